@@ -34,7 +34,11 @@
 #include <sys/ioctl.h>
 #include <sys/signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <json.h>
 
 
@@ -50,6 +54,12 @@ typedef int BOOL;
 
 #define PUBLIC
 #define STATIC    static
+#define MAX_POST_SIZE  65536  // default max size for POST data
+#define AJG_COMPRESS_LEVEL 6  // default zlib level for json responses
+#define AJG_ASSET_CACHE 4096  // default memory cap of static files cache in KB
+#define AJG_MAX_CLIENTS 256   // default max simultaneous http connections
+#define AJG_MAX_PER_IP  32    // default max simultaneous connections from one client address
+#define AJG_CONN_MEMORY 32    // default memory of one http connection in KB [headers, buffers]
 #define MAX_SNDCARDS 5  // number of active Sound Cards
 
 // prebuild json error are constructed in config-ajg
@@ -64,8 +74,13 @@ typedef struct {
   json_object *json;
 } AJG_ErrorT;
 
+// MHD connection context [con_cls], type tells endRequest how to free it
+#define AJG_CONCLS_POST   1
+#define AJG_CONCLS_DELTA  2
+
 // Post handler
 typedef struct {
+  int   type;   // AJG_CONCLS_POST, should remain first
   char* data;
   int   len;
   int   uid;
@@ -75,6 +90,78 @@ typedef struct {
 // some usefull static object initialized when entering listen loop.
 extern int verbose;
 
+#define AJG_JBUF_DEPTH 16  // max nesting of a streamed response
+
+// response format negotiated from Accept header, binary ones carry the same schema as json
+#define AJG_FORMAT_JSON    0
+#define AJG_FORMAT_CBOR    1
+#define AJG_FORMAT_MSGPACK 2
+#define AJG_FORMATS        3
+
+// reference counted response buffer, payload is handed to MHD without copy
+typedef struct {
+  int     refcount;        // [atomic]
+  size_t  len;
+  char    data [];
+} AJG_rbuf;
+
+// growable buffer for streamed json responses
+typedef struct {
+  AJG_rbuf *block;         // allocated buffer, detached when handed to MHD
+  char   *data;            // block payload, always '\0' terminated
+  size_t  len;
+  size_t  size;
+  size_t  hint;            // size of last detached block, next one starts there
+  int     plain;           // JSON_C_TO_STRING_PLAIN layout, SPACED otherwise
+  int     format;          // AJG_FORMAT_JSON, CBOR or MSGPACK
+  int     depth;
+  unsigned int members [AJG_JBUF_DEPTH]; // members already written within container at this depth
+  size_t  opened [AJG_JBUF_DEPTH];       // offset of container header [msgpack count is patched on close]
+  int     afterkey;        // next value belongs to last key
+  int     failed;          // out of memory, content is unusable
+} AJG_jbuf;
+
+// value serialized once in every response format [control metadata]
+typedef struct {
+  AJG_rbuf *formats [AJG_FORMATS]; // NULL when value is absent
+} AJG_prebuilt;
+
+// content encoding of a json API response, accepted encodings are a mask of (1 << encoding)
+#define AJG_ENCODING_IDENTITY 0
+#define AJG_ENCODING_GZIP     1
+#define AJG_ENCODING_DEFLATE  2
+#define AJG_ENCODING_BR       3  // only from precompressed static files
+#define AJG_ENCODINGS         4
+
+#define AJG_RESPCACHE_QUIET   4  // ctrl-get-all responses are cached for quiet=0..3 in every format
+#define AJG_RESPCACHE_LAYOUTS (AJG_RESPCACHE_QUIET + 1) // plus quiet=0 with shared dictionaries [dict=1]
+
+// shared dictionaries of a card, distinct enum lists and tlv blocks kept once [dict=1 responses]
+#define AJG_DICT_ENUMS 0
+#define AJG_DICT_TLVS  1
+#define AJG_DICTS      2
+
+typedef struct {
+  unsigned long long hash;
+  AJG_prebuilt value;      // blocks shared with every control using this entry
+  int     refs;            // controls using entry, free entries are null in responses and reused
+} AJG_dictentry;
+
+typedef struct {
+  AJG_dictentry *entries;  // index is the reference written in controls
+  int     count;
+  int     size;
+} AJG_dict;
+
+// ctrl-get-all response of one card, compressed variants are built on first use [slot lock]
+typedef struct {
+  unsigned long content;   // slot content generation response was built from
+  long long built;         // ms monotonic clock, responses with volatile controls expire
+  int     volat;           // response holds volatile controls
+  AJG_rbuf *variants [AJG_ENCODINGS]; // identity is set while entry is valid
+  pthread_mutex_t *lock;   // taken to add variants, NULL when slot lock protects entry
+} AJG_respcache;
+
 typedef struct {
   const char  *cardid; // sound card cardid
   int   quiet;
@@ -82,11 +169,30 @@ typedef struct {
   const char *args;
   const char *data;
 
-  void *cardhandle; // use to keep track of last card probed
+  unsigned long since;   // ctrl-get-changed generation
+  int   timeout;         // ctrl-get-changed max wait in ms
+  int   changed;         // ctrl-get-changed number of changed controls
+  struct AJG_cardslot *cardslot; // pool slot of last card probed
   char *cardname;   // cardname from alsaCardProbe
+  AJG_jbuf *jbuf;   // when set, hot responses are streamed here and NULL is returned
+  AJG_rbuf *block;  // response taken from cache instead of being written within jbuf
+  const char *ifnonematch; // If-None-Match of a GET request
+  char  etag [64];       // content tag of response [without quotes], empty when content cannot be tagged
+  int   notmodified;     // client already holds current content, nothing was written
+  AJG_respcache *respcache; // cache entry of block, holds its compressed variants
+  int   format;          // response format accepted by client [AJG_FORMAT_xxx]
+  int   dict;            // enums and tlv refer to shared dictionaries [ctrl-get-all, ctrl-get-schema]
+  int   force;           // session-load writes every control, even those already holding session value
 
 } AJG_request;
 
+// session-load outcome, skipped controls already held session value or are read only
+typedef struct {
+  int   written;
+  int   skipped;
+  int   failed;
+} AJG_loadcount;
+
 // main config structure
 typedef struct {
 
@@ -102,6 +208,16 @@ typedef struct {
   uid_t setuid;
 
   int  cacheTimeout;
+  int  poolIdle;           // close sndcard handles unused for more than poolIdle seconds
+  int  volatileRefresh;    // volatile controls cached for volatileRefresh ms [0=always read live]
+  int  workers;            // number of httpd threads [1=single select thread]
+  int  maxPost;            // max POST data size [batch requests]
+  int  compressLevel;      // zlib level of json API responses [0=no compression]
+  int  assetCache;         // memory cap in KB of static files kept in memory [0=no cache]
+  int  maxClients;         // simultaneous connections over it get a 503 [0=no limit]
+  int  maxPerIp;           // same per client address [0=no limit]
+  int  connMemory;         // memory in KB given to each connection by libmicrohttpd
+  char *fakeFaults;        // fakemod latency and errors of simulated cards [NULL=none]
 
 } AJG_config;
 
@@ -120,8 +236,343 @@ typedef struct {
   char *info;
 } AJG_sndcard;
 
+// main loop event source [fd watched through epoll]
+struct AJG_evsource;
+struct AJG_session;
+typedef void (*AJG_eventCB) (struct AJG_session *session, struct AJG_evsource *source, uint32_t revents);
+
+typedef struct AJG_evsource {
+  int     fd;
+  AJG_eventCB callback;
+  void   *context;
+  int     deleted;         // removed, will be freed at end of current event batch
+  int     timer;           // fd is a timerfd owned by source
+  AJG_eventCB timercb;     // user callback for timers
+  struct AJG_evsource *next;
+} AJG_evsource;
+
+#define AJG_POLL_MAX 4     // max poll descriptors per sndcard
+
+// In memory copy of one sndcard control, attached to its hctl element and fed by alsa events
+typedef struct AJG_sndctrl {
+  unsigned int numid;
+  void   *elem;            // snd_hctl_elem_t this control belongs to
+  void   *info;            // snd_ctl_elem_info_t, refreshed after INFO events
+  void   *value;           // snd_ctl_elem_value_t, refreshed after VALUE events
+  int     infovalid;
+  int     valuevalid;
+  int     volat;           // volatile control, value is not reported through events
+  long long readtime;      // last value read in ms [monotonic clock]
+  int     metavalid;       // static metadata, built once and copied in every response
+  char   *name;
+  const char *iface;
+  AJG_prebuilt metaCtrl;   // serialized type, count, ranges and enum items
+  AJG_prebuilt metaAcl;
+  AJG_prebuilt metaTlv;    // serialized decoded TLV, absent when control has none [shared with tlv dictionary]
+  AJG_prebuilt metaRef;    // metaCtrl with enums replaced by their dictionary index, absent without enums
+  int     enumref;         // index within slot dictionaries, -1 when none
+  int     tlvref;
+  struct AJG_cardslot *slot;
+  int     changed;         // value event not yet pushed to subscribers
+  struct AJG_sndctrl *nextchanged;
+  unsigned long generation; // pool generation of last value change [or card load]
+} AJG_sndctrl;
+
+// Alsa handle pool, one slot per opened sndcard [alsa handles are kept anonymous]
+typedef struct AJG_cardslot {
+  char   *cardid;          // devid used to open the card [hw:0, hw:USB, ...]
+  void   *ctl;             // snd_ctl_t handle, opened at first probe
+  void   *hctl;            // snd_hctl_t handle built on ctl, loaded at first control access
+  char   *id;              // static card info from snd_ctl_card_info
+  char   *name;
+  char   *driver;
+  char   *longname;
+  time_t  lastused;        // used for idle eviction and LRU replacement
+  pthread_mutex_t lock;    // serialize alsa access to this card
+  int     users;           // requests holding or waiting for this slot [pool lock]
+  AJG_evsource *watch [AJG_POLL_MAX]; // alsa poll descriptors registered in main loop
+  int     watchcount;
+  AJG_sndctrl *changed;    // controls changed by last batch of alsa events
+  int     loaded;          // hctl element list loaded, new elements are reported as changes
+  AJG_sndctrl **index;     // numid -> control, maintained on element add/remove
+  unsigned int indexsize;
+  unsigned long generation; // last change generation on this card
+  unsigned long content;   // bumped on any control change [value, info, add, remove]
+  unsigned long epoch;     // pool open counter, a reopened card [hotplug] never reuses older etags
+  int     volatiles;       // controls with known info that are volatile, their values have no etag
+  unsigned long long schema; // hash of control layout [numids, names, types, ranges, acl], ctrl-get-values position key
+  int     schemavalid;     // cleared by add, remove and info events
+  AJG_respcache respcache [AJG_RESPCACHE_LAYOUTS * AJG_FORMATS]; // ctrl-get-all responses, valid while content does not move
+  AJG_dict dicts [AJG_DICTS]; // distinct enum lists and tlv blocks of loaded controls
+} AJG_cardslot;
+
+typedef struct {
+  pthread_mutex_t lock;    // protect slot table
+  AJG_cardslot slots [MAX_SNDCARDS];
+  unsigned long hits;      // request served with an already opened handle
+  unsigned long misses;    // request that had to open the sndcard
+  unsigned long loads;     // full hctl element list loads
+  unsigned long reopens;   // handle dropped after an error or card removal
+  unsigned long evictions; // handle closed on idle timeout or LRU replacement
+  unsigned long events;    // alsa control events received
+  unsigned long cached;    // control values served from memory
+  unsigned long reads;     // control values read from sndcard
+  unsigned long generation; // change counter shared by every card, never goes back [atomic]
+  unsigned long epochs;    // cards opened since start [pool lock]
+  unsigned long cards;     // card list generation, bumped on slot open, close and /dev/snd changes [pool lock]
+  int     hotplug;         // inotify on /dev/snd, -1 when card list changes cannot be seen
+  time_t  started;         // part of every etag, tags from a previous run never match
+} AJG_cardpool;
+
+// parked ctrl-get-changed request, waits for a change on its card
+#define AJG_DELTA_PARKED  1
+#define AJG_DELTA_WOKEN   2
+#define AJG_DELTA_EXPIRED 3
+
+typedef struct AJG_delta {
+  int     type;            // AJG_CONCLS_DELTA, should remain first
+  int     state;
+  void   *connection;      // suspended MHD connection
+  char   *cardid;
+  long long deadline;      // ms monotonic clock
+  struct AJG_delta *next;
+} AJG_delta;
+
+typedef struct {
+  pthread_mutex_t lock;
+  AJG_delta *parked;
+  AJG_evsource *timer;     // only armed while requests are parked
+  unsigned long waiting;   // requests currently parked
+  unsigned long woken;     // resumed by a change
+  unsigned long expired;   // resumed by timeout
+} AJG_deltapoll;
+
+// websocket frame shared by every client it is queued to
+typedef struct {
+  int     refcount;        // [websock lock]
+  size_t  len;
+  char    frame[];         // header + payload ready to send
+} AJG_wsmsg;
+
+// websocket subscription to one card, numids==NULL for every control
+typedef struct AJG_wssub {
+  char   *cardid;
+  int    *numids;
+  int     count;
+  struct AJG_wssub *next;
+} AJG_wssub;
+
+#define AJG_WS_QUEUE   256   // max pending messages per client, slower clients are dropped
+#define AJG_WS_INSIZE  4096  // max client message
+
+typedef struct AJG_wsclient {
+  int     fd;
+  void   *urh;             // MHD upgrade handle, used to close connection
+  AJG_evsource *source;
+  int     closing;         // close once pending messages are flushed
+  int     writing;         // EPOLLOUT armed
+  AJG_wsmsg *queue [AJG_WS_QUEUE];
+  int     qhead;
+  int     qcount;
+  size_t  qoffset;         // bytes already sent from queue head
+  AJG_wssub *subs;
+  size_t  inlen;
+  char    inbuf [AJG_WS_INSIZE];
+  struct AJG_wsclient *next;
+} AJG_wsclient;
+
+typedef struct {
+  pthread_mutex_t lock;    // protect client list, queues and subscriptions
+  AJG_wsclient *clients;
+  unsigned long connected; // clients currently connected
+  unsigned long accepted;
+  unsigned long messages;  // change events serialized
+  unsigned long frames;    // frames queued [one message is queued to many clients]
+  unsigned long dropped;   // clients dropped because of a full queue
+} AJG_websock;
+
+// static file kept in memory with its precompressed siblings
+typedef struct AJG_asset {
+  char   *filepath;
+  int     wd;              // inotify watch of its directory
+  const char *mime;
+  off_t   size;
+  struct timespec mtime;
+  AJG_rbuf *variants [AJG_ENCODINGS]; // identity, file.gz, file.br
+  size_t  memory;          // bytes held by every variant
+  unsigned long lastused;
+  struct AJG_asset *next;
+} AJG_asset;
+
+#define AJG_ASSET_BUCKETS 256
+
+typedef struct {
+  pthread_mutex_t lock;    // protect table and counters
+  AJG_asset *buckets [AJG_ASSET_BUCKETS];
+  int     inotify;         // -1 when files are not cached
+  size_t  memory;
+  unsigned long clock;     // lru counter
+  unsigned long files;
+  unsigned long hits;      // files served from memory
+  unsigned long misses;    // files looked up but not in memory
+  unsigned long uncached;  // files sent from disk [too large, no inotify] [atomic]
+  unsigned long evictions; // files dropped to respect memory cap
+  unsigned long invalidations; // files dropped after an inotify event
+  unsigned long *wdgens;   // per watch generation, bumped by every event of its directory
+  int     wdsize;
+  unsigned long generation; // bumped when events are lost, added to every watch generation
+} AJG_assets;
+
+// cached file variant handed to httpd, block is held until response is freed
 typedef struct {
+  AJG_rbuf *block;
+  int     encoding;
+  const char *mime;
+  off_t   size;
+  struct timespec mtime;
+  int     vary;            // file has precompressed variants
+} AJG_assetref;
+
+// client address holding connections, entry is freed with its last connection
+typedef struct AJG_clientip {
+  unsigned char addr [16]; // ipv4 stored as v4-mapped ipv6
+  int     count;
+  struct AJG_clientip *next;
+} AJG_clientip;
+
+// one tcp connection [MHD socket context]
+typedef struct {
+  AJG_clientip *ip;
+  int     busy;            // accepted over limits, its requests only get a 503
+} AJG_client;
+
+#define AJG_ADMIT_BUCKETS 64
+#define AJG_ADMIT_SLACK   16   // connections over limits still accepted to send their 503
+#define AJG_RETRY_AFTER   "2"  // seconds
+
+typedef struct {
+  pthread_mutex_t lock;    // protect table and counters
+  AJG_clientip *buckets [AJG_ADMIT_BUCKETS];
+  void   *busy;            // prebuilt 503 response shared by every rejected request
+  int     active;          // open connections
+  unsigned long accepted;  // connections within limits
+  unsigned long rejected;  // connections over limits or refused [localhost only]
+  unsigned long timedout;  // requests ended by connection timeout [atomic]
+} AJG_admit;
+
+// fakemod response file kept serialized, loaded again after an inotify event
+typedef struct AJG_fakefile {
+  char   *name;            // file name without .ajg [CTRL_GET_ALL-hw:0]
+  AJG_respcache cache;     // serialized response and its compressed variants
+  int     stale;           // file changed since it was loaded
+  unsigned long hits;
+  unsigned long loads;
+  struct AJG_fakefile *next;
+} AJG_fakefile;
+
+typedef struct {
+  pthread_mutex_t lock;    // protect file list, responses and counters
+  AJG_fakefile *files;     // only files found on disk, never freed
+  int     inotify;         // -1 when files are read on every request
+  unsigned long reloads;   // files changed on disk
+} AJG_fake;
+
+// fakemod simulated control, static part comes from a CTRL_GET_ALL sample
+#define AJG_SIMUL_BOOLEAN    0
+#define AJG_SIMUL_INTEGER    1
+#define AJG_SIMUL_ENUMERATED 2
+#define AJG_SIMUL_OTHER      3   // sampled values, never written
+
+typedef struct {
+  int     numid;
+  char   *name;
+  char   *iface;
+  int     type;
+  int     count;           // values per control
+  long long min;           // values are clamped within range [enums: item index]
+  long long max;
+  char  **enums;           // enum item names
+  int     items;
+  int     actif;
+  int     readable;
+  int     writable;
+  int     offset;          // first value within card values
+  AJG_prebuilt metaCtrl;   // sample ctrl, acl and tlv as they are
+  AJG_prebuilt metaAcl;
+  AJG_prebuilt metaTlv;
+} AJG_simctrl;
+
+// parsed sample, read only and shared by every card simulated from it
+typedef struct AJG_simmodel {
+  char   *name;            // sample cardid [hw:18i8 for CTRL_GET_ALL-hw:18i8.ajg]
+  char   *id;              // sndcard description
+  char   *cardname;
+  char   *driver;
+  char   *info;
+  AJG_simctrl *ctrls;      // sample order
+  int     count;
+  AJG_simctrl **index;     // by numid
+  int     maxnumid;
+  int     values;          // values per card
+  long long *defaults;     // sample values
+  struct AJG_simmodel *next;
+} AJG_simmodel;
+
+typedef struct AJG_simcard {
+  char   *cardid;
+  AJG_simmodel *model;
+  pthread_mutex_t lock;    // protect values and counters
+  long long *values;
+  unsigned long reads;      // atomic
+  unsigned long writes;     // atomic
+  unsigned long removed;    // back at this monotonic ms after a simulated removal, 0 when present
+  struct AJG_simcard *next;
+} AJG_simcard;
+
+// injected faults of one card operation [--fake-faults]
+#define AJG_SIMUL_PROBE  0
+#define AJG_SIMUL_READ   1
+#define AJG_SIMUL_WRITE  2
+#define AJG_SIMUL_TLV    3
+#define AJG_SIMUL_FAULTS 4
+#define AJG_SIMUL_REMOVAL_TIME 5000  // ms
+
+typedef struct {
+  int     min;             // latency ms, uniform within min-max
+  int     max;
+  int     tail;            // latency ms of tailrate% operations
+  double  tailrate;
+  double  errors;          // % of operations failing with EAGAIN
+  unsigned long delayed;   // atomic counters
+  unsigned long failed;
+} AJG_simfault;
+
+#define AJG_SIMUL_BUCKETS  64
+#define AJG_SIMUL_MAXCARDS 4096
+#define AJG_SIMUL_CLONE    "~"   // hw:18i8~12 is one more card simulated from hw:18i8 sample
+
+typedef struct {
+  pthread_mutex_t lock;    // protect models and card table, never freed
+  AJG_simmodel *models;
+  AJG_simcard  *buckets [AJG_SIMUL_BUCKETS];
+  int     cards;
+  int     faulty;          // faults are injected
+  char   *faultcard;       // only within this cardid, every simulated card when NULL
+  AJG_simfault faults [AJG_SIMUL_FAULTS];
+  double  removal;         // % of probes removing card
+  int     removaltime;     // ms before a removed card comes back
+  unsigned long removals;  // atomic
+} AJG_simul;
+
+typedef struct AJG_session {
   AJG_config  *config;   // pointer to current config
+  AJG_cardpool *cardpool; // persistent alsa handles
+  AJG_websock  *websock;  // realtime control change subscribers
+  AJG_deltapoll *deltapoll; // parked ctrl-get-changed requests
+  AJG_assets   *assets;   // static files kept in memory
+  AJG_admit    *admit;    // http connection limits
+  AJG_fake     *fake;     // fakemod responses
+  AJG_simul    *simul;    // fakemod simulated sndcards
 
   // List of commands to execute
   int  killPrevious;
@@ -132,6 +583,8 @@ typedef struct {
 
   char *cacheTimeout;     // http require timeout to be a string
   void *httpd;            // anonymous structure for httpd handler
+  int  epollfd;           // main loop
+  int  httpdexternal;     // httpd driven by main loop [no internal httpd thread]
   int  fakemod;           // respond to GET/POST request without interacting with sndboard
   int  forceexit;         // when autoconfig from script force exit before starting server
 } AJG_session;
@@ -139,7 +592,23 @@ typedef struct {
 //  List of HTTP Query Commands
 typedef enum  {
       CARD_GET_NAME, GATEWAY_PING, CARD_GET_ALL, CARD_GET_ONE, CTRL_GET_ALL,
-      CTRL_GET_ONE, CTRL_SET_ONE, CTRL_SET_MANY, SESSION_LIST, SESSION_STORE, SESSION_LOAD
+      CTRL_GET_ONE, CTRL_SET_ONE, CTRL_SET_MANY, SESSION_LIST, SESSION_STORE, SESSION_LOAD,
+      GATEWAY_STATS, CTRL_GET_CHANGED, REQUEST_BATCH, CTRL_GET_MANY, CTRL_GET_SCHEMA, CTRL_GET_VALUES
 } AJG_REST_CMD;
 
+// resource style API [/api/v2/cards/{cardid}/controls/{numid}], same commands as request= queries
+#define AJG_ROUTE_PREFIX    "/api/v2/"
+#define AJG_ROUTE_DEPTH     6    // max path segments
+#define AJG_ROUTE_NOTFOUND  -1
+#define AJG_ROUTE_BADMETHOD -2
+
+// path parameters, parsed once when route matches
+typedef struct {
+  AJG_REST_CMD cmd;
+  const char *name;        // request= name of command [messages, verbose]
+  char    cardid [32];
+  int     numid;           // -1 when not within path
+  char    session [64];
+} AJG_route;
+
 #include "proto-def-ajg.h"
@@ -29,6 +29,41 @@ PUBLIC json_object *alsaProbeCard    (AJG_session *session, AJG_request *request
 PUBLIC json_object *alsaListSession  (AJG_session *session, AJG_request *request);
 PUBLIC json_object *alsaStoreSession (AJG_session *session, AJG_request *request);
 PUBLIC json_object *alsaLoadSession  (AJG_session *session, AJG_request *request);
+PUBLIC int alsaWriteChange           (AJG_session *session, AJG_sndctrl *ctrl, AJG_jbuf *jbuf, const char *cardid);
+PUBLIC json_object *alsaGetChanged   (AJG_session *session, AJG_request *request);
+PUBLIC json_object *alsaGetManyCtrl  (AJG_session *session, AJG_request *request);
+PUBLIC json_object *alsaGetSchema    (AJG_session *session, AJG_request *request);
+PUBLIC json_object *alsaGetValues    (AJG_session *session, AJG_request *request);
+
+
+// Alsa handle pool
+PUBLIC void poolInit                 (AJG_session *session);
+PUBLIC AJG_cardslot *poolGetCard     (AJG_session *session, const char *cardid, int *err);
+PUBLIC void poolReleaseCard          (AJG_session *session, AJG_cardslot *slot);
+PUBLIC int poolLoadCard              (AJG_session *session, AJG_cardslot *slot);
+PUBLIC void poolFailCard             (AJG_session *session, AJG_cardslot *slot, int err);
+PUBLIC void poolStartTimer           (AJG_session *session);
+PUBLIC void poolStartHotplug         (AJG_session *session);
+PUBLIC unsigned long poolCardsGeneration (AJG_session *session);
+PUBLIC void poolEvictIdle            (AJG_session *session);
+PUBLIC void poolCloseAll             (AJG_session *session);
+PUBLIC json_object *poolStats        (AJG_session *session);
+
+
+// Control value cache [alsa types are anonymous outside alsa modules]
+PUBLIC void cacheAttachCard          (AJG_session *session, AJG_cardslot *slot, void *hctl);
+PUBLIC AJG_sndctrl *cacheFindCtrl    (AJG_cardslot *slot, int numid);
+PUBLIC int  cacheUpdateCard          (AJG_session *session, AJG_cardslot *slot);
+PUBLIC void *cacheGetInfo            (AJG_session *session, AJG_sndctrl *ctrl, int *err);
+PUBLIC void *cacheGetValue           (AJG_session *session, AJG_sndctrl *ctrl, int *err);
+PUBLIC void cacheDirtyCtrl           (AJG_sndctrl *ctrl);
+PUBLIC int  cacheIntern              (AJG_cardslot *slot, int dict, json_object *valueJ, AJG_prebuilt *prebuilt);
+PUBLIC void cacheDropDicts           (AJG_cardslot *slot);
+PUBLIC void cacheDropResponses       (AJG_cardslot *slot);
+PUBLIC AJG_respcache *cacheResponseEntry (AJG_cardslot *slot, int quiet, int dict, int format);
+PUBLIC AJG_rbuf *cacheGetResponse    (AJG_session *session, AJG_cardslot *slot, AJG_respcache *entry);
+PUBLIC void cacheStoreResponse       (AJG_session *session, AJG_cardslot *slot, AJG_respcache *entry, AJG_rbuf *block, int volat);
+PUBLIC AJG_rbuf *cacheEncodeResponse (AJG_session *session, AJG_respcache *entry, int encoding);
 
 
 // Session handling
@@ -42,6 +77,113 @@ PUBLIC json_object *sessionFromDisk  (AJG_session *session, AJG_request *request
 PUBLIC AJG_ERROR httpdStart          (AJG_session *session);
 PUBLIC AJG_ERROR httpdLoop           (AJG_session *session);
 PUBLIC void  httpdStop               (AJG_session *session);
+PUBLIC json_object *httpdStats       (AJG_session *session);
+PUBLIC int httpdEtagMatch            (const char *header, const char *etag);
+
+
+// Websocket change notification
+PUBLIC void wsockInit                (AJG_session *session);
+PUBLIC int wsockRequest              (void *connection, AJG_session *session, const char *method);
+PUBLIC void wsockNotify              (AJG_session *session, AJG_cardslot *slot, AJG_sndctrl *ctrl);
+PUBLIC int wsockWatching             (AJG_session *session, const char *cardid);
+PUBLIC json_object *wsockStats       (AJG_session *session);
+
+
+// Long-poll on control changes
+PUBLIC void deltaInit                (AJG_session *session);
+PUBLIC void deltaPark                (AJG_session *session, void *connection, void **con_cls, const char *cardid, int timeout);
+PUBLIC void deltaWake                (AJG_session *session, AJG_cardslot *slot);
+PUBLIC void deltaRelease             (AJG_session *session, AJG_delta *delta);
+PUBLIC json_object *deltaStats       (AJG_session *session);
+
+
+// Main event loop
+PUBLIC AJG_ERROR eventInit           (AJG_session *session);
+PUBLIC AJG_evsource *eventAdd        (AJG_session *session, int fd, uint32_t events, AJG_eventCB callback, void *context);
+PUBLIC int eventMod                  (AJG_session *session, AJG_evsource *source, uint32_t events);
+PUBLIC void eventDel                 (AJG_session *session, AJG_evsource *source);
+PUBLIC AJG_evsource *eventTimer      (AJG_session *session, int period, AJG_eventCB callback, void *context);
+PUBLIC int eventWait                 (AJG_session *session, int timeout);
+
+
+// Streaming json writer
+PUBLIC void jbufInit                 (AJG_jbuf *jbuf, int plain);
+PUBLIC void jbufReset                (AJG_jbuf *jbuf);
+PUBLIC void jbufFree                 (AJG_jbuf *jbuf);
+PUBLIC AJG_jbuf *jbufThread          (void);
+PUBLIC AJG_rbuf *jbufDetach          (AJG_jbuf *jbuf);
+PUBLIC void jbufHold                 (AJG_rbuf *block);
+PUBLIC void jbufRelease              (AJG_rbuf *block);
+PUBLIC AJG_rbuf *jbufBlock           (void *data);
+PUBLIC void jbufObjectStart          (AJG_jbuf *jbuf);
+PUBLIC void jbufObjectEnd            (AJG_jbuf *jbuf);
+PUBLIC void jbufArrayStart           (AJG_jbuf *jbuf);
+PUBLIC void jbufArrayEnd             (AJG_jbuf *jbuf);
+PUBLIC void jbufKey                  (AJG_jbuf *jbuf, const char *key);
+PUBLIC void jbufString               (AJG_jbuf *jbuf, const char *value);
+PUBLIC void jbufInt                  (AJG_jbuf *jbuf, long long value);
+PUBLIC void jbufBool                 (AJG_jbuf *jbuf, int value);
+PUBLIC void jbufRaw                  (AJG_jbuf *jbuf, const char *text);
+PUBLIC void jbufJson                 (AJG_jbuf *jbuf, json_object *jsonObj);
+PUBLIC json_object *jbufParse        (AJG_jbuf *jbuf);
+PUBLIC void jbufPrebuild             (AJG_prebuilt *prebuilt, json_object *jsonObj);
+PUBLIC void jbufPrebuiltFree         (AJG_prebuilt *prebuilt);
+PUBLIC void jbufPrebuilt             (AJG_jbuf *jbuf, const AJG_prebuilt *prebuilt);
+PUBLIC int jbufAccept                (const char *header);
+PUBLIC const char *jbufMime          (int format);
+PUBLIC const char *jbufFormatName    (int format);
+
+
+// Response compression
+PUBLIC int compressAccept            (const char *header);
+PUBLIC int compressChoose            (AJG_session *session, int accept, size_t len);
+PUBLIC const char *compressName      (int encoding);
+PUBLIC AJG_rbuf *compressBlock       (AJG_session *session, AJG_rbuf *block, int encoding);
+
+
+// Static files cache
+PUBLIC void assetInit                (AJG_session *session);
+PUBLIC void assetStart               (AJG_session *session);
+PUBLIC const char *assetMime         (const char *filepath);
+PUBLIC int assetFind                 (AJG_session *session, const char *filepath, int accept, AJG_assetref *ref);
+PUBLIC int assetLoad                 (AJG_session *session, const char *filepath, int fd, struct stat *sbuf, int accept, AJG_assetref *ref);
+PUBLIC json_object *assetStats       (AJG_session *session);
+
+
+// REST v2 path router
+PUBLIC void routeInit                (void);
+PUBLIC int routeMatch                (const char *method, const char *path, AJG_route *route);
+
+
+// Http connection admission
+PUBLIC void admitInit                (AJG_session *session);
+PUBLIC int admitAccept               (AJG_session *session, const struct sockaddr *addr);
+PUBLIC AJG_client *admitOpen         (AJG_session *session, void *connection);
+PUBLIC void admitClose               (AJG_session *session, AJG_client *client);
+PUBLIC int admitBusy                 (AJG_session *session, void *connection);
+PUBLIC int admitReject               (AJG_session *session, void *connection);
+PUBLIC void admitTimeout             (AJG_session *session);
+PUBLIC json_object *admitStats       (AJG_session *session);
+
+
+// fakemod responses
+PUBLIC void fakeInit                 (AJG_session *session);
+PUBLIC void fakeStart                (AJG_session *session);
+PUBLIC json_object *fakeResponse     (AJG_session *session, AJG_request *request, const char *name, int tree);
+PUBLIC json_object *fakeStats        (AJG_session *session);
+
+
+// fakemod simulated sndcards
+PUBLIC void simulInit                (AJG_session *session);
+PUBLIC AJG_simcard *simulFind        (AJG_session *session, const char *cardid);
+PUBLIC json_object *simulWriteProbe  (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf);
+PUBLIC json_object *simulWriteControls (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf);
+PUBLIC json_object *simulWriteManyCtrl (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf);
+PUBLIC json_object *simulWriteSetOne (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf);
+PUBLIC json_object *simulSetMany     (AJG_session *session, AJG_request *request);
+PUBLIC int simulLoadSession          (AJG_session *session, AJG_request *request, json_object *controls, AJG_loadcount *count);
+PUBLIC int simulSetFaults            (AJG_session *session, const char *spec);
+PUBLIC json_object *simulStats       (AJG_session *session);
 
 
 // config management
@@ -49,6 +191,8 @@ PUBLIC char *configTime        (void);
 PUBLIC AJG_session *configInit (void);
 PUBLIC json_object *jsonNewMessage (AJG_ERROR level, char* format, ...);
 PUBLIC json_object *jsonNewStatus (AJG_ERROR level);
+PUBLIC void jsonWriteStatus (AJG_jbuf *jbuf, AJG_ERROR level);
+PUBLIC void jsonWriteMessage (AJG_jbuf *jbuf, AJG_ERROR level, char* format, ...);
 PUBLIC json_object *jsonNewAjgType (void);
 PUBLIC json_object *jsonNewMessage (AJG_ERROR level, char* format, ...);
 PUBLIC void jsonDumpObject (json_object * jObject);
@@ -0,0 +1,204 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Admission control of http connections. Every connection is counted when
+    libmicrohttpd accepts it, globally and per client address. Connections
+    over config->maxClients or config->maxPerIp are still accepted but their
+    requests get a prebuilt 503 with Retry-After and the connection is closed,
+    a client opening too many sockets gets an answer instead of holding the
+    serving thread. Beyond AJG_ADMIT_SLACK more connections libmicrohttpd
+    closes them at accept without any answer.
+
+    With config->localhostOnly clients not coming from loopback are refused
+    at accept.
+
+   References:
+   https://tools.ietf.org/html/rfc7231#section-6.6.4
+   https://www.gnu.org/software/libmicrohttpd/manual/html_node/microhttpd_002dinfo_002dconn.html
+*/
+
+#include <microhttpd.h>
+#include <netinet/in.h>
+
+#include "local-def-ajg.h"
+
+// client address as 16 bytes, ipv4 is v4-mapped [::ffff:a.b.c.d]
+STATIC void admitAddress (const struct sockaddr *addr, unsigned char *key) {
+
+    memset (key, 0, 16);
+    if (addr == NULL) return;
+
+    if (addr->sa_family == AF_INET) {
+        key[10] = key[11] = 0xff;
+        memcpy (&key[12], &((const struct sockaddr_in*) addr)->sin_addr, 4);
+    } else if (addr->sa_family == AF_INET6) {
+        memcpy (key, &((const struct sockaddr_in6*) addr)->sin6_addr, 16);
+    }
+}
+
+STATIC unsigned int admitHash (const unsigned char *key) {
+    unsigned int hash = 2166136261u;
+    int idx;
+
+    for (idx=0; idx < 16; idx++) hash = (hash ^ key[idx]) * 16777619u;
+    return hash % AJG_ADMIT_BUCKETS;
+}
+
+PUBLIC void admitInit (AJG_session *session) {
+    AJG_admit *admit;
+    json_object *busyJ;
+    const char *body;
+
+    admit = calloc (1, sizeof (AJG_admit));
+    pthread_mutex_init (&admit->lock, NULL);
+
+    // same 503 for every rejected request, MHD responses are reference counted
+    busyJ = jsonNewMessage (AJG_FAIL, "Gateway busy, retry in %ss", AJG_RETRY_AFTER);
+    body  = json_object_to_json_string (busyJ);
+    admit->busy = MHD_create_response_from_buffer (strlen (body), (void*) body, MHD_RESPMEM_MUST_COPY);
+    json_object_put (busyJ);
+
+    if (admit->busy) {
+        MHD_add_response_header (admit->busy, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+        MHD_add_response_header (admit->busy, MHD_HTTP_HEADER_RETRY_AFTER, AJG_RETRY_AFTER);
+        MHD_add_response_header (admit->busy, MHD_HTTP_HEADER_CONNECTION, "close");
+    }
+    session->admit = admit;
+}
+
+// MHD accept policy, only loopback clients when config->localhostOnly
+PUBLIC int admitAccept (AJG_session *session, const struct sockaddr *addr) {
+    static const unsigned char loopback6 [16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1};
+    AJG_admit *admit = session->admit;
+    unsigned char key [16];
+
+    if (!session->config->localhostOnly) return MHD_YES;
+
+    admitAddress (addr, key);
+    if (!memcmp (key, loopback6, 16)) return MHD_YES;
+    if (key[10] == 0xff && key[11] == 0xff && key[12] == 127 && !memcmp (key, loopback6, 10)) return MHD_YES;
+
+    pthread_mutex_lock (&admit->lock);
+    admit->rejected++;
+    pthread_mutex_unlock (&admit->lock);
+
+    if (verbose) fprintf (stderr, "AJG: refused non local client [--localhost]\n");
+    return MHD_NO;
+}
+
+// MHD connection started, count it and decide at once whether it is served.
+// Returned client is the MHD socket context, NULL when out of memory [treated as busy]
+PUBLIC AJG_client *admitOpen (AJG_session *session, void *connection) {
+    AJG_admit *admit = session->admit;
+    const union MHD_ConnectionInfo *info;
+    AJG_clientip *ip;
+    AJG_client *client;
+    unsigned char key [16];
+    unsigned int bucket;
+
+    info = MHD_get_connection_info (connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+    admitAddress (info ? info->client_addr : NULL, key);
+    bucket = admitHash (key);
+
+    if ((client = malloc (sizeof (AJG_client))) == NULL) return NULL;
+
+    pthread_mutex_lock (&admit->lock);
+    for (ip = admit->buckets[bucket]; ip != NULL; ip = ip->next) {
+        if (!memcmp (ip->addr, key, 16)) break;
+    }
+    if (ip == NULL && (ip = calloc (1, sizeof (AJG_clientip))) != NULL) {
+        memcpy (ip->addr, key, 16);
+        ip->next = admit->buckets[bucket];
+        admit->buckets[bucket] = ip;
+    }
+    if (ip == NULL) {
+        pthread_mutex_unlock (&admit->lock);
+        free (client);
+        return NULL;
+    }
+
+    ip->count++;
+    admit->active++;
+    client->ip = ip;
+    client->busy = (session->config->maxClients > 0 && admit->active > session->config->maxClients)
+                || (session->config->maxPerIp > 0 && ip->count > session->config->maxPerIp);
+    if (client->busy) admit->rejected++;
+    else admit->accepted++;
+    if (verbose && client->busy) fprintf (stderr, "AJG: connection over limits active=%d from client=%d\n", admit->active, ip->count);
+    pthread_mutex_unlock (&admit->lock);
+
+    return client;
+}
+
+// MHD connection closed, client address is forgotten with its last connection
+PUBLIC void admitClose (AJG_session *session, AJG_client *client) {
+    AJG_admit *admit = session->admit;
+    AJG_clientip **prev;
+
+    if (client == NULL) return;
+
+    pthread_mutex_lock (&admit->lock);
+    admit->active--;
+    if (--client->ip->count == 0) {
+        for (prev = &admit->buckets[admitHash (client->ip->addr)]; *prev != NULL; prev = &(*prev)->next) {
+            if (*prev == client->ip) {
+                *prev = client->ip->next;
+                free (client->ip);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock (&admit->lock);
+    free (client);
+}
+
+// connection was accepted over limits
+PUBLIC int admitBusy (AJG_session *session, void *connection) {
+    const union MHD_ConnectionInfo *info;
+    AJG_client *client;
+
+    info = MHD_get_connection_info (connection, MHD_CONNECTION_INFO_SOCKET_CONTEXT);
+    client = info ? info->socket_context : NULL;
+    return (client == NULL || client->busy);
+}
+
+// answer without reading request any further, connection closes after it
+PUBLIC int admitReject (AJG_session *session, void *connection) {
+    if (session->admit->busy == NULL) return MHD_NO;
+    return MHD_queue_response (connection, MHD_HTTP_SERVICE_UNAVAILABLE, session->admit->busy);
+}
+
+PUBLIC void admitTimeout (AJG_session *session) {
+    __sync_fetch_and_add (&session->admit->timedout, 1);
+}
+
+PUBLIC json_object *admitStats (AJG_session *session) {
+    AJG_admit *admit = session->admit;
+    json_object *statsJ = json_object_new_object();
+
+    pthread_mutex_lock (&admit->lock);
+    json_object_object_add (statsJ, "active"   , json_object_new_int (admit->active));
+    json_object_object_add (statsJ, "accepted" , json_object_new_int64 (admit->accepted));
+    json_object_object_add (statsJ, "rejected" , json_object_new_int64 (admit->rejected));
+    json_object_object_add (statsJ, "timedout" , json_object_new_int64 (admit->timedout));
+    pthread_mutex_unlock (&admit->lock);
+
+    return statsJ;
+}
@@ -33,165 +33,218 @@
 #define AJG_ALSACTL_JTYPE "AJG_ctrls"
 #define AJG_SNDCARD_JTYPE "AJG_sndcard"
 #define AJG_SNDLIST_JTYPE "AJG_sndlist"
+#define AJG_CHANGES_JTYPE "AJG_changes"
+#define AJG_SCHEMA_JTYPE  "AJG_schema"
+#define AJG_VALUES_JTYPE  "AJG_values"
 
-// in fakemod response comes from disk
+// in fakemod response comes from disk [rootdir/fakemod/xxx.ajg], files are cached by fake module.
+// Cards with a CTRL_GET_ALL sample are simulated instead [simul module]
 STATIC json_object *alsaFakeResponse (AJG_session *session, AJG_request *request, AJG_REST_CMD fakecmd) {
-    json_object *fakeResponse;
+    const char *name;
     char filename[256];
 
-    strncpy (filename, session->config->rootdir, sizeof(filename));
-    strncat (filename, "/fakemod/", sizeof(filename) - 1);
-
     switch (fakecmd) {
-     case  CARD_GET_NAME:
-           strncat (filename, "CARD_GET_NAME", sizeof(filename) - 1);
-           break;
-     case  GATEWAY_PING:
-           strncat (filename, "GATEWAY_PING", sizeof(filename) - 1);
-           break;
-     case  CARD_GET_ALL:
-           strncat (filename, "CARD_GET_ALL", sizeof(filename) - 1);
-           break;
-     case  CARD_GET_ONE:
-           strncat (filename, "CARD_GET_ONE", sizeof(filename) - 1);
-           break;
+     case  CARD_GET_NAME: name = "CARD_GET_NAME"; break;
+     case  GATEWAY_PING:  name = "GATEWAY_PING";  break;
+     case  CARD_GET_ALL:  name = "CARD_GET_ALL";  break;
+     case  CARD_GET_ONE:  name = "CARD_GET_ONE";  break;
+     case  CTRL_GET_ONE:  name = "CTRL_GET_ONE";  break;
+     case  CTRL_SET_ONE:  name = "CTRL_SET_ONE";  break;
+     case  CTRL_SET_MANY: name = "CTRL_SET_MANY"; break;
      case  CTRL_GET_ALL:
-           strncat (filename, "CTRL_GET_ALL-", sizeof(filename) - 1);
-           strncat (filename, request->cardid, sizeof(filename) - 1);
-           break;
-     case  CTRL_GET_ONE:
-           strncat (filename, "CTRL_GET_ONE", sizeof(filename) - 1);
-           break;
-     case  CTRL_SET_ONE:
-           strncat (filename, "CTRL_SET_ONE", sizeof(filename) - 1);
-           break;
-     case  CTRL_SET_MANY:
-           strncat (filename, "CTRL_SET_MANY", sizeof(filename) - 1);
+           snprintf (filename, sizeof(filename), "CTRL_GET_ALL-%s", request->cardid ? request->cardid : "");
+           name = filename;
            break;
 
      default:
-         jsonNewMessage (AJG_FAIL, "FakeModResponse CMD=%d not supported", fakecmd);
+         return jsonNewMessage (AJG_FAIL, "FakeModResponse CMD=%d not supported", fakecmd);
     }
 
-    // just upload json object and return without any further processing
-    strncat (filename, ".ajg", sizeof(filename) - 1);
-    fakeResponse = json_object_from_file (filename);
+    // card name is read back from response, it is always returned as a tree
+    return fakeResponse (session, request, name, fakecmd == CARD_GET_NAME);
+}
+
+// stream response into request->jbuf when provided, otherwise return it as a json-c tree.
+// Writers return NULL once their response is written, or a json-c response [errors, fakemod].
+typedef json_object *(*AJG_alsaWriter) (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf);
+
+STATIC json_object *alsaResponse (AJG_session *session, AJG_request *request, AJG_alsaWriter writer) {
+    json_object *response;
+    AJG_jbuf jbuf;
+
+    if (request->jbuf) return writer (session, request, request->jbuf);
+
+    jbufInit (&jbuf, FALSE);
+    response = writer (session, request, &jbuf);
+    if (response == NULL) response = jbufParse (&jbuf);
+    jbufFree (&jbuf);
+    return response;
+}
+
+// tag response from card state, TRUE when client already holds this content [If-None-Match]
+STATIC int alsaCheckEtag (AJG_session *session, AJG_request *request, unsigned long epoch, unsigned long long content) {
+
+    // binary formats are other representations of the same content
+    snprintf (request->etag, sizeof (request->etag), "%lx-%lx-%llx%s%s", (unsigned long) session->cardpool->started, epoch, content
+             , request->format ? "-" : "", request->format ? jbufFormatName (request->format) : "");
+    request->notmodified = httpdEtagMatch (request->ifnonematch, request->etag);
+    return request->notmodified;
+}
+
+// get sndcard handle from pool and push it with cardname into request, return NULL on error
+STATIC AJG_cardslot *alsaProbeSlot (AJG_session *session, AJG_request *request, json_object **errMessage) {
+      AJG_cardslot *slot;
+      int err;
+
+      // sndcard handle and static info come from pool, card is only opened once.
+      // A request already holding this card [batch, set then get] keeps it, any other previous card is released.
+      slot = request->cardslot;
+      if (slot == NULL || slot->cardid == NULL || request->cardid == NULL || strcmp (slot->cardid, request->cardid)) {
+          poolReleaseCard (session, request->cardslot);
+          request->cardslot = NULL;
+          slot = poolGetCard (session, request->cardid, &err);
+      }
+      if (slot == NULL) {
+          if (err == -ENOENT || err == -ENODEV) *errMessage = jsonNewMessage (AJG_EMPTY, "SndCard [%s] Not Found", request->cardid);
+          else *errMessage = jsonNewMessage (AJG_FAIL, "SndCard [%s] info error: %s", request->cardid, snd_strerror(err));
+          return NULL;
+      }
+
+      if (request->cardname) free (request->cardname);
+      request->cardname = strdup (slot->name); // save cardname for session management
+
+      // keep track of probed handle for further control access
+      request->cardslot = slot;
+      return slot;
+}
+
+// write sndcard description from its pool slot
+STATIC void alsaWriteCard (AJG_jbuf *jbuf, AJG_cardslot *slot, AJG_request *request) {
+
+      jbufObjectStart (jbuf);
+      jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_SNDCARD_JTYPE);
+      jbufKey (jbuf, "cardid");  jbufString (jbuf, slot->id);
+      jbufKey (jbuf, "name");    jbufString (jbuf, slot->name);
+
+      if (!request->quiet) {
+          jbufKey (jbuf, "devid");  jbufString (jbuf, request->cardid);
+          jbufKey (jbuf, "driver"); jbufString (jbuf, slot->driver);
+          jbufKey (jbuf, "info");   jbufString (jbuf, slot->longname);
+          if (verbose) fprintf (stderr, "AJG: Soundcard Devid=%-5s Cardid=%-7s Name=%s\n", request->cardid, slot->id, slot->longname);
+      }
+      jbufObjectEnd (jbuf);
+}
 
-    // if not fakemessage for this request build an error message
-    if (fakeResponse == NULL) jsonNewMessage (AJG_FAIL, "FakeModResponse file=%s not found or invalid", filename);
+STATIC json_object *alsaWriteProbe (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+      json_object *errMessage;
+      AJG_cardslot *slot;
 
-    return fakeResponse;
+      if ((slot = alsaProbeSlot (session, request, &errMessage)) == NULL) return errMessage;
+      alsaWriteCard (jbuf, slot, request);
+      return NULL;
 }
 
 // retreive info for one given card
 PUBLIC json_object * alsaProbeCard (AJG_session *session, AJG_request *request) {
-      char  *info, *name;
-      const char *cardid, *driver;
       json_object *sndcard;
-      snd_ctl_t   *handle;
-      snd_ctl_card_info_t *cardinfo;
-      int err;
-
-      // fakemode read response from session directory
+      AJG_jbuf *jbuf;
+
+      // fakemode read response from session directory, cards with a CTRL_GET_ALL sample are simulated
+      if (session->fakemod && simulFind (session, request->cardid)) {
+        jbuf = request->jbuf;
+        request->jbuf = NULL;
+        sndcard = alsaResponse (session, request, simulWriteProbe);
+        request->jbuf = jbuf;
+        return (sndcard);
+      }
       if (session->fakemod) {
         json_object *sndname;
         sndcard = alsaFakeResponse (session, request, CARD_GET_NAME);
-        json_object_object_get_ex (sndcard, "name", &sndname);
-        request->cardname = strdup (json_object_get_string (sndname));
+        if (json_object_object_get_ex (sndcard, "name", &sndname)) {
+            if (request->cardname) free (request->cardname);
+            request->cardname = strdup (json_object_get_string (sndname));
+        }
       	return (sndcard);
       }
 
-      snd_ctl_card_info_alloca(&cardinfo);
-
-	  if (!request->cardid || (err = snd_ctl_open(&handle, request->cardid, 0)) < 0) {
-		 return  jsonNewMessage (AJG_EMPTY, "SndCard [%s] Not Found", request->cardid);
-	  }
-
-	  if ((err = snd_ctl_card_info(handle, cardinfo)) < 0) {
-		  snd_ctl_close(handle);
-		  return  jsonNewMessage (AJG_FAIL, "SndCard [%s] info error: %s", request->cardid, snd_strerror(err));
-	  }
-
-	  // cardid= strdup(request->cardid);
-	  cardid= snd_ctl_card_info_get_id(cardinfo);
-
-	  sndcard = json_object_new_object();
-      json_object_object_add (sndcard, "ajgtype" ,json_object_new_string (AJG_SNDCARD_JTYPE));
-      json_object_object_add (sndcard, "cardid"  , json_object_new_string (cardid));
-      name = strdup(snd_ctl_card_info_get_name (cardinfo));
-      request->cardname = name; // save cardname for session management
-	  json_object_object_add (sndcard, "name"    , json_object_new_string (name));
-
-	  if (!request->quiet) {
-          json_object_object_add (sndcard, "devid" , json_object_new_string (request->cardid));
-	  	  driver= snd_ctl_card_info_get_driver(cardinfo);
-          json_object_object_add (sndcard, "driver"  , json_object_new_string (driver));
-		  info  = strdup(snd_ctl_card_info_get_longname (cardinfo));
-          json_object_object_add (sndcard, "info" , json_object_new_string (info));
-   	      if (verbose) fprintf (stderr, "AJG: Soundcard Devid=%-5s Cardid=%-7s Name=%s\n", request->cardid, cardid, info);
-	  }
-
-      // if requested keep track of sound probed handle
-      if (request->cardhandle) request->cardhandle = handle;
-      else snd_ctl_close(handle);
+      // card description is always returned as a tree, callers merge it within their response
+      jbuf = request->jbuf;
+      request->jbuf = NULL;
+      sndcard = alsaResponse (session, request, alsaWriteProbe);
+      request->jbuf = jbuf;
 	  return (sndcard);
 }
 
-// Loop on everypotential Sound card and register active one
-PUBLIC json_object * alsaFindCard (AJG_session *session, AJG_request *request) {
+STATIC json_object *alsaWriteFindCard (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
 	int  card;
-	json_object *sndcards, *element, *ajgResponse;
+	json_object *errMessage;
+	AJG_cardslot *slot;
     char cardid[32];
+    unsigned long long cards = 0; // found cards and their open epoch, changes on hotplug
+    unsigned long generation = 0; // pool card list generation, 0 when hotplug is not watched
 
-    if (session->fakemod) {
-       json_object *fakeresponse;
-       if (request->cardid == NULL) fakeresponse = alsaFakeResponse (session, request, CARD_GET_ALL);
-       else  fakeresponse = alsaFakeResponse (session, request, CARD_GET_ONE);
-       return (fakeresponse);
+    // only one card was requested let's probe it
+    if (request->cardid != NULL) {
+        if ((slot = alsaProbeSlot (session, request, &errMessage)) == NULL) return errMessage;
+        cards = slot->epoch;
+
+    // card list only moves with pool slots and /dev/snd events, unchanged list is answered before probing any card
+    } else if ((generation = poolCardsGeneration (session)) != 0 && alsaCheckEtag (session, request, 0, generation)) {
+        return NULL;
     }
 
+    jbufObjectStart (jbuf);
+    jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_SNDLIST_JTYPE);
+    jbufKey (jbuf, "status");  jsonWriteStatus (jbuf, AJG_SUCCESS);
+    jbufKey (jbuf, "data");
 
-	// if no specific card requested loop on all
-	if (request->cardid == NULL) {
+    if (request->cardid != NULL) {
+        alsaWriteCard (jbuf, slot, request);
+    } else {
 	     // return an array of sndcard
-		 sndcards =json_object_new_array();
+		 jbufArrayStart (jbuf);
 
 		 // loop on potential card number
 		 for (card =0; card < 32; card++) {
-			json_object *sndcard;
 
-			// build card cardid and probe it
+			// build card cardid and probe it, missing cards are just ignored
 			snprintf (cardid, sizeof(cardid), "hw:%i", card);
 			request->cardid = cardid;
-			sndcard = alsaProbeCard (session, request);
-
-			// If card probe fail to return cardid check for status
-			if (!json_object_object_get_ex (sndcard, "cardid", &element)) {
-				const char *status;
-				json_object_object_get_ex (sndcard, "status", &element);
-				status = json_object_get_string (element);
-				if (!strcmp (status, ERROR_LABEL[AJG_FATAL]))  break;
-				continue; // just ignore this entry
+			if ((slot = alsaProbeSlot (session, request, &errMessage)) == NULL) {
+				json_object_put (errMessage);
+				continue;
 			}
-			// add current sndcard to sndcards object
-			json_object_array_add (sndcards, sndcard);
-	   	 }
+			cards = cards * 31 + card * 1000003 + slot->epoch;
 
-	 } else {
-		 // only one card was requested let's probe it
-		 sndcards = alsaProbeCard (session, request);
-		 // If card probe fail to return cardid check for status
-		 if (!json_object_object_get_ex (sndcards, "cardid", &element)) {
-			return (sndcards);
-		 }
+			// add current sndcard to sndcards array
+			alsaWriteCard (jbuf, slot, request);
+	   	 }
+		 jbufArrayEnd (jbuf);
+		 request->cardid = NULL;
 	}
+    jbufObjectEnd (jbuf);
 
-    ajgResponse = json_object_new_object();
-    json_object_object_add (ajgResponse, "ajgtype" , json_object_new_string (AJG_SNDLIST_JTYPE));
-    json_object_object_add (ajgResponse, "status"  , jsonNewStatus(AJG_SUCCESS));
-    json_object_object_add (ajgResponse, "data"    , sndcards);
+    // without hotplug watch card list is only known once every card was probed, unchanged list is dropped
+    if (generation == 0) {
+        if (alsaCheckEtag (session, request, 0, cards)) jbufReset (jbuf);
+        return NULL;
+    }
 
-   return (ajgResponse);
+    // tagged with the generation list was built from, untagged when cards moved while probing [first probes open them]
+    if (generation != poolCardsGeneration (session)) request->etag[0] = '\0';
+    return NULL;
+}
+
+PUBLIC json_object * alsaFindCard (AJG_session *session, AJG_request *request) {
+
+    if (session->fakemod) {
+       json_object *fakeresponse;
+       if (request->cardid == NULL) fakeresponse = alsaFakeResponse (session, request, CARD_GET_ALL);
+       else  fakeresponse = alsaFakeResponse (session, request, CARD_GET_ONE);
+       return (fakeresponse);
+    }
+
+    return alsaResponse (session, request, alsaWriteFindCard);
 }
 
 STATIC json_object *DB2StringJsonOject (long dB) {
@@ -414,144 +467,358 @@ STATIC json_object *  getControlAcl (snd_ctl_elem_info_t *info) {
 }
 
 
-// pack element from ALSA control into a JSON object
-STATIC json_object * getAlsaSingleCtrl (snd_hctl_elem_t *elem, snd_ctl_elem_info_t *info,  AJG_request *request) {
-
+// build static part of a control [name, ranges, enums, acl, tlv] once, every response shares them
+STATIC void alsaBuildCtrlMeta (AJG_sndctrl *ctrl, snd_ctl_elem_info_t *info) {
 	int err;
-    json_object *jsonAlsaCtrl,*jsonClassCtrl;
+	json_object *jsonClassCtrl, *jsonAcl, *jsonEnum = NULL;
+	snd_hctl_elem_t *elem = ctrl->elem;
 	snd_ctl_elem_id_t *elemid;
 	snd_ctl_elem_type_t elemtype;
-	snd_ctl_elem_value_t *control;
-	int count, idx;
+	unsigned int tlv [1024];
 
+	snd_ctl_elem_id_alloca (&elemid);
+	snd_hctl_elem_get_id(elem, elemid);
 
-	// allocate ram for ALSA elements
-	snd_ctl_elem_value_alloca(&control);
-	snd_ctl_elem_id_alloca   (&elemid);
+	ctrl->name  = strdup (snd_ctl_elem_id_get_name (elemid));
+	ctrl->iface = snd_ctl_elem_iface_name(snd_ctl_elem_id_get_interface(elemid));
 
-    // get elemId out of elem
-    snd_hctl_elem_get_id(elem, elemid);
+	elemtype = snd_ctl_elem_info_get_type(info);
 
-    // when ctrlid is set, return only this ctrl
-    if (request->numid != -1 && request->numid != snd_ctl_elem_id_get_numid(elemid)) return NULL;
+    jsonClassCtrl = json_object_new_object();
+    json_object_object_add (jsonClassCtrl,"type" , json_object_new_string(snd_ctl_elem_type_name(elemtype)));
+	json_object_object_add (jsonClassCtrl,"count", json_object_new_int(snd_ctl_elem_info_get_count (info)));
 
-    // build a json object out of element
-    jsonAlsaCtrl = json_object_new_object(); // http://alsa-lib.sourcearchive.com/documentation/1.0.24.1-3/group__Control_ga4e4f251147f558bc2ad044e836e449d9.html
-    json_object_object_add (jsonAlsaCtrl,"numid", json_object_new_int(snd_ctl_elem_id_get_numid (elemid)));
-    if (request->quiet < 2) json_object_object_add (jsonAlsaCtrl,"name" , json_object_new_string(snd_ctl_elem_id_get_name (elemid)));
-    if (request->quiet < 1) json_object_object_add (jsonAlsaCtrl,"iface", json_object_new_string(snd_ctl_elem_iface_name(snd_ctl_elem_id_get_interface(elemid))));
-    if (request->quiet < 3)json_object_object_add (jsonAlsaCtrl,"actif", json_object_new_boolean(!snd_ctl_elem_info_is_inactive(info)));
+	switch (elemtype) {
+		case SND_CTL_ELEM_TYPE_INTEGER:
+			json_object_object_add (jsonClassCtrl,"min",  json_object_new_int(snd_ctl_elem_info_get_min(info)));
+			json_object_object_add (jsonClassCtrl,"max",  json_object_new_int(snd_ctl_elem_info_get_max(info)));
+			json_object_object_add (jsonClassCtrl,"step", json_object_new_int(snd_ctl_elem_info_get_step(info)));
+			break;
+		case SND_CTL_ELEM_TYPE_INTEGER64:
+			json_object_object_add (jsonClassCtrl,"min",  json_object_new_int64(snd_ctl_elem_info_get_min64(info)));
+			json_object_object_add (jsonClassCtrl,"max",  json_object_new_int64(snd_ctl_elem_info_get_max64(info)));
+			json_object_object_add (jsonClassCtrl,"step", json_object_new_int64(snd_ctl_elem_info_get_step64(info)));
+			break;
+		case SND_CTL_ELEM_TYPE_ENUMERATED: {
+			unsigned int item, items = snd_ctl_elem_info_get_items(info);
+			snd_ctl_elem_info_t *iteminfo;
+
+			// work on a copy not to alter cached info
+			snd_ctl_elem_info_alloca (&iteminfo);
+			snd_ctl_elem_info_copy (iteminfo, info);
+
+			jsonEnum = json_object_new_array();
+			for (item = 0; item < items; item++) {
+				snd_ctl_elem_info_set_item(iteminfo, item);
+				if ((err = snd_hctl_elem_info(elem, iteminfo)) >= 0) {
+					json_object_array_add (jsonEnum, json_object_new_string(snd_ctl_elem_info_get_item_name(iteminfo)));
+				}
+			}
+			json_object_object_add (jsonClassCtrl, "enums", json_object_get (jsonEnum));
+			break;
+		}
+		default: break; // ignore any unknown type
+		}
+
+	// collected class info with associated ACLs, serialized once and copied as is in responses
+	jsonAcl = getControlAcl (info);
+	jbufPrebuild (&ctrl->metaCtrl, jsonClassCtrl);
+	jbufPrebuild (&ctrl->metaAcl, jsonAcl);
+	json_object_put (jsonAcl);
+
+	// enum list goes within card dictionary, dict=1 responses only carry its index
+	if (jsonEnum) {
+		AJG_prebuilt shared;
+
+		ctrl->enumref = cacheIntern (ctrl->slot, AJG_DICT_ENUMS, jsonEnum, &shared);
+		jbufPrebuiltFree (&shared); // control already holds its list within metaCtrl
+		if (ctrl->enumref >= 0) {
+			json_object_object_del (jsonClassCtrl, "enums");
+			json_object_object_add (jsonClassCtrl, "enumref", json_object_new_int (ctrl->enumref));
+			jbufPrebuild (&ctrl->metaRef, jsonClassCtrl);
+		}
+		json_object_put (jsonEnum);
+	}
+	json_object_put (jsonClassCtrl);
+
+	// check for tlv [direct port from amixer.c]
+	if (snd_ctl_elem_info_is_tlv_readable(info)) {
+		if ((err = snd_hctl_elem_tlv_read(elem, tlv, sizeof (tlv))) < 0) {
+			fprintf (stderr, "Control %s element TLV read error\n", snd_strerror(err));
+		} else {
+			json_object *jsonTlv = decodeTlv (tlv, sizeof (tlv));
+			ctrl->tlvref = cacheIntern (ctrl->slot, AJG_DICT_TLVS, jsonTlv, &ctrl->metaTlv);
+			json_object_put (jsonTlv);
+		}
+	}
+	ctrl->metavalid = TRUE;
+}
+
+// write control value(s) as a json array
+STATIC void alsaWriteValues (AJG_jbuf *jbuf, snd_ctl_elem_info_t *info, snd_ctl_elem_value_t *control) {
+	snd_ctl_elem_type_t elemtype = snd_ctl_elem_info_get_type(info);
+	int count = snd_ctl_elem_info_get_count (info);
+	int idx;
+
+	jbufArrayStart (jbuf);
+	for (idx = 0; idx < count; idx++) { // start from one in amixer.c !!!
+		switch (elemtype) {
+		case SND_CTL_ELEM_TYPE_BOOLEAN: {
+			jbufBool (jbuf, snd_ctl_elem_value_get_boolean(control, idx));
+			break;
+			}
+		case SND_CTL_ELEM_TYPE_INTEGER:
+			jbufInt (jbuf, snd_ctl_elem_value_get_integer(control, idx));
+			break;
+		case SND_CTL_ELEM_TYPE_INTEGER64:
+			jbufInt (jbuf, snd_ctl_elem_value_get_integer64(control, idx));
+			break;
+		case SND_CTL_ELEM_TYPE_ENUMERATED:
+			jbufInt (jbuf, snd_ctl_elem_value_get_enumerated(control, idx));
+			break;
+		case SND_CTL_ELEM_TYPE_BYTES:
+			jbufInt (jbuf, (int)snd_ctl_elem_value_get_byte(control, idx));
+			break;
+		case SND_CTL_ELEM_TYPE_IEC958: {
+			snd_aes_iec958_t iec958;
+			snd_ctl_elem_value_get_iec958(control, &iec958);
+
+			jbufObjectStart (jbuf);
+			jbufKey (jbuf, "AES0"); jbufInt (jbuf, iec958.status[0]);
+			jbufKey (jbuf, "AES1"); jbufInt (jbuf, iec958.status[1]);
+			jbufKey (jbuf, "AES2"); jbufInt (jbuf, iec958.status[2]);
+			jbufKey (jbuf, "AES3"); jbufInt (jbuf, iec958.status[3]);
+			jbufObjectEnd (jbuf);
+			break;
+			}
+		default:
+			jbufString (jbuf, "?unknown?");
+			break;
+		}
+	}
+	jbufArrayEnd (jbuf);
+}
+
+// static part of a control, enums and tlv are dictionary indexes in dict mode
+STATIC void alsaWriteMeta (AJG_jbuf *jbuf, AJG_sndctrl *ctrl, AJG_request *request) {
+	int dict = request->dict;
+
+	jbufKey (jbuf, "ctrl");
+	if (dict && ctrl->metaRef.formats[AJG_FORMAT_JSON]) jbufPrebuilt (jbuf, &ctrl->metaRef);
+	else jbufPrebuilt (jbuf, &ctrl->metaCtrl);
+	jbufKey (jbuf, "acl");  jbufPrebuilt (jbuf, &ctrl->metaAcl);
+
+	if (!ctrl->metaTlv.formats[AJG_FORMAT_JSON]) return;
+	if (dict && ctrl->tlvref >= 0) { jbufKey (jbuf, "tlvref"); jbufInt (jbuf, ctrl->tlvref); }
+	else { jbufKey (jbuf, "tlv"); jbufPrebuilt (jbuf, &ctrl->metaTlv); }
+}
 
-    elemtype = snd_ctl_elem_info_get_type(info);
+// card dictionaries, written once every control of response has its metadata built
+STATIC void alsaWriteDicts (AJG_jbuf *jbuf, AJG_cardslot *slot) {
+	static const char *keys [AJG_DICTS] = {"enums", "tlvs"};
+	int dict, idx;
 
-	// number item and value(s) within control.
-	count = snd_ctl_elem_info_get_count (info);
+	for (dict=0; dict < AJG_DICTS; dict++) {
+		jbufKey (jbuf, keys[dict]);
+		jbufArrayStart (jbuf);
+		for (idx=0; idx < slot->dicts[dict].count; idx++) {
+			AJG_dictentry *entry = &slot->dicts[dict].entries[idx];
+
+			if (entry->refs == 0) jbufString (jbuf, NULL);
+			else jbufPrebuilt (jbuf, &entry->value);
+		}
+		jbufArrayEnd (jbuf);
+	}
+}
+
+// write element from ALSA control as a JSON object
+STATIC void alsaWriteCtrl (AJG_session *session, AJG_sndctrl *ctrl, snd_ctl_elem_info_t *info, AJG_request *request, AJG_jbuf *jbuf) {
+	int err;
+	snd_ctl_elem_value_t *control;
+
+    // static metadata is built at first access and after info change events
+    if (!ctrl->metavalid) alsaBuildCtrlMeta (ctrl, info);
+
+    // http://alsa-lib.sourcearchive.com/documentation/1.0.24.1-3/group__Control_ga4e4f251147f558bc2ad044e836e449d9.html
+    jbufObjectStart (jbuf);
+    jbufKey (jbuf, "numid"); jbufInt (jbuf, ctrl->numid);
+    if (request->quiet < 2) { jbufKey (jbuf, "name");  jbufString (jbuf, ctrl->name); }
+    if (request->quiet < 1) { jbufKey (jbuf, "iface"); jbufString (jbuf, ctrl->iface); }
+    if (request->quiet < 3) { jbufKey (jbuf, "actif"); jbufBool (jbuf, !snd_ctl_elem_info_is_inactive(info)); }
 
 	if (snd_ctl_elem_info_is_readable(info)) {
-	    json_object *jsonValuesCtrl = json_object_new_array();
+		jbufKey (jbuf, "value");
 
-		if ((err = snd_hctl_elem_read(elem, control)) < 0) {
-		       json_object *jsonValuesCtrl = json_object_new_object();
-       		   json_object_object_add (jsonValuesCtrl,"error", json_object_new_string(snd_strerror(err)));
+		// value comes from control cache unless an event changed it since last read
+		if ((control = cacheGetValue (session, ctrl, &err)) == NULL) {
+		       jbufObjectStart (jbuf);
+		       jbufKey (jbuf, "error"); jbufString (jbuf, snd_strerror(err));
+		       jbufObjectEnd (jbuf);
 		} else {
-			for (idx = 0; idx < count; idx++) { // start from one in amixer.c !!!
-				switch (elemtype) {
-				case SND_CTL_ELEM_TYPE_BOOLEAN: {
-					json_object_array_add (jsonValuesCtrl, json_object_new_boolean (snd_ctl_elem_value_get_boolean(control, idx)));
-					break;
-					}
-				case SND_CTL_ELEM_TYPE_INTEGER:
-					json_object_array_add (jsonValuesCtrl, json_object_new_int (snd_ctl_elem_value_get_integer(control, idx)));
-					break;
-				case SND_CTL_ELEM_TYPE_INTEGER64:
-					json_object_array_add (jsonValuesCtrl, json_object_new_int64 (snd_ctl_elem_value_get_integer64(control, idx)));
-					break;
-				case SND_CTL_ELEM_TYPE_ENUMERATED:
-					json_object_array_add (jsonValuesCtrl, json_object_new_int (snd_ctl_elem_value_get_enumerated(control, idx)));
-					break;
-				case SND_CTL_ELEM_TYPE_BYTES:
-					json_object_array_add (jsonValuesCtrl, json_object_new_int ((int)snd_ctl_elem_value_get_byte(control, idx)));
-					break;
-				case SND_CTL_ELEM_TYPE_IEC958: {
-					json_object *jsonIec958Ctrl = json_object_new_object();
-					snd_aes_iec958_t iec958;
-					snd_ctl_elem_value_get_iec958(control, &iec958);
-
-					json_object_object_add (jsonIec958Ctrl,"AES0",json_object_new_int(iec958.status[0]));
-					json_object_object_add (jsonIec958Ctrl,"AES1",json_object_new_int(iec958.status[1]));
-					json_object_object_add (jsonIec958Ctrl,"AES2",json_object_new_int(iec958.status[2]));
-					json_object_object_add (jsonIec958Ctrl,"AES3",json_object_new_int(iec958.status[3]));
-					json_object_array_add  (jsonValuesCtrl, jsonIec958Ctrl);
-					break;
-					}
-				default:
-					json_object_array_add (jsonValuesCtrl, json_object_new_string ("?unknown?"));
-					break;
-				}
-			}
+		       alsaWriteValues (jbuf, info, control);
 		}
-		json_object_object_add (jsonAlsaCtrl,"value",jsonValuesCtrl);
     }
 
+    if (!request->quiet) alsaWriteMeta (jbuf, ctrl, request);  // in simple mode do not print usable values
+    jbufObjectEnd (jbuf);
+}
 
-    if (!request->quiet) {  // in simple mode do not print usable values
-        jsonClassCtrl = json_object_new_object();
-        json_object_object_add (jsonClassCtrl,"type" , json_object_new_string(snd_ctl_elem_type_name(elemtype)));
-		json_object_object_add (jsonClassCtrl,"count", json_object_new_int(count));
+// compact {numid,value[,cardid]} of a control changed by an alsa event, FALSE when it has no value [slot lock held]
+PUBLIC int alsaWriteChange (AJG_session *session, AJG_sndctrl *ctrl, AJG_jbuf *jbuf, const char *cardid) {
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *control;
+	int err;
 
-		switch (elemtype) {
-			case SND_CTL_ELEM_TYPE_INTEGER:
-				json_object_object_add (jsonClassCtrl,"min",  json_object_new_int(snd_ctl_elem_info_get_min(info)));
-				json_object_object_add (jsonClassCtrl,"max",  json_object_new_int(snd_ctl_elem_info_get_max(info)));
-				json_object_object_add (jsonClassCtrl,"step", json_object_new_int(snd_ctl_elem_info_get_step(info)));
-				break;
-			case SND_CTL_ELEM_TYPE_INTEGER64:
-				json_object_object_add (jsonClassCtrl,"min",  json_object_new_int64(snd_ctl_elem_info_get_min64(info)));
-				json_object_object_add (jsonClassCtrl,"max",  json_object_new_int64(snd_ctl_elem_info_get_max64(info)));
-				json_object_object_add (jsonClassCtrl,"step", json_object_new_int64(snd_ctl_elem_info_get_step64(info)));
-				break;
-			case SND_CTL_ELEM_TYPE_ENUMERATED: {
-				unsigned int item, items = snd_ctl_elem_info_get_items(info);
-				json_object *jsonEnum = json_object_new_array();
-
-				for (item = 0; item < items; item++) {
-					snd_ctl_elem_info_set_item(info, item);
-					if ((err = snd_hctl_elem_info(elem, info)) >= 0) {
-						json_object_array_add (jsonEnum, json_object_new_string(snd_ctl_elem_info_get_item_name(info)));
-					}
-				}
-				json_object_object_add (jsonClassCtrl, "enums",jsonEnum);
-				break;
-			}
-			default: break; // ignore any unknown type
-			}
+	if ((info = cacheGetInfo (session, ctrl, &err)) == NULL) return FALSE;
+	if (!snd_ctl_elem_info_is_readable(info)) return FALSE;
+	if ((control = cacheGetValue (session, ctrl, &err)) == NULL) return FALSE;
 
-		// add collected class info with associated ACLs
-		json_object_object_add (jsonAlsaCtrl,"ctrl", jsonClassCtrl);
-		json_object_object_add (jsonAlsaCtrl,"acl"  , getControlAcl (info));
-
-		// check for tlv [direct port from amixer.c]
-		if (snd_ctl_elem_info_is_tlv_readable(info)) {
-				unsigned int *tlv;
-				tlv = malloc(4096);
-				if ((err = snd_hctl_elem_tlv_read(elem, tlv, 4096)) < 0) {
-					fprintf (stderr, "Control %s element TLV read error\n", snd_strerror(err));
-					free(tlv);
-				} else {
-					json_object_object_add (jsonAlsaCtrl,"tlv", decodeTlv (tlv, 4096));
-		   }
-		}
-   }
-   return (jsonAlsaCtrl);
+	jbufObjectStart (jbuf);
+	jbufKey (jbuf, "numid"); jbufInt (jbuf, ctrl->numid);
+	jbufKey (jbuf, "value"); alsaWriteValues (jbuf, info, control);
+	if (cardid) { jbufKey (jbuf, "cardid"); jbufString (jbuf, cardid); }
+	jbufObjectEnd (jbuf);
+	return TRUE;
 }
 
-PUBLIC json_object *alsaGetControl (AJG_session *session, AJG_request *request) {
-	int err=0;
-	snd_hctl_t *handle;
-	snd_hctl_elem_t *elem;
+// load element list of probed card and process pending events, return NULL or an error message [card released on error]
+STATIC json_object *alsaLoadControls (AJG_session *session, AJG_request *request) {
+	int err;
+
+	// Alsa high level API like amixer.c, element list is only loaded once per handle
+	if ((err = poolLoadCard (session, request->cardslot)) < 0) {
+		poolReleaseCard (session, request->cardslot);
+		request->cardslot = NULL;
+		return (jsonNewMessage (AJG_FAIL,"alsaLoadControls cardid=[%s] load fail error=%s\n", request->cardid, snd_strerror(err)));
+	}
+
+	// pending alsa events invalidate cached controls
+	if ((err = cacheUpdateCard (session, request->cardslot)) < 0) {
+		poolFailCard (session, request->cardslot, err);
+		poolReleaseCard (session, request->cardslot);
+		request->cardslot = NULL;
+		return (jsonNewMessage (AJG_FAIL,"alsaLoadControls cardid=[%s] event error=%s\n", request->cardid, snd_strerror(err)));
+	}
+	return NULL;
+}
+
+// control info, on alsa error card is released and an error message returned
+STATIC snd_ctl_elem_info_t *alsaCtrlInfo (AJG_session *session, AJG_request *request, AJG_sndctrl *ctrl, json_object **errMessage) {
 	snd_ctl_elem_info_t *info;
-	json_object *response, *sndctrls, *control;
+	int err;
 
+	// info are cached and only re-read after an info event
+	if ((info = cacheGetInfo (session, ctrl, &err)) == NULL) {
+		poolFailCard (session, request->cardslot, err);
+		poolReleaseCard (session, request->cardslot);
+		request->cardslot = NULL;
+		*errMessage = jsonNewMessage (AJG_FATAL,"alsaGetControl cardid=[%s/%s] snd_hctl_elem_info error: %s\n", request->cardid, request->cardname, snd_strerror(err));
+	}
+	return info;
+}
+
+// write one control, on alsa error card is released and an error message returned
+STATIC json_object *alsaAddCtrl (AJG_session *session, AJG_request *request, AJG_sndctrl *ctrl, AJG_jbuf *jbuf) {
+	snd_ctl_elem_info_t *info;
+	json_object *errMessage;
+
+	if ((info = alsaCtrlInfo (session, request, ctrl, &errMessage)) == NULL) return errMessage;
+
+	alsaWriteCtrl (session, ctrl, info, request, jbuf);
+	return NULL;
+}
+
+// probe card and load its controls, return NULL or an error message
+STATIC json_object *alsaPrepareControls (AJG_session *session, AJG_request *request, const char *label) {
+	json_object *errMessage;
+
+	// this also pick sndcard handle from pool
+	if (alsaProbeSlot (session, request, &errMessage) == NULL) {
+		json_object_put (errMessage);
+		return (jsonNewMessage (AJG_FAIL,"%s cardid=[%s] open fail\n", label, request->cardid));
+	}
+
+	// element list is loaded once per handle and kept up to date by alsa events
+	return alsaLoadControls (session, request);
+}
+
+// open response with sndcard description
+STATIC void alsaOpenControls (AJG_jbuf *jbuf, AJG_request *request) {
+	jbufObjectStart (jbuf);
+	jbufKey (jbuf, "sndcard");
+	alsaWriteCard (jbuf, request->cardslot, request);
+	jbufKey (jbuf, "data");
+	jbufArrayStart (jbuf);
+}
+
+STATIC void alsaCloseControls (AJG_jbuf *jbuf, AJG_request *request) {
+	jbufArrayEnd (jbuf);
+	if (request->dict && !request->quiet) alsaWriteDicts (jbuf, request->cardslot);
+	jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_ALSACTL_JTYPE);
+	jbufKey (jbuf, "status");  jsonWriteStatus (jbuf, AJG_SUCCESS);
+	jbufObjectEnd (jbuf);
+}
+
+// every control of the card, streamed responses are cached until a control changes
+STATIC json_object *alsaWriteAllCtrl (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	snd_hctl_elem_t *elem;
+	json_object *errMessage;
+	AJG_respcache *entry = NULL;
+	int volat = FALSE;
+
+	// client already holds current content, nothing is read from card [volatile values have no tag]
+	if (request->cardslot->volatiles == 0 && alsaCheckEtag (session, request, request->cardslot->epoch, request->cardslot->content)) return NULL;
+
+	// cached response is handed to caller as it is, nothing gets written
+	if (request->jbuf == jbuf) entry = cacheResponseEntry (request->cardslot, request->quiet, request->dict, jbuf->format);
+	if (entry && (request->block = cacheGetResponse (session, request->cardslot, entry)) != NULL) {
+		request->respcache = entry;
+		return NULL;
+	}
+
+	alsaOpenControls (jbuf, request);
+	for (elem = snd_hctl_first_elem(request->cardslot->hctl); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+
+		if (ctrl == NULL) continue; // element without cache entry [out of memory]
+		if ((errMessage = alsaAddCtrl (session, request, ctrl, jbuf)) != NULL) return errMessage;
+		volat |= ctrl->volat;
+	}
+	alsaCloseControls (jbuf, request);
+	if (volat) request->etag[0] = '\0';
+
+	if (entry == NULL || jbuf->failed) return NULL;
+
+	// keep response within card cache, caller sends it from there
+	request->block = jbufDetach (jbuf);
+	request->respcache = entry;
+	cacheStoreResponse (session, request->cardslot, entry, request->block, volat);
+	return NULL;
+}
+
+STATIC json_object *alsaWriteControls (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	json_object *errMessage;
+	AJG_sndctrl *ctrl;
+
+	if ((errMessage = alsaPrepareControls (session, request, "alsaGetControl")) != NULL) return errMessage;
+	if (request->numid < 0) return alsaWriteAllCtrl (session, request, jbuf);
+
+	// single control is reached through numid index, tagged with its card content
+	ctrl = cacheFindCtrl (request->cardslot, request->numid);
+	if (ctrl == NULL || (ctrl->infovalid && !ctrl->volat)) {
+		if (alsaCheckEtag (session, request, request->cardslot->epoch, request->cardslot->content)) return NULL;
+	}
+
+	alsaOpenControls (jbuf, request);
+	if (ctrl && (errMessage = alsaAddCtrl (session, request, ctrl, jbuf)) != NULL) return errMessage;
+	alsaCloseControls (jbuf, request);
+	if (ctrl && ctrl->volat) request->etag[0] = '\0';
+	return NULL;
+}
+
+PUBLIC json_object *alsaGetControl (AJG_session *session, AJG_request *request) {
+
+  	if (session->fakemod && simulFind (session, request->cardid)) return alsaResponse (session, request, simulWriteControls);
   	if (session->fakemod) {
   	   json_object *fakeresponse;
   	   // make sure request->cardname is valid
@@ -562,130 +829,342 @@ PUBLIC json_object *alsaGetControl (AJG_session *session, AJG_request *request)
   	   return fakeresponse;
   	}
 
+	return alsaResponse (session, request, alsaWriteControls);
+}
+
+// controls listed in request->data json numids array, in requested order
+STATIC json_object *alsaWriteManyCtrl (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	json_object *numids, *errMessage;
+	unsigned int index;
 
-    // Open sound we use Alsa high level API like amixer.c
-	if (!request->cardid || (err = snd_hctl_open(&handle, request->cardid, 0)) < 0) {
-		return (jsonNewMessage (AJG_FAIL,"alsaGetControl cardid=[%s] open fail error=%s\n", request->cardid, snd_strerror(err)));
+	numids = request->data ? json_tokener_parse (request->data) : NULL;
+	if (numids == NULL || !json_object_is_type (numids, json_type_array)) {
+		if (numids) json_object_put (numids);
+		return (jsonNewMessage (AJG_FATAL,"alsaGetManyCtrl cardid=[%s] invalid json numids array=%s\n", request->cardid, request->data));
 	}
 
-	if ((err = snd_hctl_load(handle)) < 0) {
-		return (jsonNewMessage (AJG_FAIL,"alsaGetControl cardid=[%s] load fail error=%s\n", request->cardid, snd_strerror(err)));
+	if ((errMessage = alsaPrepareControls (session, request, "alsaGetManyCtrl")) != NULL) {
+		json_object_put(numids);
+		return errMessage;
+	}
+	alsaOpenControls (jbuf, request);
+
+	request->numid = -1; // every listed control is returned
+	for (index=0; index < json_object_array_length (numids); index++) {
+		int numid = json_object_get_int (json_object_array_get_idx (numids, index));
+		AJG_sndctrl *ctrl = cacheFindCtrl (request->cardslot, numid);
+
+		if (ctrl == NULL) {
+			jbufObjectStart (jbuf);
+			jbufKey (jbuf, "numid"); jbufInt (jbuf, numid);
+			jbufKey (jbuf, "error"); jbufString (jbuf, "unknown numid");
+			jbufObjectEnd (jbuf);
+			continue;
+		}
+
+		if ((errMessage = alsaAddCtrl (session, request, ctrl, jbuf)) != NULL) {
+			json_object_put(numids);
+			return errMessage;
+		}
+	}
+	json_object_put(numids);
+
+	alsaCloseControls (jbuf, request);
+	return NULL;
+}
+
+PUBLIC json_object *alsaGetManyCtrl (AJG_session *session, AJG_request *request) {
+
+	if (session->fakemod && simulFind (session, request->cardid)) return alsaResponse (session, request, simulWriteManyCtrl);
+	if (session->fakemod) return alsaFakeResponse (session, request, CTRL_GET_ALL);
+	return alsaResponse (session, request, alsaWriteManyCtrl);
+}
+
+// FNV-1a, schema hash only has to tell layouts apart
+STATIC unsigned long long alsaHash (unsigned long long hash, const void *data, size_t len) {
+	const unsigned char *bytes = data;
+
+	while (len-- > 0) hash = (hash ^ *bytes++) * 1099511628211ULL;
+	return hash;
+}
+
+STATIC unsigned long long alsaHashBlock (unsigned long long hash, const AJG_prebuilt *prebuilt) {
+	AJG_rbuf *block = prebuilt->formats[AJG_FORMAT_JSON];
+
+	if (block == NULL) return alsaHash (hash, "", 1);
+	return alsaHash (hash, block->data, block->len + 1);
+}
+
+// hash of card control layout in element order, computed again after add, remove or info events.
+// Returns NULL or an error message [card released on error]
+STATIC json_object *alsaSchemaHash (AJG_session *session, AJG_request *request) {
+	AJG_cardslot *slot = request->cardslot;
+	snd_hctl_elem_t *elem;
+	json_object *errMessage;
+	unsigned long long hash = 14695981039346656037ULL;
+
+	if (slot->schemavalid) return NULL;
+
+	for (elem = snd_hctl_first_elem(slot->hctl); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+		snd_ctl_elem_info_t *info;
+
+		if (ctrl == NULL) continue;
+		if ((info = alsaCtrlInfo (session, request, ctrl, &errMessage)) == NULL) return errMessage;
+		if (!ctrl->metavalid) alsaBuildCtrlMeta (ctrl, info);
+
+		// inactive flag is not part of layout, it moves with card routing
+		hash = alsaHash (hash, &ctrl->numid, sizeof (ctrl->numid));
+		hash = alsaHash (hash, ctrl->name, strlen (ctrl->name) + 1);
+		hash = alsaHash (hash, ctrl->iface, strlen (ctrl->iface) + 1);
+		hash = alsaHashBlock (hash, &ctrl->metaCtrl);
+		hash = alsaHashBlock (hash, &ctrl->metaAcl);
+		hash = alsaHashBlock (hash, &ctrl->metaTlv);
+	}
+	slot->schema = hash;
+	slot->schemavalid = TRUE;
+	return NULL;
+}
+
+STATIC void alsaWriteSchemaHash (AJG_jbuf *jbuf, AJG_cardslot *slot) {
+	char schema [20];
+
+	snprintf (schema, sizeof (schema), "%016llx", slot->schema);
+	jbufKey (jbuf, "schema"); jbufString (jbuf, schema);
+}
+
+// static part of every control, position within data is the one of its value in ctrl-get-values
+STATIC json_object *alsaWriteSchema (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	snd_hctl_elem_t *elem;
+	json_object *errMessage;
+
+	if ((errMessage = alsaPrepareControls (session, request, "alsaGetSchema")) != NULL) return errMessage;
+	if ((errMessage = alsaSchemaHash (session, request)) != NULL) return errMessage;
+
+	// schema only changes with its hash
+	if (alsaCheckEtag (session, request, request->cardslot->epoch, request->cardslot->schema)) return NULL;
+
+	jbufObjectStart (jbuf);
+	jbufKey (jbuf, "sndcard");
+	alsaWriteCard (jbuf, request->cardslot, request);
+	alsaWriteSchemaHash (jbuf, request->cardslot);
+	jbufKey (jbuf, "data");
+	jbufArrayStart (jbuf);
+	for (elem = snd_hctl_first_elem(request->cardslot->hctl); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+
+		if (ctrl == NULL) continue;
+		jbufObjectStart (jbuf);
+		jbufKey (jbuf, "numid"); jbufInt (jbuf, ctrl->numid);
+		jbufKey (jbuf, "name");  jbufString (jbuf, ctrl->name);
+		jbufKey (jbuf, "iface"); jbufString (jbuf, ctrl->iface);
+		alsaWriteMeta (jbuf, ctrl, request);
+		jbufObjectEnd (jbuf);
 	}
+	jbufArrayEnd (jbuf);
+	if (request->dict) alsaWriteDicts (jbuf, request->cardslot);
+	jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_SCHEMA_JTYPE);
+	jbufKey (jbuf, "status");  jsonWriteStatus (jbuf, AJG_SUCCESS);
+	jbufObjectEnd (jbuf);
+	return NULL;
+}
+
+PUBLIC json_object *alsaGetSchema (AJG_session *session, AJG_request *request) {
 
-	// allocate ram for ALSA elements
-	snd_ctl_elem_info_alloca (&info);
+	if (session->fakemod) return (jsonNewMessage (AJG_FAIL,"ctrl-get-schema not available in fakemod"));
+	return alsaResponse (session, request, alsaWriteSchema);
+}
+
+// values only, in schema order, unreadable controls and read errors are null
+STATIC json_object *alsaWriteSnapshot (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	snd_hctl_elem_t *elem;
+	snd_ctl_elem_value_t *control;
+	json_object *errMessage;
+	int err, volat = FALSE;
 
-	// main json structure for our sound card
-	response = json_object_new_object();
+	if ((errMessage = alsaPrepareControls (session, request, "alsaGetValues")) != NULL) return errMessage;
+	if ((errMessage = alsaSchemaHash (session, request)) != NULL) return errMessage;
 
-	// add card description to ctrl-get-all response
-	json_object *sndcard = alsaProbeCard (session, request);
-	json_object_object_add (response,"sndcard",  sndcard);
+	if (request->cardslot->volatiles == 0 && alsaCheckEtag (session, request, request->cardslot->epoch, request->cardslot->content)) return NULL;
 
-	// create an json array to hold all sndcard response
-	sndctrls = json_object_new_array();
+	jbufObjectStart (jbuf);
+	alsaWriteSchemaHash (jbuf, request->cardslot);
+	jbufKey (jbuf, "values");
+	jbufArrayStart (jbuf);
+	for (elem = snd_hctl_first_elem(request->cardslot->hctl); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+		snd_ctl_elem_info_t *info;
 
-	for (elem = snd_hctl_first_elem(handle); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		if (ctrl == NULL) continue;
+		if ((info = alsaCtrlInfo (session, request, ctrl, &errMessage)) == NULL) return errMessage;
+		volat |= ctrl->volat;
 
-		if ((err = snd_hctl_elem_info(elem, info)) < 0) {
-			json_object_put(response); // we abandon request let's free response
-			return jsonNewMessage (AJG_FATAL,"alsaGetControl cardid=[%s/%s] snd_hctl_elem_info error: %s\n", request->cardid, request->cardname, snd_strerror(err));
+		if (!snd_ctl_elem_info_is_readable(info) || (control = cacheGetValue (session, ctrl, &err)) == NULL) {
+			jbufString (jbuf, NULL);
+			continue;
 		}
+		alsaWriteValues (jbuf, info, control);
+	}
+	jbufArrayEnd (jbuf);
+	jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_VALUES_JTYPE);
+	jbufKey (jbuf, "status");  jsonWriteStatus (jbuf, AJG_SUCCESS);
+	jbufObjectEnd (jbuf);
+
+	if (volat) request->etag[0] = '\0';
+	return NULL;
+}
+
+PUBLIC json_object *alsaGetValues (AJG_session *session, AJG_request *request) {
 
-		// each control is added into a JSON array
-		control = getAlsaSingleCtrl (elem, info, request);
-		if (control) json_object_array_add (sndctrls, control);
+	if (session->fakemod) return (jsonNewMessage (AJG_FAIL,"ctrl-get-values not available in fakemod"));
+	return alsaResponse (session, request, alsaWriteSnapshot);
+}
+
+// controls changed after request->since, their number is returned in request->changed
+STATIC json_object *alsaWriteChanged (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+	snd_hctl_elem_t *elem;
+	json_object *errMessage;
+	AJG_cardslot *slot;
+	int err;
 
+	if ((slot = alsaProbeSlot (session, request, &errMessage)) == NULL) {
+		json_object_put (errMessage);
+		return (jsonNewMessage (AJG_FAIL,"alsaGetChanged cardid=[%s] open fail\n", request->cardid));
 	}
+	if ((errMessage = alsaLoadControls (session, request)) != NULL) return (errMessage);
+
+	jbufObjectStart (jbuf);
+	jbufKey (jbuf, "ajgtype");    jbufString (jbuf, AJG_CHANGES_JTYPE);
+	jbufKey (jbuf, "status");     jsonWriteStatus (jbuf, AJG_SUCCESS);
+	jbufKey (jbuf, "cardid");     jbufString (jbuf, request->cardid);
+	jbufKey (jbuf, "generation"); jbufInt (jbuf, slot->generation);
+	jbufKey (jbuf, "data");
+	jbufArrayStart (jbuf);
+
+	for (elem = snd_hctl_first_elem(slot->hctl); elem != NULL; elem = snd_hctl_elem_next(elem)) {
+		AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+
+		if (ctrl == NULL || ctrl->generation <= request->since) continue;
+		if (request->numid != -1 && request->numid != ctrl->numid) continue;
+
+		if (cacheGetInfo (session, ctrl, &err) == NULL) {
+			poolFailCard (session, slot, err);
+			poolReleaseCard (session, slot);
+			request->cardslot = NULL;
+			return jsonNewMessage (AJG_FATAL,"alsaGetChanged cardid=[%s] snd_hctl_elem_info error: %s\n", request->cardid, snd_strerror(err));
+		}
 
-	// add response json array to sndcard
-	json_object_object_add (response,"ajgtype", json_object_new_string (AJG_ALSACTL_JTYPE));
-    json_object_object_add (response,"status", jsonNewStatus(AJG_SUCCESS));
-	json_object_object_add (response,"data", sndctrls);
-	snd_hctl_close(handle);
+		// write only controls have no value to report
+		if (alsaWriteChange (session, ctrl, jbuf, NULL)) request->changed++;
+	}
 
-	return (response);
+	jbufArrayEnd (jbuf);
+	jbufObjectEnd (jbuf);
+	return (NULL);
 }
 
-PUBLIC json_object *alsaSetOneCtrl (AJG_session *session, AJG_request *request) {
-    static json_object * okresponse =NULL;
+PUBLIC json_object *alsaGetChanged (AJG_session *session, AJG_request *request) {
+
+	request->changed = 0;
+	if (session->fakemod) return (jsonNewMessage (AJG_FAIL,"ctrl-get-changed not available in fakemod"));
+	return alsaResponse (session, request, alsaWriteChanged);
+}
+
+STATIC json_object *alsaWriteSetOne (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
 	int err;
 	snd_ctl_elem_info_t *info;
-    snd_ctl_elem_id_t *id;
-	snd_ctl_elem_value_t *control;
+	snd_ctl_elem_value_t *control, *cached;
+    AJG_cardslot *slot;
+    AJG_sndctrl *ctrl;
     json_object *response;
+    int readback;
 
-    // make standard response only once
-    if (okresponse == NULL) okresponse=jsonNewMessage (AJG_SUCCESS, "done");
+    // in verbose mode written control is returned in short form [quiet=1]
+    readback = !request->quiet;
+    if (readback) request->quiet=1;
 
-    if (session->fakemod) return alsaFakeResponse (session, request, CTRL_SET_ONE);
-
-	// probe soundcard to check it exist and get it name
-	request->cardhandle = (void*)TRUE; // request for not closing card handle
-	(void) alsaProbeCard (session, request); // use to push cardname into request
-	if (request->cardname == NULL) {
+	// probe soundcard to check it exist and get it name, this push cardname and pool handle into request
+	if ((slot = alsaProbeSlot (session, request, &response)) == NULL) {
+	   json_object_put (response);
 	   return  (jsonNewMessage (AJG_FATAL,"Sound card [%s] has no 'name' element", request->cardid));
 	}
 
     if (request->args == NULL || request->numid < 0) {
-    	response= jsonNewMessage (AJG_FAIL,"setcontrol Card=%s NumId=%d no values missing &numid=xx&args='values'\n", request->cardname, request->numid);
-       	goto ExitNow;
+    	return jsonNewMessage (AJG_FAIL,"setcontrol Card=%s NumId=%d no values missing &numid=xx&args='values'\n", request->cardname, request->numid);
     }
 
-    /* FIXME: Remove it when hctl find works ok !!! */
-   	snd_ctl_elem_id_alloca(&id);
-    snd_ctl_elem_id_set_numid (id, request->numid);
+    // element is reached through numid index, info and current value usually come from cache
+    if ((response = alsaLoadControls (session, request)) != NULL) return response;
+
+    if ((ctrl = cacheFindCtrl (request->cardslot, request->numid)) == NULL) {
+   		return jsonNewMessage (AJG_FAIL,"Cannot find the given element from control %s\n", request->cardid);
+    }
 
-    snd_ctl_elem_info_alloca(&info);
-    snd_ctl_elem_info_set_id(info, id);
-    if ((err = snd_ctl_elem_info(request->cardhandle, info)) < 0) {
+    if ((info = cacheGetInfo (session, ctrl, &err)) == NULL) {
    		response= jsonNewMessage (AJG_FAIL,"Cannot find the given element from control %s\n", request->cardid);
-   		goto ExitNow;
+   		goto ExitOnAlsaError;
     }
 
-  	snd_ctl_elem_info_get_id(info, id);
-	snd_ctl_elem_value_alloca(&control);
-    snd_ctl_elem_value_set_id(control, id);
-	if ((err = snd_ctl_elem_read(request->cardhandle, control)) < 0) {
+	if ((cached = cacheGetValue (session, ctrl, &err)) == NULL) {
    	    response= jsonNewMessage (AJG_FAIL,"Cannot read the given element from control %s\n", request->cardid);
-	    goto ExitNow;
+	    goto ExitOnAlsaError;
 	}
 
-    err = snd_ctl_ascii_value_parse(request->cardhandle, control, info, request->args);
+	// work on a copy, cached value remains untouched when parsing or writing fails
+	snd_ctl_elem_value_alloca(&control);
+	snd_ctl_elem_value_copy (control, cached);
+
+    err = snd_ctl_ascii_value_parse(slot->ctl, control, info, request->args);
   	if (err < 0) {
-  	    response= jsonNewMessage (AJG_FAIL,"Control %s fail to parse args=%s: %s\n", request->cardid, request->args, snd_strerror(err));
-  	    goto ExitNow;
+  	    return jsonNewMessage (AJG_FAIL,"Control %s fail to parse args=%s: %s\n", request->cardid, request->args, snd_strerror(err));
   	}
 
-	if ((err = snd_ctl_elem_write(request->cardhandle, control)) < 0) {
+	if ((err = snd_hctl_elem_write(ctrl->elem, control)) < 0) {
 	   response= jsonNewMessage (AJG_FAIL,"Control %s element write error: %s\n", request->cardid, snd_strerror(err));
-  	   goto ExitNow;
+  	   goto ExitOnAlsaError;
     }
+    cacheDirtyCtrl (ctrl); // driver may adjust written value, re-read it on next access
 
-    // in quiet mode we only return OK otherwise we request full value of modified control
-	if (request->quiet) {
-        json_object_get (okresponse);
-        response = okresponse;
-	} else {
-	    // in verbose mode we return a modified controls
-  	    request->quiet=1; // make response short
-        response = alsaGetControl (session, request);
+    // in quiet mode we only return OK [sndcard handle remains within pool]
+	if (!readback) {
+        jsonWriteMessage (jbuf, AJG_SUCCESS, "done");
+        return NULL;
 	}
 
-ExitNow: // also used for normal exit
-    snd_ctl_close(request->cardhandle);
+	// otherwise same response as ctrl-get-one&quiet=1, value is read back once through the cached element
+	jbufObjectStart (jbuf);
+	jbufKey (jbuf, "sndcard");
+	alsaWriteCard (jbuf, slot, request);
+	jbufKey (jbuf, "data");
+	jbufArrayStart (jbuf);
+	alsaWriteCtrl (session, ctrl, info, request, jbuf);
+	alsaCloseControls (jbuf, request);
+	return NULL;
+
+ExitOnAlsaError:
+    poolFailCard (session, request->cardslot, err);
+    poolReleaseCard (session, request->cardslot);
+    request->cardslot = NULL;
 	return response;
 }
 
-// Low level push one control values to sound card.
+PUBLIC json_object *alsaSetOneCtrl (AJG_session *session, AJG_request *request) {
+
+    if (session->fakemod && simulFind (session, request->cardid)) return alsaResponse (session, request, simulWriteSetOne);
+    if (session->fakemod) return alsaFakeResponse (session, request, CTRL_SET_ONE);
+    return alsaResponse (session, request, alsaWriteSetOne);
+}
+
+// Low level push one control values to sound card [controls should be loaded by caller].
 // Warning: at this level we expect session file to be save and we write integer values without verification.
-STATIC AJG_ERROR alsaSimpleSetCtrl(AJG_session *session, AJG_request *request, json_object *ctrlnumid, json_object *ctrlvalue) {
+// Unless forced a control already holding those values is not written and AJG_EMPTY is returned as for read only ones.
+STATIC AJG_ERROR alsaSimpleSetCtrl(AJG_session *session, AJG_request *request, json_object *ctrlnumid, json_object *ctrlvalue, int force) {
     json_object *element;
 	int err, numid, value;
 	snd_ctl_elem_info_t *info;
-    snd_ctl_elem_id_t *myid;
-	snd_ctl_elem_value_t *control;
+	snd_ctl_elem_value_t *control, *cached;
 	unsigned int index, count, length;
+	AJG_sndctrl *ctrl;
 
     // extract NUMid and loop on values
 
@@ -695,12 +1174,8 @@ STATIC AJG_ERROR alsaSimpleSetCtrl(AJG_session *session, AJG_request *request, j
     }
     numid = json_object_get_int (ctrlnumid);
 
-   	snd_ctl_elem_id_alloca(&myid);
-    snd_ctl_elem_id_set_numid (myid, numid);
-
-    snd_ctl_elem_info_alloca(&info);
-    snd_ctl_elem_info_set_id(info, myid);
-    if ((err = snd_ctl_elem_info(request->cardhandle, info)) < 0) {
+    ctrl = cacheFindCtrl (request->cardslot, numid);
+    if (ctrl == NULL || (info = cacheGetInfo (session, ctrl, &err)) == NULL) {
    		fprintf (stderr, "AJG: Fail numid=%2d unknown\n", numid);
    		return AJG_FAIL;
     }
@@ -710,18 +1185,16 @@ STATIC AJG_ERROR alsaSimpleSetCtrl(AJG_session *session, AJG_request *request, j
    	   return (AJG_EMPTY);
    	}
 
-  	snd_ctl_elem_info_get_id(info, myid);
-	snd_ctl_elem_value_alloca(&control);
-    snd_ctl_elem_value_set_id(control, myid);
-	if ((err = snd_ctl_elem_read(request->cardhandle, control)) < 0) {
+	if ((cached = cacheGetValue (session, ctrl, &err)) == NULL) {
    		fprintf (stderr, "AJG: Fail numid=%2d control error\n", numid);
 	    return AJG_FAIL;
 	}
+	snd_ctl_elem_value_alloca(&control);
+	snd_ctl_elem_value_copy (control, cached);
 
     // prepare structure to loop on pushing value to sound card
     index = 0; // taken from ctrlparse.c
    	count = snd_ctl_elem_info_get_count(info);
-   	snd_ctl_elem_value_set_id(control, myid);
    	length = json_object_array_length (ctrlvalue);
 
     // Loop on every value and push control to sndcard
@@ -732,26 +1205,39 @@ STATIC AJG_ERROR alsaSimpleSetCtrl(AJG_session *session, AJG_request *request, j
         snd_ctl_elem_value_set_integer(control, index, value);
     }
 
+    // cached value follows card through hctl events, unchanged controls cost no driver write
+    if (!force && !snd_ctl_elem_value_compare (control, cached)) return AJG_EMPTY;
+
     // write array on disk
-    if ((err = snd_ctl_elem_write(request->cardhandle, control)) < 0) {
+    if ((err = snd_hctl_elem_write(ctrl->elem, control)) < 0) {
 	   fprintf (stderr,"AJG: Fail numid=%2d values=%s write error: %s\n", numid, json_object_to_json_string(ctrlvalue),snd_strerror(err));
 	   return AJG_FAIL;
 	}
+	cacheDirtyCtrl (ctrl);
 	return (AJG_SUCCESS);
 }
 
 // open sndcard to get its name and request existing session for this card
 PUBLIC json_object *alsaListSession (AJG_session *session, AJG_request *request) {
    json_object *sndcard, *response;
+   struct stat sbuf;
+   char cardpath [512];
 
    // open sndcard and get its name
    sndcard = alsaProbeCard (session, request);
    if (request->cardname == NULL) {
        return (jsonNewMessage (AJG_FATAL,"Sound card [%s] has not 'name' element", request->cardid));
    }
+   json_object_put (sndcard); // release sndcard json object
+
+   // session list only changes with its directory, tagged with its mtime
+   snprintf (cardpath, sizeof (cardpath), "%s/%s", session->config->sessiondir, request->cardname);
+   if (request->cardslot && stat (cardpath, &sbuf) == 0) {
+       unsigned long long mtime = (unsigned long long) sbuf.st_mtim.tv_sec * 1000000000 + sbuf.st_mtim.tv_nsec;
+       if (alsaCheckEtag (session, request, request->cardslot->epoch, mtime)) return NULL;
+   }
 
    response = sessionList (session, request);
-   json_object_put (sndcard); // release sndcard json object
    return (response);
 }
 
@@ -761,16 +1247,19 @@ PUBLIC json_object *alsaSetManyCtrl (AJG_session *session, AJG_request *request)
    json_object *errorMsg, *sndcard, *numids,*ctrlnumid, *ctrlvalue;
    unsigned int index;
 
+   if (session->fakemod && simulFind (session, request->cardid)) return simulSetMany (session, request);
    if (session->fakemod) return alsaFakeResponse (session, request, CTRL_SET_MANY);
 
    // probe soundcard to check it exist and get it name
-   request->cardhandle = (void*)TRUE; // request for not closing card handle
    sndcard = alsaProbeCard (session, request);
-   if (request->cardname == NULL) {
+   if (request->cardname == NULL || request->cardslot == NULL) {
        errorMsg =  jsonNewMessage (AJG_FATAL,"Sound card [%s] has no 'name' element", request->cardid);
   	   goto OnErrorExit;
    }
 
+   // controls are written through numid index
+   if ((errorMsg = alsaLoadControls (session, request)) != NULL) goto OnErrorExit;
+
    // extract numids from string
    numids = json_tokener_parse (request->data);
    if (!json_object_is_type (numids, json_type_array)) {
@@ -799,47 +1288,41 @@ PUBLIC json_object *alsaSetManyCtrl (AJG_session *session, AJG_request *request)
         }
 
         // apply control to sound card
-        status = alsaSimpleSetCtrl (session, request, ctrlnumid, ctrlvalue);
+        status = alsaSimpleSetCtrl (session, request, ctrlnumid, ctrlvalue, TRUE);
         if (status != AJG_SUCCESS) {
            errorMsg = jsonNewMessage (AJG_FAIL,"%s alsaSetManyCtrl:%d request refused numids=%s args=%s\n",  request->cardname, index, request->data, request->args);
     	   goto OnErrorExit;
         }
    }
 
-   // we done let free jsonSession object
+   // we done let free jsonSession object [sndcard handle remains within pool]
    json_object_put   (sndcard);
 
-   // if we have a valid card handle let's close it
-   if (request->cardhandle != (void*)TRUE && request->cardhandle != NULL) {
-   		snd_ctl_close(request->cardhandle);
-   		if (verbose) fprintf (stderr, "sndcard: %s release\n", request->cardid);
-   }
-
    return jsonNewStatus (AJG_SUCCESS);
 
 OnErrorExit:
    if (sndcard) json_object_put (sndcard);
-
-   // if we have a valid card handle let's close it
-   if (request->cardhandle != (void*)TRUE && request->cardhandle != NULL) snd_ctl_close(request->cardhandle);
    return (errorMsg);
 }
 
 
 // load a session for requested card
 PUBLIC json_object *alsaLoadSession (AJG_session *session, AJG_request *request) {
-   json_object *jsonSession=NULL, *errorMsg, *sndcard, *element, *cardinfo, *jsonResponse;
+   json_object *jsonSession=NULL, *errorMsg, *sndcard, *element, *cardinfo, *jsonResponse, *loadJ;
+   AJG_loadcount count = {0, 0, 0};
    const char *sessionname;
    unsigned int index;
 
    // probe soundcard to check it exist and get it name
-   request->cardhandle = (void*)TRUE; // request for not closing card handle
    sndcard = alsaProbeCard (session, request);
-   if (request->cardname == NULL) {
+   if (request->cardname == NULL || (request->cardslot == NULL && !session->fakemod)) {
        errorMsg =  jsonNewMessage (AJG_FATAL,"Sound card [%s] has no 'name' element", request->cardid);
   	   goto OnErrorExit;
    }
 
+   // controls are written through numid index
+   if (!session->fakemod && (errorMsg = alsaLoadControls (session, request)) != NULL) goto OnErrorExit;
+
    // request session from disk [response is a valid json error or a valid session]
    jsonSession = sessionFromDisk (session, request);
 
@@ -880,18 +1363,21 @@ PUBLIC json_object *alsaLoadSession (AJG_session *session, AJG_request *request)
            fprintf (stderr, "AJG:WARNING invalid session [%s] descriptor [%s]\n", request->args, json_object_to_json_string(control));
         }
 
-        // apply control to sound card ignoring errors
-        if (!session->fakemod) (void) alsaSimpleSetCtrl (session, request, ctrlnumid, ctrlvalue);
+        // apply control to sound card ignoring errors, only controls differing from card unless forced
+        if (session->fakemod) continue;
+        switch (alsaSimpleSetCtrl (session, request, ctrlnumid, ctrlvalue, request->force)) {
+           case AJG_SUCCESS: count.written++; break;
+           case AJG_EMPTY:   count.skipped++; break;
+           default:          count.failed++;
+        }
    }
 
-   // we done let free jsonSession object
-   json_object_put   (sndcard);
+   // simulated card gets session values, other fakemod cards ignore them
+   if (session->fakemod) (void) simulLoadSession (session, request, cardinfo, &count);
+   if (verbose) fprintf (stderr, "AJG: session [%s] on [%s] written=%d skipped=%d failed=%d\n", request->args, request->cardname, count.written, count.skipped, count.failed);
 
-   // if we have a valid card handle let's close it
-   if (request->cardhandle != (void*)TRUE && request->cardhandle != NULL) {
-   		snd_ctl_close(request->cardhandle);
-   		if (verbose) fprintf (stderr, "sndcard: %s release\n", request->cardid);
-   }
+   // we done let free jsonSession object [sndcard handle remains within pool]
+   json_object_put   (sndcard);
 
    switch (request->quiet) {
      case 0:
@@ -911,29 +1397,49 @@ PUBLIC json_object *alsaLoadSession (AJG_session *session, AJG_request *request)
           jsonResponse = jsonNewMessage (AJG_SUCCESS,"session [%s] Loaded on [%s]", request->args, request->cardname);
    }
 
+   // every quiet level tells what session load did to the card
+   if (json_object_is_type (jsonResponse, json_type_object)) {
+       loadJ = json_object_new_object ();
+       json_object_object_add (loadJ, "written", json_object_new_int (count.written));
+       json_object_object_add (loadJ, "skipped", json_object_new_int (count.skipped));
+       json_object_object_add (loadJ, "failed" , json_object_new_int (count.failed));
+       json_object_object_add (jsonResponse, "load", loadJ);
+   }
+
    return jsonResponse;
 
 OnErrorExit:
    if (jsonSession) json_object_put (jsonSession);
    if (sndcard) json_object_put (sndcard);
-
-   // if we have a valid card handle let's close it
-   if (request->cardhandle != (void*)TRUE && request->cardhandle != NULL) snd_ctl_close(request->cardhandle);
    return (errorMsg);
 }
 
 // load every control from the board in a very quiet mode to serialize on disk
 PUBLIC json_object *alsaStoreSession (AJG_session *session, AJG_request *request) {
     json_object *controls, *response;
+    AJG_jbuf *jbuf = request->jbuf;
 
+    // a store is a write, it is never answered 304 nor tagged even when sent as a GET with If-None-Match
+    request->ifnonematch = NULL;
     request->quiet = 2;  // run quiet mode
+    request->jbuf = NULL; // session is written from a json tree
     controls = alsaGetControl (session, request);
+    request->jbuf = jbuf;
+    request->etag[0] = '\0';
+    request->notmodified = FALSE;
 
     if (request->cardname == NULL) {
-       return jsonNewMessage (AJG_FATAL,"Sound card [hw:%d] no [name] element", request->cardid);
+       if (controls) json_object_put (controls);
+       return jsonNewMessage (AJG_FATAL,"Sound card [%s] no [name] element", request->cardid);
     }
+
+    // read errors come back as a message without data, they are returned instead of being saved
+    if (controls == NULL) {
+       return jsonNewMessage (AJG_FATAL,"Sound card [%s] controls could not be read", request->cardid);
+    }
+    if (!json_object_object_get_ex (controls, "data", NULL)) return controls;
+
+    // sessionToDisk takes ownership of controls
     response = sessionToDisk (session, request, controls);
-    // this triggers a segfault
-    //json_object_put   (controls);    // decrease reference count to free the json object
     return response;
 }
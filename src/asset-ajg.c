@@ -0,0 +1,383 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Static files of rootdir kept in memory. When a whole UI reloads, every
+    file is served from memory without open/fstat, precompressed siblings
+    [file.gz, file.br] are loaded with their file and sent to clients that
+    accept them.
+
+    Directory of every cached file is watched through inotify, any change
+    within it drops its cached files. Memory is capped by config->assetCache,
+    least recently used files are evicted first. Files larger than an eighth
+    of the cap are never cached, httpd sends them from their fd [sendfile].
+
+   References:
+   http://man7.org/linux/man-pages/man7/inotify.7.html
+*/
+
+#include "local-def-ajg.h"
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#define AJG_ASSET_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// content type from file extension, anything else is sent as binary
+STATIC const char *assetMimeTypes[][2] = {
+    {"html" , "text/html; charset=utf-8"},
+    {"htm"  , "text/html; charset=utf-8"},
+    {"js"   , "application/javascript; charset=utf-8"},
+    {"css"  , "text/css; charset=utf-8"},
+    {"json" , "application/json"},
+    {"ajg"  , "application/json"},
+    {"map"  , "application/json"},
+    {"txt"  , "text/plain; charset=utf-8"},
+    {"svg"  , "image/svg+xml"},
+    {"png"  , "image/png"},
+    {"jpg"  , "image/jpeg"},
+    {"jpeg" , "image/jpeg"},
+    {"gif"  , "image/gif"},
+    {"ico"  , "image/x-icon"},
+    {"woff" , "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf"  , "font/ttf"},
+    {NULL, NULL}
+};
+
+// suffix of precompressed siblings by encoding, compressed on the fly ones have none
+STATIC const char *assetSuffix [AJG_ENCODINGS] = {NULL, ".gz", NULL, ".br"};
+
+STATIC unsigned int assetHash (const char *filepath) {
+    unsigned int hash = 5381;
+
+    while (*filepath) hash = hash * 33 + (unsigned char) *filepath++;
+    return hash % AJG_ASSET_BUCKETS;
+}
+
+STATIC void assetFree (AJG_assets *assets, AJG_asset *asset) {
+    int idx;
+
+    for (idx=0; idx < AJG_ENCODINGS; idx++) jbufRelease (asset->variants[idx]);
+    assets->memory -= asset->memory;
+    assets->files--;
+    free (asset->filepath);
+    free (asset);
+}
+
+// remove every file matching wd [-1 for all], return number of files dropped [asset lock held]
+STATIC int assetDrop (AJG_assets *assets, int wd) {
+    int idx, count = 0;
+
+    for (idx=0; idx < AJG_ASSET_BUCKETS; idx++) {
+        AJG_asset **prev = &assets->buckets[idx];
+
+        while (*prev) {
+            AJG_asset *asset = *prev;
+
+            if (wd >= 0 && asset->wd != wd) {
+                prev = &asset->next;
+                continue;
+            }
+            *prev = asset->next;
+            assetFree (assets, asset);
+            count++;
+        }
+    }
+    return count;
+}
+
+// make room for len bytes, least recently used files go first [asset lock held]
+STATIC void assetEvict (AJG_session *session, AJG_assets *assets, size_t len) {
+    size_t cap = (size_t) session->config->assetCache * 1024;
+
+    while (assets->memory + len > cap && assets->files > 0) {
+        AJG_asset **oldest = NULL, **prev, *asset;
+        int idx;
+
+        for (idx=0; idx < AJG_ASSET_BUCKETS; idx++) {
+            for (prev = &assets->buckets[idx]; *prev; prev = &(*prev)->next) {
+                if (oldest == NULL || (*prev)->lastused < (*oldest)->lastused) oldest = prev;
+            }
+        }
+
+        asset = *oldest;
+        *oldest = asset->next;
+        assetFree (assets, asset);
+        assets->evictions++;
+    }
+}
+
+// whole file within a new block [refcount=1], NULL when it cannot be read
+STATIC AJG_rbuf *assetRead (int fd, size_t size) {
+    AJG_rbuf *block;
+    size_t done = 0;
+
+    if ((block = malloc (sizeof (AJG_rbuf) + size)) == NULL) return NULL;
+    while (done < size) {
+        ssize_t count = read (fd, &block->data[done], size - done);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            free (block);
+            return NULL;
+        }
+        done += count;
+    }
+    block->refcount = 1;
+    block->len = size;
+    return block;
+}
+
+// precompressed sibling of filepath, only kept when smaller than original
+STATIC AJG_rbuf *assetSibling (const char *filepath, int encoding, size_t size) {
+    char sibling [512];
+    struct stat sbuf;
+    AJG_rbuf *block = NULL;
+    int fd;
+
+    snprintf (sibling, sizeof (sibling), "%s%s", filepath, assetSuffix[encoding]);
+    if ((fd = open (sibling, O_RDONLY)) < 0) return NULL;
+    if (fstat (fd, &sbuf) == 0 && S_ISREG (sbuf.st_mode) && (size_t) sbuf.st_size < size) block = assetRead (fd, sbuf.st_size);
+    close (fd);
+    return block;
+}
+
+// fill ref with best variant accepted by client [asset lock held]
+STATIC void assetRef (AJG_assets *assets, AJG_asset *asset, int accept, AJG_assetref *ref) {
+    int encoding = AJG_ENCODING_IDENTITY;
+
+    if ((accept & (1 << AJG_ENCODING_BR)) && asset->variants[AJG_ENCODING_BR]) encoding = AJG_ENCODING_BR;
+    else if ((accept & (1 << AJG_ENCODING_GZIP)) && asset->variants[AJG_ENCODING_GZIP]) encoding = AJG_ENCODING_GZIP;
+
+    ref->block    = asset->variants[encoding];
+    ref->encoding = encoding;
+    ref->mime     = asset->mime;
+    ref->size     = asset->size;
+    ref->mtime    = asset->mtime;
+    ref->vary     = (asset->variants[AJG_ENCODING_BR] || asset->variants[AJG_ENCODING_GZIP]);
+    jbufHold (ref->block);
+
+    asset->lastused = ++assets->clock;
+}
+
+// generation of watch wd, a file read under an older one may be stale [asset lock held]
+STATIC unsigned long assetGeneration (AJG_assets *assets, int wd) {
+    return assets->generation + (wd >= 0 && wd < assets->wdsize ? assets->wdgens[wd] : 0);
+}
+
+// directory of watch wd changed [-1 when events were lost] [asset lock held]
+STATIC void assetBump (AJG_assets *assets, int wd) {
+
+    if (wd >= assets->wdsize && wd >= 0) {
+        int size = wd + 64;
+        unsigned long *wdgens = realloc (assets->wdgens, size * sizeof (unsigned long));
+
+        if (wdgens != NULL) {
+            memset (&wdgens[assets->wdsize], 0, (size - assets->wdsize) * sizeof (unsigned long));
+            assets->wdgens = wdgens;
+            assets->wdsize = size;
+        }
+    }
+    if (wd >= 0 && wd < assets->wdsize) assets->wdgens[wd]++;
+    else assets->generation++;
+}
+
+// inotify reports a change within a watched directory, its cached files are dropped
+STATIC void assetNotifyCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_assets *assets = session->assets;
+    char events [4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read (assets->inotify, events, sizeof (events))) > 0) {
+        char *ptr;
+
+        pthread_mutex_lock (&assets->lock);
+        for (ptr = events; ptr < events + len; ptr += sizeof (struct inotify_event) + ((struct inotify_event*)ptr)->len) {
+            struct inotify_event *event = (struct inotify_event*)ptr;
+
+            // lost events, nothing can be trusted any more
+            if (event->mask & IN_Q_OVERFLOW) {
+                assets->invalidations += assetDrop (assets, -1);
+                assetBump (assets, -1);
+            } else {
+                assets->invalidations += assetDrop (assets, event->wd);
+                assetBump (assets, event->wd);
+            }
+        }
+        pthread_mutex_unlock (&assets->lock);
+    }
+}
+
+PUBLIC void assetInit (AJG_session *session) {
+    session->assets = malloc (sizeof (AJG_assets));
+    memset (session->assets, 0, sizeof (AJG_assets));
+    pthread_mutex_init (&session->assets->lock, NULL);
+    session->assets->inotify = -1;
+}
+
+// watch for file changes from main loop, without inotify files are never cached
+PUBLIC void assetStart (AJG_session *session) {
+    AJG_assets *assets = session->assets;
+
+    if (session->config->assetCache <= 0) return;
+
+    assets->inotify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (assets->inotify < 0 || eventAdd (session, assets->inotify, EPOLLIN, assetNotifyCB, NULL) == NULL) {
+        fprintf (stderr, "AJG: asset cache disabled, inotify error=%s\n", strerror(errno));
+        if (assets->inotify >= 0) close (assets->inotify);
+        assets->inotify = -1;
+    }
+}
+
+PUBLIC const char *assetMime (const char *filepath) {
+    const char *ext = strrchr (filepath, '.');
+    int idx;
+
+    if (ext == NULL || strchr (ext, '/')) return "application/octet-stream";
+    for (idx=0; assetMimeTypes[idx][0]; idx++) {
+        if (!strcasecmp (ext+1, assetMimeTypes[idx][0])) return assetMimeTypes[idx][1];
+    }
+    return "application/octet-stream";
+}
+
+// cached file in best encoding accepted by client [ref->block held], FALSE when not in memory
+PUBLIC int assetFind (AJG_session *session, const char *filepath, int accept, AJG_assetref *ref) {
+    AJG_assets *assets = session->assets;
+    AJG_asset *asset;
+
+    if (assets->inotify < 0) return FALSE;
+
+    pthread_mutex_lock (&assets->lock);
+    for (asset = assets->buckets[assetHash (filepath)]; asset; asset = asset->next) {
+        if (!strcmp (asset->filepath, filepath)) break;
+    }
+    if (asset) {
+        assets->hits++;
+        assetRef (assets, asset, accept, ref);
+    } else {
+        assets->misses++;
+    }
+    pthread_mutex_unlock (&assets->lock);
+
+    return (asset != NULL);
+}
+
+// load regular file opened by httpd within cache [ref->block held], FALSE when it should be sent from fd
+PUBLIC int assetLoad (AJG_session *session, const char *filepath, int fd, struct stat *sbuf, int accept, AJG_assetref *ref) {
+    AJG_assets *assets = session->assets;
+    size_t cap = (size_t) session->config->assetCache * 1024;
+    AJG_asset *asset, **prev;
+    char dirpath [512], *slash;
+    unsigned long generation;
+    unsigned int bucket;
+    int idx;
+
+    if (assets->inotify < 0 || (size_t) sbuf->st_size > cap / 8) {
+        __sync_fetch_and_add (&assets->uncached, 1);
+        return FALSE;
+    }
+
+    // directory is watched before file is read and its generation taken, an event processed
+    // before file gets inserted finds nothing to drop but changes generation
+    strncpy (dirpath, filepath, sizeof (dirpath) - 1);
+    dirpath [sizeof (dirpath) - 1] = '\0';
+    if ((slash = strrchr (dirpath, '/')) != NULL) *slash = '\0';
+
+    asset = malloc (sizeof (AJG_asset));
+    memset (asset, 0, sizeof (AJG_asset));
+    asset->wd = inotify_add_watch (assets->inotify, dirpath, AJG_ASSET_EVENTS);
+    if (asset->wd < 0) {
+        free (asset);
+        __sync_fetch_and_add (&assets->uncached, 1);
+        return FALSE;
+    }
+
+    pthread_mutex_lock (&assets->lock);
+    generation = assetGeneration (assets, asset->wd);
+    pthread_mutex_unlock (&assets->lock);
+
+    if ((asset->variants[AJG_ENCODING_IDENTITY] = assetRead (fd, sbuf->st_size)) == NULL) {
+        free (asset);
+        __sync_fetch_and_add (&assets->uncached, 1);
+        return FALSE;
+    }
+
+    asset->filepath = strdup (filepath);
+    asset->mime     = assetMime (filepath);
+    asset->size     = sbuf->st_size;
+    asset->mtime    = sbuf->st_mtim;
+    for (idx=0; idx < AJG_ENCODINGS; idx++) {
+        if (assetSuffix[idx]) asset->variants[idx] = assetSibling (filepath, idx, sbuf->st_size);
+        if (asset->variants[idx]) asset->memory += asset->variants[idx]->len;
+    }
+
+    pthread_mutex_lock (&assets->lock);
+
+    // directory changed while reading, what was read is sent once but never cached
+    if (generation != assetGeneration (assets, asset->wd)) {
+        assetRef (assets, asset, accept, ref);
+        __sync_fetch_and_add (&assets->uncached, 1);
+        pthread_mutex_unlock (&assets->lock);
+
+        for (idx=0; idx < AJG_ENCODINGS; idx++) jbufRelease (asset->variants[idx]);
+        free (asset->filepath);
+        free (asset);
+        return TRUE;
+    }
+
+    // file and its smaller siblings take less than half the cap, they always fit once older files are gone
+    assetEvict (session, assets, asset->memory);
+
+    // another thread may have loaded the same file meanwhile
+    bucket = assetHash (filepath);
+    for (prev = &assets->buckets[bucket]; *prev; prev = &(*prev)->next) {
+        if (!strcmp ((*prev)->filepath, filepath)) {
+            AJG_asset *old = *prev;
+            *prev = old->next;
+            assetFree (assets, old);
+            break;
+        }
+    }
+    asset->next = assets->buckets[bucket];
+    assets->buckets[bucket] = asset;
+    assets->memory += asset->memory;
+    assets->files++;
+
+    assetRef (assets, asset, accept, ref);
+    pthread_mutex_unlock (&assets->lock);
+
+    return TRUE;
+}
+
+PUBLIC json_object *assetStats (AJG_session *session) {
+    AJG_assets *assets = session->assets;
+    json_object *statsJ = json_object_new_object();
+
+    pthread_mutex_lock (&assets->lock);
+    json_object_object_add (statsJ, "files"        , json_object_new_int64 (assets->files));
+    json_object_object_add (statsJ, "memory"       , json_object_new_int64 (assets->memory));
+    json_object_object_add (statsJ, "hits"         , json_object_new_int64 (assets->hits));
+    json_object_object_add (statsJ, "misses"       , json_object_new_int64 (assets->misses));
+    json_object_object_add (statsJ, "uncached"     , json_object_new_int64 (assets->uncached));
+    json_object_object_add (statsJ, "evictions"    , json_object_new_int64 (assets->evictions));
+    json_object_object_add (statsJ, "invalidations", json_object_new_int64 (assets->invalidations));
+    pthread_mutex_unlock (&assets->lock);
+
+    return statsJ;
+}
@@ -0,0 +1,407 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    In memory model of every control of a pooled sndcard. Each hctl element
+    carries an AJG_sndctrl as callback private data. Alsa control events
+    (subscribed through snd_ctl_subscribe_events) only invalidate the entry,
+    value is re-read on next access. A GET then costs one non-blocking read
+    of the event queue instead of one ioctl per control.
+
+    Controls are also indexed by numid within their slot, numids are small
+    and dense so a plain array gives a direct access to any control.
+
+    Static metadata [ranges, enums, acl, tlv] is serialized once per control and
+    only dropped when an INFO event changes the element.
+
+    Enum lists and tlv blocks are interned within slot dictionaries when
+    metadata is built. Controls with the same list share its serialized
+    blocks and refer to it by index in dict=1 responses, where every list is
+    written once [Scarlett routing controls all carry the same 40+ items].
+
+    Value events also queue the control on its slot changed list. Once events
+    are processed every changed control gets a new generation number, changes
+    are pushed to websocket subscribers and parked long-poll requests wake up.
+
+    Volatile controls [volat ACL] do not send events. They are read live or,
+    when config->volatileRefresh is set, at most once every volatileRefresh ms.
+
+    Add, remove and info events also drop the slot schema hash, it is only
+    computed again when a client asks for ctrl-get-schema or ctrl-get-values.
+
+    Every event also moves slot content generation. Full ctrl-get-all responses
+    are kept per quiet level together with their compressed variants, and
+    served as they are until content moves [or volatileRefresh expires when
+    they hold volatile controls].
+
+   References:
+   http://www.alsa-project.org/alsa-doc/alsa-lib/group___h_control.html
+*/
+
+#include "local-def-ajg.h"
+#include <alsa/asoundlib.h>
+
+// monotonic time in ms for volatile refresh
+STATIC long long cacheNow (void) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// one control less refers to a dictionary entry, entry is freed with its last user
+STATIC void cacheUnref (AJG_cardslot *slot, int dict, int index) {
+    AJG_dictentry *entry;
+
+    if (index < 0 || index >= slot->dicts[dict].count) return;
+    entry = &slot->dicts[dict].entries[index];
+    if (--entry->refs == 0) jbufPrebuiltFree (&entry->value);
+}
+
+// release prebuilt metadata, responses get their own copy when written
+STATIC void cacheFreeMeta (AJG_sndctrl *ctrl) {
+    if (ctrl->name)     free (ctrl->name);
+    jbufPrebuiltFree (&ctrl->metaCtrl);
+    jbufPrebuiltFree (&ctrl->metaAcl);
+    jbufPrebuiltFree (&ctrl->metaTlv);
+    jbufPrebuiltFree (&ctrl->metaRef);
+    cacheUnref (ctrl->slot, AJG_DICT_ENUMS, ctrl->enumref);
+    cacheUnref (ctrl->slot, AJG_DICT_TLVS, ctrl->tlvref);
+    ctrl->enumref = ctrl->tlvref = -1;
+
+    ctrl->name = NULL;
+    ctrl->iface = NULL;
+    ctrl->metavalid = FALSE;
+}
+
+STATIC void cacheFreeCtrl (AJG_sndctrl *ctrl) {
+    cacheFreeMeta (ctrl);
+    if (ctrl->info)  snd_ctl_elem_info_free (ctrl->info);
+    if (ctrl->value) snd_ctl_elem_value_free (ctrl->value);
+    free (ctrl);
+}
+
+// queue control on its card changed list
+STATIC void cacheQueueChange (AJG_sndctrl *ctrl) {
+    if (ctrl->changed) return;
+    ctrl->changed = TRUE;
+    ctrl->nextchanged = ctrl->slot->changed;
+    ctrl->slot->changed = ctrl;
+}
+
+// register control within numid index, array grows with highest numid
+STATIC void cacheIndexCtrl (AJG_cardslot *slot, AJG_sndctrl *ctrl) {
+
+    if (ctrl->numid >= slot->indexsize) {
+        unsigned int size = slot->indexsize ? slot->indexsize : 64;
+        AJG_sndctrl **index;
+
+        while (size <= ctrl->numid) size *= 2;
+        index = realloc (slot->index, size * sizeof (AJG_sndctrl*));
+        if (index == NULL) return; // control remains reachable through element list
+        memset (&index[slot->indexsize], 0, (size - slot->indexsize) * sizeof (AJG_sndctrl*));
+        slot->index = index;
+        slot->indexsize = size;
+    }
+    slot->index[ctrl->numid] = ctrl;
+}
+
+// element callback, alsa events only invalidate cached data
+STATIC int cacheElemEvent (snd_hctl_elem_t *elem, unsigned int mask) {
+    AJG_sndctrl *ctrl = snd_hctl_elem_get_callback_private (elem);
+
+    if (ctrl == NULL) return 0;
+    ctrl->slot->content++;
+    if (mask == SND_CTL_EVENT_MASK_REMOVE || (mask & SND_CTL_EVENT_MASK_INFO)) ctrl->slot->schemavalid = FALSE;
+
+    // element is about to be freed by hctl [control removed or handle closed]
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        if (ctrl->changed) {
+            AJG_sndctrl **prev = &ctrl->slot->changed;
+            while (*prev != ctrl) prev = &(*prev)->nextchanged;
+            *prev = ctrl->nextchanged;
+        }
+        if (ctrl->numid < ctrl->slot->indexsize && ctrl->slot->index[ctrl->numid] == ctrl) ctrl->slot->index[ctrl->numid] = NULL;
+        if (ctrl->volat) ctrl->slot->volatiles--;
+        snd_hctl_elem_set_callback_private (elem, NULL);
+        cacheFreeCtrl (ctrl);
+        return 0;
+    }
+
+    if (mask & SND_CTL_EVENT_MASK_INFO)  ctrl->infovalid  = FALSE;
+    if (mask & SND_CTL_EVENT_MASK_VALUE) ctrl->valuevalid = FALSE;
+
+    // remember change for subscribers, pushed once every pending event is processed
+    if (mask & SND_CTL_EVENT_MASK_VALUE) cacheQueueChange (ctrl);
+
+    return 0;
+}
+
+// hctl callback, attach a cache entry to every new element [snd_hctl_load also sends ADD for each element]
+STATIC int cacheHctlEvent (snd_hctl_t *hctl, unsigned int mask, snd_hctl_elem_t *elem) {
+    AJG_sndctrl *ctrl;
+
+    if (!(mask & SND_CTL_EVENT_MASK_ADD)) return 0;
+
+    ctrl = malloc (sizeof (AJG_sndctrl));
+    memset (ctrl, 0, sizeof (AJG_sndctrl));
+    ctrl->numid = snd_hctl_elem_get_numid (elem);
+    ctrl->elem  = elem;
+    ctrl->slot  = snd_hctl_get_callback_private (hctl);
+    ctrl->generation = ctrl->slot->generation;
+    ctrl->enumref = ctrl->tlvref = -1;
+
+    if (snd_ctl_elem_info_malloc ((snd_ctl_elem_info_t**)&ctrl->info) < 0 ||
+        snd_ctl_elem_value_malloc ((snd_ctl_elem_value_t**)&ctrl->value) < 0) {
+        cacheFreeCtrl (ctrl);
+        return -ENOMEM;
+    }
+
+    snd_hctl_elem_set_callback_private (elem, ctrl);
+    snd_hctl_elem_set_callback (elem, cacheElemEvent);
+    cacheIndexCtrl (ctrl->slot, ctrl);
+    ctrl->slot->content++;
+    ctrl->slot->schemavalid = FALSE;
+
+    // control added after initial load is a change for clients
+    if (ctrl->slot->loaded) cacheQueueChange (ctrl);
+    return 0;
+}
+
+// register cache callbacks on hctl, should be called before snd_hctl_load
+PUBLIC void cacheAttachCard (AJG_session *session, AJG_cardslot *slot, void *hctl) {
+    snd_hctl_set_callback (hctl, cacheHctlEvent);
+    snd_hctl_set_callback_private (hctl, slot);
+    slot->schemavalid = FALSE;
+}
+
+// direct access to a control from its numid [slot lock held]
+PUBLIC AJG_sndctrl *cacheFindCtrl (AJG_cardslot *slot, int numid) {
+    if (numid < 0 || (unsigned int)numid >= slot->indexsize) return NULL;
+    return slot->index[numid];
+}
+
+// value written by gateway, re-read on next access since driver may adjust it [slot lock held]
+PUBLIC void cacheDirtyCtrl (AJG_sndctrl *ctrl) {
+    ctrl->valuevalid = FALSE;
+    ctrl->slot->content++;
+}
+
+// process pending alsa events without blocking, return number of events or alsa error
+PUBLIC int cacheUpdateCard (AJG_session *session, AJG_cardslot *slot) {
+    int count;
+
+    if (slot->hctl == NULL) return 0;
+
+    count = snd_hctl_handle_events (slot->hctl);
+    if (count > 0) __sync_fetch_and_add (&session->cardpool->events, count);
+
+    if (slot->changed == NULL) return count;
+
+    // one generation for this batch of changes, then push values to subscribers
+    slot->generation = __sync_add_and_fetch (&session->cardpool->generation, 1);
+    while (slot->changed) {
+        AJG_sndctrl *ctrl = slot->changed;
+
+        slot->changed = ctrl->nextchanged;
+        ctrl->changed = FALSE;
+        ctrl->nextchanged = NULL;
+        ctrl->generation = slot->generation;
+        wsockNotify (session, slot, ctrl);
+    }
+    deltaWake (session, slot);
+
+    return count;
+}
+
+// return element info, only read from sndcard after an INFO event
+PUBLIC void *cacheGetInfo (AJG_session *session, AJG_sndctrl *ctrl, int *err) {
+
+    *err = 0;
+    if (ctrl->infovalid) return ctrl->info;
+
+    if ((*err = snd_hctl_elem_info (ctrl->elem, ctrl->info)) < 0) return NULL;
+
+    // info changed, static metadata will be rebuilt on next verbose request
+    cacheFreeMeta (ctrl);
+    if (ctrl->volat) ctrl->slot->volatiles--;
+    ctrl->volat = snd_ctl_elem_info_is_volatile (ctrl->info);
+    if (ctrl->volat) ctrl->slot->volatiles++;
+    ctrl->infovalid = TRUE;
+    return ctrl->info;
+}
+
+// return element value from memory when no event changed it since last read
+PUBLIC void *cacheGetValue (AJG_session *session, AJG_sndctrl *ctrl, int *err) {
+    long long now = 0;
+
+    *err = 0;
+    if (ctrl->volat) {
+        now = cacheNow ();
+        if (session->config->volatileRefresh <= 0 || now - ctrl->readtime >= session->config->volatileRefresh) ctrl->valuevalid = FALSE;
+    }
+
+    if (ctrl->valuevalid) {
+        __sync_fetch_and_add (&session->cardpool->cached, 1);
+        return ctrl->value;
+    }
+
+    if ((*err = snd_hctl_elem_read (ctrl->elem, ctrl->value)) < 0) return NULL;
+
+    __sync_fetch_and_add (&session->cardpool->reads, 1);
+    ctrl->readtime = now ? now : cacheNow ();
+    ctrl->valuevalid = TRUE;
+    return ctrl->value;
+}
+
+STATIC void cacheDropEntry (AJG_respcache *entry) {
+    int idx;
+
+    for (idx=0; idx < AJG_ENCODINGS; idx++) {
+        jbufRelease (entry->variants[idx]);
+        entry->variants[idx] = NULL;
+    }
+}
+
+// share value with an identical dictionary entry or add it, prebuilt gets its own reference
+// on entry blocks. Returns entry index [slot lock held, lists are few and scanned linearly]
+PUBLIC int cacheIntern (AJG_cardslot *slot, int dict, json_object *valueJ, AJG_prebuilt *prebuilt) {
+    AJG_dict *table = &slot->dicts[dict];
+    AJG_dictentry *entry = NULL;
+    const char *text;
+    unsigned long long hash = 14695981039346656037ULL;
+    int idx, format;
+
+    // same text as prebuilt json block, entries are compared on it
+    text = json_object_to_json_string_ext (valueJ, JSON_C_TO_STRING_SPACED);
+    for (idx=0; text[idx]; idx++) hash = (hash ^ (unsigned char) text[idx]) * 1099511628211ULL;
+
+    for (idx=0; idx < table->count; idx++) {
+        AJG_dictentry *current = &table->entries[idx];
+
+        if (current->refs == 0) {
+            if (entry == NULL) entry = current;
+            continue;
+        }
+        if (current->hash == hash && current->value.formats[AJG_FORMAT_JSON] && !strcmp (current->value.formats[AJG_FORMAT_JSON]->data, text)) {
+            entry = current;
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        if (table->count == table->size) {
+            int size = table->size ? table->size * 2 : 16;
+            AJG_dictentry *entries = realloc (table->entries, size * sizeof (AJG_dictentry));
+
+            if (entries == NULL) {
+                jbufPrebuild (prebuilt, valueJ); // control keeps a private copy
+                return -1;
+            }
+            table->entries = entries;
+            table->size = size;
+        }
+        entry = &table->entries[table->count++];
+        memset (entry, 0, sizeof (AJG_dictentry));
+    }
+
+    if (entry->refs == 0) {
+        jbufPrebuild (&entry->value, valueJ);
+        entry->hash = hash;
+    }
+    entry->refs++;
+
+    for (format=0; format < AJG_FORMATS; format++) {
+        prebuilt->formats[format] = entry->value.formats[format];
+        if (prebuilt->formats[format]) jbufHold (prebuilt->formats[format]);
+    }
+    return (int) (entry - table->entries);
+}
+
+// release dictionaries once every control is gone [closing card]
+PUBLIC void cacheDropDicts (AJG_cardslot *slot) {
+    int dict, idx;
+
+    for (dict=0; dict < AJG_DICTS; dict++) {
+        for (idx=0; idx < slot->dicts[dict].count; idx++) jbufPrebuiltFree (&slot->dicts[dict].entries[idx].value);
+        free (slot->dicts[dict].entries);
+        memset (&slot->dicts[dict], 0, sizeof (AJG_dict));
+    }
+}
+
+// release every cached response of a slot [closing card or content moved]
+PUBLIC void cacheDropResponses (AJG_cardslot *slot) {
+    int idx;
+
+    for (idx=0; idx < AJG_RESPCACHE_LAYOUTS * AJG_FORMATS; idx++) cacheDropEntry (&slot->respcache[idx]);
+}
+
+// cache entry for ctrl-get-all at this quiet level, NULL when responses with this layout are not cached.
+// Dictionaries only change verbose responses [quiet=0]
+PUBLIC AJG_respcache *cacheResponseEntry (AJG_cardslot *slot, int quiet, int dict, int format) {
+    if (quiet < 0 || quiet >= AJG_RESPCACHE_QUIET || format < 0 || format >= AJG_FORMATS) return NULL;
+    if (dict && quiet == 0) quiet = AJG_RESPCACHE_QUIET;
+    return &slot->respcache[format * AJG_RESPCACHE_LAYOUTS + quiet];
+}
+
+// still valid response [one more reference for caller] or NULL, stale variants are dropped [slot lock held]
+PUBLIC AJG_rbuf *cacheGetResponse (AJG_session *session, AJG_cardslot *slot, AJG_respcache *entry) {
+    AJG_rbuf *block = entry->variants[AJG_ENCODING_IDENTITY];
+
+    if (block == NULL) return NULL;
+
+    if (entry->content != slot->content ||
+        (entry->volat && (session->config->volatileRefresh <= 0 || cacheNow () - entry->built >= session->config->volatileRefresh))) {
+        cacheDropEntry (entry);
+        return NULL;
+    }
+
+    jbufHold (block);
+    return block;
+}
+
+// keep a freshly written response, volatile controls are never cached when read live [slot lock held]
+PUBLIC void cacheStoreResponse (AJG_session *session, AJG_cardslot *slot, AJG_respcache *entry, AJG_rbuf *block, int volat) {
+
+    cacheDropEntry (entry);
+    if (volat && session->config->volatileRefresh <= 0) return;
+
+    jbufHold (block);
+    entry->variants[AJG_ENCODING_IDENTITY] = block;
+    entry->content = slot->content;
+    entry->built   = cacheNow ();
+    entry->volat   = volat;
+}
+
+// compressed variant of a cached response, only compressed once per content [one more reference for caller]
+PUBLIC AJG_rbuf *cacheEncodeResponse (AJG_session *session, AJG_respcache *entry, int encoding) {
+    AJG_rbuf *block;
+
+    // entries outside of card slots [fakemod] carry their own lock
+    if (entry->lock) pthread_mutex_lock (entry->lock);
+    block = entry->variants[encoding];
+
+    if (block == NULL && entry->variants[AJG_ENCODING_IDENTITY]) {
+        block = compressBlock (session, entry->variants[AJG_ENCODING_IDENTITY], encoding);
+        entry->variants[encoding] = block;
+    }
+    if (block) jbufHold (block);
+    if (entry->lock) pthread_mutex_unlock (entry->lock);
+    return block;
+}
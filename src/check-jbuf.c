@@ -0,0 +1,399 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    make check program for the streaming writer. Every ctrl-get-all sample
+    [$AJG_SAMPLES/CTRL_GET_ALL-hw:*.ajg] is written member by member in json,
+    CBOR and MessagePack. Json output has to match json-c serialization byte
+    for byte, binary outputs are decoded back to a json-c tree that has to
+    equal the sample. A few hand built values check what samples do not
+    hold: msgpack map32/array32 counts patched on close, CBOR indefinite
+    length containers closed by a break, negative integers at every width.
+
+   References:
+   https://tools.ietf.org/html/rfc7049
+   https://github.com/msgpack/msgpack/blob/master/spec.md
+*/
+
+#include "local-def-ajg.h"
+#include <glob.h>
+
+#define CHECK_SAMPLES "CTRL_GET_ALL-hw:*.ajg"
+
+typedef struct {
+  const unsigned char *cur;
+  const unsigned char *end;
+} CHECK_input;
+
+STATIC int checkFailed = 0;
+
+STATIC void checkResult (const char *name, const char *format, int success) {
+    printf ("%s: %s [%s]\n", success ? "PASS" : "FAIL", name, format);
+    if (!success) checkFailed++;
+}
+
+// same walk as writer callers do, through public jbuf calls only
+STATIC void checkWrite (AJG_jbuf *jbuf, json_object *jsonObj) {
+    int idx;
+
+    switch (json_object_get_type (jsonObj)) {
+        case json_type_boolean:
+            jbufBool (jbuf, json_object_get_boolean (jsonObj));
+            break;
+        case json_type_int:
+            jbufInt (jbuf, json_object_get_int64 (jsonObj));
+            break;
+        case json_type_string:
+            jbufString (jbuf, json_object_get_string (jsonObj));
+            break;
+        case json_type_object:
+            jbufObjectStart (jbuf);
+            {
+                json_object_object_foreach (jsonObj, key, value) {
+                    jbufKey (jbuf, key);
+                    checkWrite (jbuf, value);
+                }
+            }
+            jbufObjectEnd (jbuf);
+            break;
+        case json_type_array:
+            jbufArrayStart (jbuf);
+            for (idx=0; idx < (int)json_object_array_length (jsonObj); idx++) checkWrite (jbuf, json_object_array_get_idx (jsonObj, idx));
+            jbufArrayEnd (jbuf);
+            break;
+        default:  // double and null have no dedicated writer call
+            jbufJson (jbuf, jsonObj);
+    }
+}
+
+// big endian unsigned on len bytes, FALSE when input is short
+STATIC int checkUint (CHECK_input *input, int len, uint64_t *value) {
+
+    if (input->end - input->cur < len) return FALSE;
+    for (*value = 0; len > 0; len--) *value = (*value << 8) | *input->cur++;
+    return TRUE;
+}
+
+STATIC json_object *checkText (CHECK_input *input, uint64_t len) {
+    json_object *textJ;
+
+    if ((uint64_t)(input->end - input->cur) < len) return NULL;
+    textJ = json_object_new_string_len ((const char*) input->cur, (int)len);
+    input->cur += len;
+    return textJ;
+}
+
+STATIC json_object *checkCbor (CHECK_input *input, int *failed);
+
+// items of an indefinite length container up to its break, FALSE when none is found
+STATIC int checkCborItems (CHECK_input *input, json_object *containerJ, int *failed) {
+    json_object *keyJ, *valueJ;
+
+    while (!*failed && input->cur < input->end && *input->cur != 0xff) {
+        if (json_object_get_type (containerJ) == json_type_array) {
+            json_object_array_add (containerJ, checkCbor (input, failed));
+            continue;
+        }
+        keyJ = checkCbor (input, failed);
+        valueJ = checkCbor (input, failed);
+        if (json_object_get_type (keyJ) != json_type_string) {
+            *failed = TRUE;
+            json_object_put (valueJ);
+        } else json_object_object_add (containerJ, json_object_get_string (keyJ), valueJ);
+        json_object_put (keyJ);
+    }
+    if (*failed || input->cur >= input->end) return FALSE;
+    input->cur++;  // skip break
+    return TRUE;
+}
+
+// CBOR subset written by jbuf: integers, text, indefinite containers, simple values, doubles
+STATIC json_object *checkCbor (CHECK_input *input, int *failed) {
+    union { double value; uint64_t bits; } number;
+    json_object *valueJ;
+    uint64_t arg;
+    int major, info;
+
+    if (*failed || input->cur >= input->end) goto OnErrorExit;
+    major = *input->cur >> 5;
+    info  = *input->cur++ & 0x1f;
+
+    if (major == 7) switch (info) {
+        case 20: return json_object_new_boolean (FALSE);
+        case 21: return json_object_new_boolean (TRUE);
+        case 22: return NULL;
+        case 27:
+            if (!checkUint (input, 8, &number.bits)) goto OnErrorExit;
+            return json_object_new_double (number.value);
+        default: goto OnErrorExit;
+    }
+
+    if (info == 31) {  // jbuf containers are always indefinite length
+        if (major == 4) valueJ = json_object_new_array ();
+        else if (major == 5) valueJ = json_object_new_object ();
+        else goto OnErrorExit;
+        if (!checkCborItems (input, valueJ, failed)) {
+            json_object_put (valueJ);
+            goto OnErrorExit;
+        }
+        return valueJ;
+    }
+
+    if (info < 24) arg = info;
+    else if (info > 27 || !checkUint (input, 1 << (info - 24), &arg)) goto OnErrorExit;
+
+    switch (major) {
+        case 0: return json_object_new_int64 ((int64_t) arg);
+        case 1: return json_object_new_int64 (-1 - (int64_t) arg);
+        case 3:
+            if ((valueJ = checkText (input, arg)) == NULL) goto OnErrorExit;
+            return valueJ;
+        default: goto OnErrorExit;
+    }
+
+OnErrorExit:
+    *failed = TRUE;
+    return NULL;
+}
+
+STATIC json_object *checkPack (CHECK_input *input, int *failed);
+
+// count items of a map or array [map counts its keys]
+STATIC json_object *checkPackItems (CHECK_input *input, json_object *containerJ, uint64_t count, int *failed) {
+    json_object *keyJ, *valueJ;
+
+    for (; count > 0 && !*failed; count--) {
+        if (json_object_get_type (containerJ) == json_type_array) {
+            json_object_array_add (containerJ, checkPack (input, failed));
+            continue;
+        }
+        keyJ = checkPack (input, failed);
+        valueJ = checkPack (input, failed);
+        if (json_object_get_type (keyJ) != json_type_string) {
+            *failed = TRUE;
+            json_object_put (valueJ);
+        } else json_object_object_add (containerJ, json_object_get_string (keyJ), valueJ);
+        json_object_put (keyJ);
+    }
+    return containerJ;
+}
+
+// MessagePack subset written by jbuf
+STATIC json_object *checkPack (CHECK_input *input, int *failed) {
+    union { double value; uint64_t bits; } number;
+    json_object *valueJ;
+    unsigned char type;
+    uint64_t arg;
+
+    if (*failed || input->cur >= input->end) goto OnErrorExit;
+    type = *input->cur++;
+
+    if (type < 0x80) return json_object_new_int64 (type);
+    if (type >= 0xe0) return json_object_new_int64 ((int8_t) type);
+    if ((type & 0xe0) == 0xa0) {
+        if ((valueJ = checkText (input, type & 0x1f)) == NULL) goto OnErrorExit;
+        return valueJ;
+    }
+
+    switch (type) {
+        case 0xc0: return NULL;
+        case 0xc2: return json_object_new_boolean (FALSE);
+        case 0xc3: return json_object_new_boolean (TRUE);
+        case 0xcb:
+            if (!checkUint (input, 8, &number.bits)) goto OnErrorExit;
+            return json_object_new_double (number.value);
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            if (!checkUint (input, 1 << (type - 0xcc), &arg)) goto OnErrorExit;
+            return json_object_new_int64 ((int64_t) arg);
+        case 0xd0: if (!checkUint (input, 1, &arg)) goto OnErrorExit; return json_object_new_int64 ((int8_t) arg);
+        case 0xd1: if (!checkUint (input, 2, &arg)) goto OnErrorExit; return json_object_new_int64 ((int16_t) arg);
+        case 0xd2: if (!checkUint (input, 4, &arg)) goto OnErrorExit; return json_object_new_int64 ((int32_t) arg);
+        case 0xd3: if (!checkUint (input, 8, &arg)) goto OnErrorExit; return json_object_new_int64 ((int64_t) arg);
+        case 0xd9: case 0xda: case 0xdb:
+            if (!checkUint (input, 1 << (type - 0xd9), &arg)) goto OnErrorExit;
+            if ((valueJ = checkText (input, arg)) == NULL) goto OnErrorExit;
+            return valueJ;
+        case 0xdd:  // jbuf containers are always array32/map32
+            if (!checkUint (input, 4, &arg)) goto OnErrorExit;
+            return checkPackItems (input, json_object_new_array (), arg, failed);
+        case 0xdf:
+            if (!checkUint (input, 4, &arg)) goto OnErrorExit;
+            return checkPackItems (input, json_object_new_object (), arg, failed);
+        default: goto OnErrorExit;
+    }
+
+OnErrorExit:
+    *failed = TRUE;
+    return NULL;
+}
+
+// binary output has to decode to exactly one value equal to the source tree
+STATIC int checkDecode (AJG_jbuf *jbuf, json_object *sourceJ) {
+    CHECK_input input;
+    json_object *decodedJ;
+    int failed = FALSE, equal;
+
+    input.cur = (const unsigned char*) jbuf->data;
+    input.end = input.cur + jbuf->len;
+    if (jbuf->format == AJG_FORMAT_CBOR) decodedJ = checkCbor (&input, &failed);
+    else decodedJ = checkPack (&input, &failed);
+
+    // same serialization means same values, same types and same member order
+    equal = !failed && input.cur == input.end && !strcmp (json_object_to_json_string_ext (decodedJ, JSON_C_TO_STRING_PLAIN),
+        json_object_to_json_string_ext (sourceJ, JSON_C_TO_STRING_PLAIN));
+    if (decodedJ) json_object_put (decodedJ);
+    return equal;
+}
+
+// write one value in every format and check each output
+STATIC void checkRoundTrip (const char *name, json_object *sourceJ) {
+    AJG_jbuf jbuf;
+    int format, plain;
+
+    for (format=0; format < AJG_FORMATS; format++) {
+        for (plain=FALSE; plain <= (format == AJG_FORMAT_JSON); plain++) {
+            jbufInit (&jbuf, plain);
+            jbuf.format = format;
+            checkWrite (&jbuf, sourceJ);
+
+            if (jbuf.failed || jbuf.depth != 0) checkResult (name, jbufFormatName (format), FALSE);
+            else if (format == AJG_FORMAT_JSON) checkResult (name, plain ? "json plain" : "json", !strcmp (jbuf.data,
+                json_object_to_json_string_ext (sourceJ, plain ? JSON_C_TO_STRING_PLAIN : JSON_C_TO_STRING_SPACED)));
+            else checkResult (name, jbufFormatName (format), checkDecode (&jbuf, sourceJ));
+            jbufFree (&jbuf);
+        }
+    }
+}
+
+STATIC void checkSamples (void) {
+    const char *samples = getenv ("AJG_SAMPLES");
+    json_object *sampleJ;
+    char pattern [512];
+    glob_t found;
+    size_t idx;
+
+    snprintf (pattern, sizeof (pattern), "%s/%s", samples ? samples : "samples", CHECK_SAMPLES);
+    if (glob (pattern, 0, NULL, &found) != 0) {
+        checkResult (pattern, "samples", FALSE);
+        return;
+    }
+    if (found.gl_pathc < 3) checkResult (pattern, "samples", FALSE);
+
+    for (idx=0; idx < found.gl_pathc; idx++) {
+        sampleJ = json_object_from_file (found.gl_pathv[idx]);
+        if (sampleJ == NULL) checkResult (found.gl_pathv[idx], "parse", FALSE);
+        else checkRoundTrip (found.gl_pathv[idx], sampleJ);
+        if (sampleJ) json_object_put (sampleJ);
+    }
+    globfree (&found);
+}
+
+// integers at each encoding boundary on both sides of zero
+STATIC void checkIntegers (void) {
+    static const long long values [] = {
+        0, 1, 23, 24, 127, 128, 255, 256, 65535, 65536, 4294967295LL, 4294967296LL, INT64_MAX,
+        -1, -24, -25, -32, -33, -128, -129, -256, -257, -32768, -32769, -65536, -65537,
+        (long long) INT32_MIN, (long long) INT32_MIN - 1, -4294967296LL, -4294967297LL, INT64_MIN
+    };
+    static const struct { int format; long long value; size_t len; const char *bytes; } encoded [] = {
+        {AJG_FORMAT_CBOR,    -1,     1, "\x20"},
+        {AJG_FORMAT_CBOR,    -25,    2, "\x38\x18"},
+        {AJG_FORMAT_CBOR,    -257,   3, "\x39\x01\x00"},
+        {AJG_FORMAT_MSGPACK, -1,     1, "\xff"},
+        {AJG_FORMAT_MSGPACK, -32,    1, "\xe0"},
+        {AJG_FORMAT_MSGPACK, -33,    2, "\xd0\xdf"},
+        {AJG_FORMAT_MSGPACK, -129,   3, "\xd1\xff\x7f"},
+        {AJG_FORMAT_MSGPACK, -32769, 5, "\xd2\xff\xff\x7f\xff"},
+    };
+    json_object *valuesJ = json_object_new_array ();
+    AJG_jbuf jbuf;
+    char name [32];
+    size_t idx;
+
+    for (idx=0; idx < sizeof (values) / sizeof (values[0]); idx++) json_object_array_add (valuesJ, json_object_new_int64 (values[idx]));
+    checkRoundTrip ("integers", valuesJ);
+    json_object_put (valuesJ);
+
+    // shortest form is expected, not only a decodable one
+    for (idx=0; idx < sizeof (encoded) / sizeof (encoded[0]); idx++) {
+        jbufInit (&jbuf, FALSE);
+        jbuf.format = encoded[idx].format;
+        jbufInt (&jbuf, encoded[idx].value);
+        snprintf (name, sizeof (name), "integer %lld", encoded[idx].value);
+        checkResult (name, jbufFormatName (encoded[idx].format), jbuf.len == encoded[idx].len && !memcmp (jbuf.data, encoded[idx].bytes, jbuf.len));
+        jbufFree (&jbuf);
+    }
+}
+
+// msgpack counts are only known when containers close, CBOR ones are never written
+STATIC void checkContainers (void) {
+    json_object *outerJ = json_object_new_object ();
+    json_object *innerJ = json_object_new_array ();
+    AJG_jbuf jbuf;
+    char key [16];
+    int idx;
+
+    for (idx=0; idx < 300; idx++) {  // larger than fixmap/map16 would take for a fixed header
+        snprintf (key, sizeof (key), "k%d", idx);
+        json_object_object_add (outerJ, key, json_object_new_int64 (-idx));
+    }
+    for (idx=0; idx < 17; idx++) json_object_array_add (innerJ, json_object_new_array ());
+    json_object_object_add (outerJ, "nested", innerJ);
+    json_object_object_add (outerJ, "empty", json_object_new_object ());
+    checkRoundTrip ("containers", outerJ);
+
+    jbufInit (&jbuf, FALSE);
+    jbuf.format = AJG_FORMAT_MSGPACK;
+    checkWrite (&jbuf, outerJ);
+    checkResult ("map32 count", "msgpack", jbuf.len > 5 && !memcmp (jbuf.data, "\xdf\x00\x00\x01\x2e", 5));
+    jbufFree (&jbuf);
+
+    jbufInit (&jbuf, FALSE);
+    jbuf.format = AJG_FORMAT_CBOR;
+    checkWrite (&jbuf, outerJ);
+    checkResult ("indefinite map", "cbor", jbuf.len > 2 && (unsigned char) jbuf.data[0] == 0xbf && (unsigned char) jbuf.data[jbuf.len-1] == 0xff);
+    jbufFree (&jbuf);
+
+    // break missing or count too large must not decode
+    jbufInit (&jbuf, FALSE);
+    jbuf.format = AJG_FORMAT_CBOR;
+    checkWrite (&jbuf, innerJ);
+    jbuf.len--;
+    checkResult ("missing break", "cbor", !checkDecode (&jbuf, innerJ));
+    jbufFree (&jbuf);
+
+    jbufInit (&jbuf, FALSE);
+    jbuf.format = AJG_FORMAT_MSGPACK;
+    checkWrite (&jbuf, innerJ);
+    jbuf.data[4]++;
+    checkResult ("wrong count", "msgpack", !checkDecode (&jbuf, innerJ));
+    jbufFree (&jbuf);
+
+    json_object_put (outerJ);
+}
+
+int main (void) {
+
+    checkSamples ();
+    checkIntegers ();
+    checkContainers ();
+
+    if (checkFailed) fprintf (stderr, "%d check(s) failed\n", checkFailed);
+    return checkFailed ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+#!/bin/sh
+
+# Object: make check end to end run of ajg-daemon on the ajg ctl plugin [no sound hardware]
+#   an asoundrc shows samples/CTRL_GET_ALL-hw:18i8.ajg as sndcard "ajgtest" through the plugin
+#   freshly built in .libs, then ajg-daemon real alsa code is checked over http:
+#     - ctrl-get-all returns every sample control [name, iface, ctrl, values, TLV]
+#     - ctrl-set-one&quiet=0 returns written values, ctrl-get-one reads them back
+#   Skipped [exit 77] when python3, the plugin or the daemon are not available.
+# Author: Fulup Ar Foll
+# Copyright: GPL v2, same as AlsaJsonGateway
+
+SAMPLES=${AJG_SAMPLES:-../samples}
+SAMPLE=${AJG_SAMPLE:-$SAMPLES/CTRL_GET_ALL-hw:18i8.ajg}
+DAEMON=${AJG_DAEMON:-./ajg-daemon}
+PLUGIN=${AJG_PLUGIN:-./.libs/libasound_module_ctl_ajg.so}
+PORT=${AJG_PORT:-21234}
+CARDID=ajgtest
+
+skip () {
+    echo "SKIP: $*"
+    exit 77
+}
+
+command -v python3 >/dev/null 2>&1 || skip "python3 not found"
+test -x "$DAEMON" || skip "$DAEMON not built"
+test -f "$PLUGIN" || skip "$PLUGIN not built"
+test -f "$SAMPLE" || { echo "FAIL: no sample $SAMPLE"; exit 1; }
+
+# asoundrc needs absolute paths
+PLUGIN=`cd \`dirname "$PLUGIN"\` && pwd`/`basename "$PLUGIN"`
+SAMPLE=`cd \`dirname "$SAMPLE"\` && pwd`/`basename "$SAMPLE"`
+
+WORKDIR=`mktemp -d ${TMPDIR:-/tmp}/ajg-check.XXXXXX` || exit 1
+DAEMONPID=
+cleanup () {
+    test -n "$DAEMONPID" && kill $DAEMONPID 2>/dev/null && wait $DAEMONPID 2>/dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT INT TERM
+
+# alsa.conf includes ~/.asoundrc, ctl_type tells where the uninstalled plugin is
+cat > "$WORKDIR/.asoundrc" <<EOF
+ctl_type.ajg {
+    lib "$PLUGIN"
+}
+ctl.$CARDID {
+    type ajg
+    sample "$SAMPLE"
+}
+EOF
+mkdir "$WORKDIR/sessions"
+
+HOME="$WORKDIR" XDG_CONFIG_HOME="$WORKDIR" "$DAEMON" --rootdir="$WORKDIR" --sessiondir="$WORKDIR/sessions" --port=$PORT >"$WORKDIR/daemon.log" 2>&1 &
+DAEMONPID=$!
+
+python3 - "$SAMPLE" "http://localhost:$PORT/jsonapi" "$CARDID" <<'EOF'
+import json, sys, time, urllib.request
+
+sample, url, cardid = sys.argv[1:4]
+failed = 0
+
+def request(**args):
+    query = "&".join("%s=%s" % (key, value) for key, value in args.items())
+    with urllib.request.urlopen("%s?%s" % (url, query), timeout=5) as response:
+        return json.loads(response.read().decode())
+
+def check(name, success, detail=""):
+    global failed
+    print("%s: %s" % ("PASS", name) if success else "FAIL: %s %s" % (name, detail))
+    if not success: failed += 1
+
+# daemon needs a moment to listen
+for retry in range(50):
+    try:
+        request(request="ping-get")
+        break
+    except Exception:
+        time.sleep(0.1)
+else:
+    print("FAIL: ajg-daemon does not answer")
+    sys.exit(1)
+
+with open(sample) as file:
+    controls = {ctrl["numid"]: ctrl for ctrl in json.load(file)["data"]}
+
+response = request(request="ctrl-get-all", cardid=cardid, quiet=0)
+if "data" not in response:
+    print("SKIP: card %s not opened [alsa-lib without ext plugin support?] %s" % (cardid, response))
+    sys.exit(77)
+shown = {ctrl.get("numid"): ctrl for ctrl in response["data"]}
+
+tlvs = 0
+for numid, expected in sorted(controls.items()):
+    ctrl = shown.get(numid)
+    if ctrl is None:
+        check("ctrl-get-all numid=%d" % numid, False, "missing")
+        continue
+    wrong = [key for key in ("name", "iface", "value", "ctrl", "tlv") if key in expected and ctrl.get(key) != expected[key]]
+    check("ctrl-get-all numid=%d %s" % (numid, expected.get("name")), not wrong, " ".join("%s=%s" % (key, json.dumps(ctrl.get(key))) for key in wrong))
+    if "tlv" in expected: tlvs += 1
+check("ctrl-get-all TLV compared", tlvs > 0)
+
+# first writable integer control [a fader with TLV when any], every value moves to another one within range
+target = None
+for numid, expected in sorted(controls.items(), key=lambda item: ("tlv" not in item[1], item[0])):
+    info = expected.get("ctrl", {})
+    if info.get("type") == "INTEGER" and expected.get("acl", {}).get("write") and info.get("max", 0) > info.get("min", 0):
+        target = numid
+        values = [info["min"] if value != info["min"] else info["max"] for value in expected["value"]]
+        break
+check("ctrl-set-one writable control found", target is not None)
+
+if target is not None:
+    written = ",".join(str(value) for value in values)
+    response = request(request="ctrl-set-one", cardid=cardid, numid=target, quiet=0, value=written)
+    check("ctrl-set-one numid=%d value=%s" % (target, written), (response.get("data") or [{}])[0].get("value") == values, json.dumps(response))
+    response = request(request="ctrl-get-one", cardid=cardid, numid=target, quiet=1)
+    check("ctrl-get-one numid=%d read back" % target, (response.get("data") or [{}])[0].get("value") == values, json.dumps(response))
+
+sys.exit(1 if failed else 0)
+EOF
+rc=$?
+test $rc -eq 1 && cat "$WORKDIR/daemon.log"
+exit $rc
@@ -0,0 +1,145 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    gzip/deflate encoding of json API responses. Client Accept-Encoding is
+    reduced to a mask of acceptable encodings, gzip is preferred when both
+    are. Small responses are sent as they are, compression would cost more
+    than it saves. Compressed responses are regular reference counted blocks,
+    cached responses keep them until their content changes.
+
+   References:
+   https://tools.ietf.org/html/rfc7231#section-5.3.4
+   https://www.zlib.net/manual.html
+*/
+
+#include "local-def-ajg.h"
+#include <zlib.h>
+
+#define AJG_COMPRESS_MIN 1024  // smaller responses are not worth compressing
+
+STATIC const char *compressNames [AJG_ENCODINGS] = {"identity", "gzip", "deflate", "br"};
+
+// match one Accept-Encoding token [len chars] with a known encoding
+STATIC int compressToken (const char *token, size_t len) {
+    int idx;
+
+    if (len == 1 && token[0] == '*') return AJG_ENCODINGS;
+    for (idx=0; idx < AJG_ENCODINGS; idx++) {
+        if (strlen (compressNames[idx]) == len && !strncasecmp (token, compressNames[idx], len)) return idx;
+    }
+    return -1;
+}
+
+// mask of encodings accepted by client, q=0 explicitly refuses an encoding
+PUBLIC int compressAccept (const char *header) {
+    int accept = 0, refuse = 0;
+    const char *token;
+
+    if (header == NULL) return 0;
+
+    for (token = header; *token; ) {
+        size_t len;
+        const char *params;
+        int encoding, zero = FALSE;
+
+        while (*token == ' ' || *token == '\t' || *token == ',') token++;
+        if (*token == '\0') break;
+
+        len = strcspn (token, " \t;,");
+        encoding = compressToken (token, len);
+
+        // only look for q=0 [q=0.0, q=0.000] within parameters
+        params = token + len;
+        while (*params && *params != ',') {
+            if ((params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+                float quality;
+                if (sscanf (&params[2], "%f", &quality) == 1 && quality <= 0) zero = TRUE;
+            }
+            params++;
+        }
+        token = params;
+
+        if (encoding < 0) continue;
+
+        // "*;q=0" only refuses encodings not listed, which are never used anyway
+        if (encoding == AJG_ENCODINGS) {
+            if (!zero) accept |= (1 << AJG_ENCODING_GZIP) | (1 << AJG_ENCODING_DEFLATE) | (1 << AJG_ENCODING_BR);
+        } else if (zero) {
+            refuse |= (1 << encoding);
+        } else {
+            accept |= (1 << encoding);
+        }
+    }
+    return (accept & ~refuse);
+}
+
+// encoding used for a response of len bytes, AJG_ENCODING_IDENTITY when left uncompressed
+PUBLIC int compressChoose (AJG_session *session, int accept, size_t len) {
+
+    if (session->config->compressLevel <= 0 || len < AJG_COMPRESS_MIN) return AJG_ENCODING_IDENTITY;
+    if (accept & (1 << AJG_ENCODING_GZIP))    return AJG_ENCODING_GZIP;
+    if (accept & (1 << AJG_ENCODING_DEFLATE)) return AJG_ENCODING_DEFLATE;
+    return AJG_ENCODING_IDENTITY;
+}
+
+PUBLIC const char *compressName (int encoding) {
+    if (encoding < 0 || encoding >= AJG_ENCODINGS) return NULL;
+    return compressNames[encoding];
+}
+
+// compress block into a new one [refcount=1], NULL on error or when it would not be smaller
+PUBLIC AJG_rbuf *compressBlock (AJG_session *session, AJG_rbuf *block, int encoding) {
+    AJG_rbuf *compressed;
+    z_stream zstream;
+    int bits;
+
+    // http deflate is zlib format [RFC1950], gzip adds its own header
+    switch (encoding) {
+        case AJG_ENCODING_GZIP:    bits = MAX_WBITS + 16; break;
+        case AJG_ENCODING_DEFLATE: bits = MAX_WBITS; break;
+        default: return NULL;
+    }
+
+    memset (&zstream, 0, sizeof (zstream));
+    if (deflateInit2 (&zstream, session->config->compressLevel, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+
+    // whole response is compressed in one call within a buffer large enough for worst case
+    compressed = malloc (sizeof (AJG_rbuf) + deflateBound (&zstream, block->len));
+    if (compressed == NULL) {
+        deflateEnd (&zstream);
+        return NULL;
+    }
+
+    zstream.next_in   = (Bytef*) block->data;
+    zstream.avail_in  = block->len;
+    zstream.next_out  = (Bytef*) compressed->data;
+    zstream.avail_out = deflateBound (&zstream, block->len);
+
+    if (deflate (&zstream, Z_FINISH) != Z_STREAM_END || zstream.total_out >= block->len) {
+        deflateEnd (&zstream);
+        free (compressed);
+        return NULL;
+    }
+
+    compressed->refcount = 1;
+    compressed->len = zstream.total_out;
+    deflateEnd (&zstream);
+    return compressed;
+}
@@ -31,35 +31,49 @@
 
 
 #define AJG_CONFIG_JTYPE "AJG_config"
+#define AJG_MESSAGE_JTYPE "AJG_message"
 
 PUBLIC  char *ERROR_LABEL[]=ERROR_LABEL_DEF;
 
 PUBLIC int verbose;
 STATIC AJG_ErrorT  AJG_Error [AJG_SUCCESS+1];
-STATIC json_object *ajgJsonType;
 
 /* ------------------------------------------------------------------------------
  * Get localtime and return in a string
  * ------------------------------------------------------------------------------ */
 
 PUBLIC char * configTime (void) {
-  static char reqTime [26];
+  static __thread char reqTime [26];  // one buffer per thread
   time_t tt;
-  struct tm *rt;
+  struct tm rt;
 
   /* Get actual Date and Time */
   time(&tt);
-  rt = localtime(&tt);
+  localtime_r(&tt, &rt);
 
-  strftime(reqTime, sizeof (reqTime), "(%d-%b %H:%M)",rt);
+  strftime(reqTime, sizeof (reqTime), "(%d-%b %H:%M)",&rt);
 
-  // return pointer on static data
+  // return pointer on thread static data
   return (reqTime);
 }
 
+// fakefaults config block as a --fake-faults spec
+STATIC char *configFaults (json_object *faultsJ) {
+   char spec [512] = "";
+   size_t len = 0;
+
+   if (!json_object_is_type (faultsJ, json_type_object)) return strdup (json_object_get_string (faultsJ));
+
+   json_object_object_foreach (faultsJ, key, value) {
+      len += snprintf (&spec[len], sizeof (spec) - len, "%s%s=%s", len ? "," : "", key, json_object_get_string (value));
+      if (len >= sizeof (spec)) return strdup ("");
+   }
+   return strdup (spec);
+}
+
 // loaf config from disk and merge with CLI option
 PUBLIC AJG_ERROR configLoadFile (AJG_session * session, AJG_config *cliconfig) {
-   static char cacheTimeout [10];
+   static char cacheTimeout [24];
    int fd;
    json_object * ajgConfig, *value;
 
@@ -71,6 +85,49 @@ PUBLIC AJG_ERROR configLoadFile (AJG_session * session, AJG_config *cliconfig) {
    if (cliconfig->cacheTimeout == 0) session->config->cacheTimeout=3600;
    else session->config->cacheTimeout=cliconfig->cacheTimeout;
 
+   // sndcard handles idle timeout default 5mn
+   if (cliconfig->poolIdle == 0) session->config->poolIdle=300;
+   else session->config->poolIdle=cliconfig->poolIdle;
+
+   // single httpd thread by default
+   if (cliconfig->workers == 0) session->config->workers=1;
+   else session->config->workers=cliconfig->workers;
+
+   // POST data are limited to 64KB by default
+   if (cliconfig->maxPost == 0) session->config->maxPost=MAX_POST_SIZE;
+   else session->config->maxPost=cliconfig->maxPost;
+
+   // volatile controls are read live by default
+   session->config->volatileRefresh=cliconfig->volatileRefresh;
+
+   // json responses are compressed at zlib level 6 by default, negative level turns compression off
+   if (cliconfig->compressLevel == 0) session->config->compressLevel=AJG_COMPRESS_LEVEL;
+   else if (cliconfig->compressLevel < 0) session->config->compressLevel=0;
+   else session->config->compressLevel=cliconfig->compressLevel;
+
+   // static files are kept in memory up to 4MB by default, negative size turns cache off
+   if (cliconfig->assetCache == 0) session->config->assetCache=AJG_ASSET_CACHE;
+   else if (cliconfig->assetCache < 0) session->config->assetCache=0;
+   else session->config->assetCache=cliconfig->assetCache;
+
+   // connections are limited by default, negative limit turns it off
+   if (cliconfig->maxClients == 0) session->config->maxClients=AJG_MAX_CLIENTS;
+   else if (cliconfig->maxClients < 0) session->config->maxClients=0;
+   else session->config->maxClients=cliconfig->maxClients;
+
+   if (cliconfig->maxPerIp == 0) session->config->maxPerIp=AJG_MAX_PER_IP;
+   else if (cliconfig->maxPerIp < 0) session->config->maxPerIp=0;
+   else session->config->maxPerIp=cliconfig->maxPerIp;
+
+   // libmicrohttpd default connection memory is 32KB
+   if (cliconfig->connMemory <= 0) session->config->connMemory=AJG_CONN_MEMORY;
+   else session->config->connMemory=cliconfig->connMemory;
+
+   session->config->localhostOnly=cliconfig->localhostOnly;
+
+   // fakemod simulated cards run without injected faults by default
+   session->config->fakeFaults=cliconfig->fakeFaults;
+
    if (cliconfig->rootdir == NULL) {
        session->config->rootdir = getenv("AJGDIR");
        if (session->config->rootdir == NULL) {
@@ -166,8 +223,54 @@ PUBLIC AJG_ERROR configLoadFile (AJG_session * session, AJG_config *cliconfig) {
    if (!cliconfig->cacheTimeout && json_object_object_get_ex (ajgConfig, "cachetimeout", &value)) {
       session->config->cacheTimeout = json_object_get_int (value);
    }
-   // cacheTimeout is an interger but HTTPd wants it as a string
-   snprintf (cacheTimeout, sizeof (cacheTimeout),"%d", session->config->cacheTimeout);
+
+   if (!cliconfig->poolIdle && json_object_object_get_ex (ajgConfig, "poolidle", &value)) {
+      session->config->poolIdle = json_object_get_int (value);
+   }
+
+   if (!cliconfig->workers && json_object_object_get_ex (ajgConfig, "workers", &value)) {
+      session->config->workers = json_object_get_int (value);
+   }
+
+   if (!cliconfig->volatileRefresh && json_object_object_get_ex (ajgConfig, "volatilerefresh", &value)) {
+      session->config->volatileRefresh = json_object_get_int (value);
+   }
+
+   if (!cliconfig->maxPost && json_object_object_get_ex (ajgConfig, "maxpost", &value)) {
+      session->config->maxPost = json_object_get_int (value);
+   }
+
+   if (!cliconfig->compressLevel && json_object_object_get_ex (ajgConfig, "compress", &value)) {
+      session->config->compressLevel = json_object_get_int (value);
+   }
+   if (session->config->compressLevel > 9) session->config->compressLevel = 9;
+   if (session->config->compressLevel < 0) session->config->compressLevel = 0;
+
+   if (!cliconfig->assetCache && json_object_object_get_ex (ajgConfig, "assetcache", &value)) {
+      session->config->assetCache = json_object_get_int (value);
+   }
+
+   if (!cliconfig->maxClients && json_object_object_get_ex (ajgConfig, "maxclients", &value)) {
+      session->config->maxClients = json_object_get_int (value);
+   }
+
+   if (!cliconfig->maxPerIp && json_object_object_get_ex (ajgConfig, "maxperip", &value)) {
+      session->config->maxPerIp = json_object_get_int (value);
+   }
+
+   if (!cliconfig->connMemory && json_object_object_get_ex (ajgConfig, "connmemory", &value)) {
+      session->config->connMemory = json_object_get_int (value);
+   }
+   // fakefaults is a --fake-faults spec or an object with the same keys {"read":"2-20","write-errors":1}
+   if (!cliconfig->fakeFaults && json_object_object_get_ex (ajgConfig, "fakefaults", &value)) {
+      session->config->fakeFaults = configFaults (value);
+   }
+
+   if (session->config->maxClients < 0) session->config->maxClients = 0;
+   if (session->config->maxPerIp < 0) session->config->maxPerIp = 0;
+   if (session->config->connMemory < 4) session->config->connMemory = 4;
+   // cacheTimeout is an interger but HTTPd wants it as a Cache-Control value
+   snprintf (cacheTimeout, sizeof (cacheTimeout),"max-age=%d", session->config->cacheTimeout);
    session->cacheTimeout = cacheTimeout; // httpd uses cacheTimeout string version
    json_object_put   (ajgConfig);    // decrease reference count to free the json object
 
@@ -195,6 +298,16 @@ PUBLIC void configStoreFile (AJG_session * session) {
    json_object_object_add (ajgConfig, "setuid"       , json_object_new_int (session->config->setuid));
    json_object_object_add (ajgConfig, "localhostonly", json_object_new_int (session->config->localhostOnly));
    json_object_object_add (ajgConfig, "cachetimeout" , json_object_new_int (session->config->cacheTimeout));
+   json_object_object_add (ajgConfig, "poolidle"     , json_object_new_int (session->config->poolIdle));
+   json_object_object_add (ajgConfig, "volatilerefresh", json_object_new_int (session->config->volatileRefresh));
+   json_object_object_add (ajgConfig, "workers"      , json_object_new_int (session->config->workers));
+   json_object_object_add (ajgConfig, "maxpost"      , json_object_new_int (session->config->maxPost));
+   json_object_object_add (ajgConfig, "compress"     , json_object_new_int (session->config->compressLevel));
+   json_object_object_add (ajgConfig, "assetcache"   , json_object_new_int (session->config->assetCache));
+   json_object_object_add (ajgConfig, "maxclients"   , json_object_new_int (session->config->maxClients));
+   json_object_object_add (ajgConfig, "maxperip"     , json_object_new_int (session->config->maxPerIp));
+   json_object_object_add (ajgConfig, "connmemory"   , json_object_new_int (session->config->connMemory));
+   if (session->config->fakeFaults) json_object_object_add (ajgConfig, "fakefaults", json_object_new_string (session->config->fakeFaults));
 
    err = json_object_to_file (session->config->configfile, ajgConfig);
    json_object_put   (ajgConfig);    // decrease reference count to free the json object
@@ -220,8 +333,16 @@ PUBLIC AJG_session *configInit () {
 
   // stack config handle into session
   session->config = config;
+  session->epollfd = -1;  // main loop not started yet
 
-  ajgJsonType = json_object_new_string ("AJG_message");
+  // sndcard handles are kept open across requests
+  poolInit (session);
+  wsockInit (session);
+  deltaInit (session);
+  assetInit (session);
+  admitInit (session);
+  fakeInit (session);
+  simulInit (session);
 
   // initialize JSON constant messages and increase reference count to make them permanent
   verbosesav = verbose;
@@ -232,50 +353,44 @@ PUBLIC AJG_session *configInit () {
   for (idx = 0; idx <= AJG_SUCCESS; idx++) {
      AJG_Error[idx].level = idx;
      AJG_Error[idx].label = ERROR_LABEL [idx];
-     AJG_Error[idx].json  = jsonNewMessage (idx, NULL);
+     AJG_Error[idx].json  = NULL; // built on request see jsonNewStatus
   }
   verbose = verbosesav;
   return (session);
 }
 
 
-// get JSON object from error level and increase its reference count
+// get JSON object from error level. Json-c reference count is not thread safe, with
+// parallel workers prebuilt objects cannot be shared between responses, we build a new one.
 PUBLIC json_object *jsonNewStatus (AJG_ERROR level) {
+  json_object *target = json_object_new_object();
 
-  json_object *target =  AJG_Error[level].json;
-  json_object_get (target);
-
+  json_object_object_add (target, "ajgtype", jsonNewAjgType ());
+  json_object_object_add (target, "status" , json_object_new_string (ERROR_LABEL[level]));
   return (target);
 }
 
-// get AJG object type with adequate usage count
+// get AJG object type [fresh object see jsonNewStatus]
 PUBLIC json_object *jsonNewAjgType (void) {
-  json_object_get (ajgJsonType); // increase reference count
-  return (ajgJsonType);
+  return (json_object_new_string (AJG_MESSAGE_JTYPE));
 }
 
-// build an ERROR message and return it as a valid json object
-PUBLIC  json_object *jsonNewMessage (AJG_ERROR level, char* format, ...) {
+// streamed version of jsonNewStatus
+PUBLIC void jsonWriteStatus (AJG_jbuf *jbuf, AJG_ERROR level) {
+  jbufObjectStart (jbuf);
+  jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_MESSAGE_JTYPE);
+  jbufKey (jbuf, "status");  jbufString (jbuf, ERROR_LABEL[level]);
+  jbufObjectEnd (jbuf);
+}
+
+// format message and trace it in verbose mode, returns NULL without format
+STATIC const char *jsonFormatMessage (AJG_ERROR level, char *message, size_t size, char* format, va_list args) {
    static int count = 0;
-   json_object * ajgResponse;
-   va_list args;
-   char message [512];
 
-   // format message
-   if (format != NULL) {
-       va_start(args, format);
-       vsnprintf (message, sizeof (message), format, args);
-       va_end(args);
-   }
+   if (format != NULL) vsnprintf (message, size, format, args);
 
-   ajgResponse = json_object_new_object();
-   json_object_object_add (ajgResponse, "ajgtype", jsonNewAjgType ());
-   json_object_object_add (ajgResponse, "status" , json_object_new_string (ERROR_LABEL[level]));
-   if (format != NULL) {
-        json_object_object_add (ajgResponse, "info"   , json_object_new_string (message));
-   }
    if (verbose) {
-        fprintf (stderr, "AJG:%-6s [%3d]: ", AJG_Error [level].label, count++);
+        fprintf (stderr, "AJG:%-6s [%3d]: ", AJG_Error [level].label, __sync_fetch_and_add (&count, 1));
         if (format != NULL) {
             fprintf (stderr, "%s", message);
         } else {
@@ -283,10 +398,48 @@ PUBLIC  json_object *jsonNewMessage (AJG_ERROR level, char* format, ...) {
         }
         fprintf (stderr, "\n");
    }
+   return (format ? message : NULL);
+}
+
+// build an ERROR message and return it as a valid json object
+PUBLIC  json_object *jsonNewMessage (AJG_ERROR level, char* format, ...) {
+   json_object * ajgResponse;
+   const char *info;
+   va_list args;
+   char message [512];
 
+   va_start(args, format);
+   info = jsonFormatMessage (level, message, sizeof (message), format, args);
+   va_end(args);
+
+   ajgResponse = json_object_new_object();
+   json_object_object_add (ajgResponse, "ajgtype", jsonNewAjgType ());
+   json_object_object_add (ajgResponse, "status" , json_object_new_string (ERROR_LABEL[level]));
+   if (info != NULL) {
+        json_object_object_add (ajgResponse, "info"   , json_object_new_string (info));
+   }
    return (ajgResponse);
 }
 
+// streamed version of jsonNewMessage [same layout]
+PUBLIC void jsonWriteMessage (AJG_jbuf *jbuf, AJG_ERROR level, char* format, ...) {
+   const char *info;
+   va_list args;
+   char message [512];
+
+   va_start(args, format);
+   info = jsonFormatMessage (level, message, sizeof (message), format, args);
+   va_end(args);
+
+   jbufObjectStart (jbuf);
+   jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_MESSAGE_JTYPE);
+   jbufKey (jbuf, "status");  jbufString (jbuf, ERROR_LABEL[level]);
+   if (info != NULL) {
+        jbufKey (jbuf, "info"); jbufString (jbuf, info);
+   }
+   jbufObjectEnd (jbuf);
+}
+
 // Dump a message on stderr
 PUBLIC void jsonDumpObject (json_object * jObject) {
 
@@ -0,0 +1,160 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Long-poll for ctrl-get-changed. When no control changed since requested
+    generation, connection is suspended [MHD suspend/resume] and parked here
+    until alsa reports a change on its card or timeout expires. A parked
+    request only costs an AJG_delta and its cardid, no thread and no buffer.
+
+    Requests are parked while their card is still locked, a change processed
+    after the check will always find them. Expiration timer is only armed
+    while at least one request is parked.
+
+   References:
+   https://www.gnu.org/software/libmicrohttpd/manual/html_node/microhttpd_002dflow.html
+*/
+
+#include <microhttpd.h>
+#include "local-def-ajg.h"
+
+#define AJG_DELTA_TICK 1000  // ms between expiration checks
+
+STATIC long long deltaNow (void) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// remove from parked list and let MHD call request handler again [delta lock held]
+STATIC void deltaResume (AJG_deltapoll *deltapoll, AJG_delta **prev, int state) {
+    AJG_delta *delta = *prev;
+
+    *prev = delta->next;
+    delta->next  = NULL;
+    delta->state = state;
+    deltapoll->waiting--;
+    MHD_resume_connection (delta->connection);
+}
+
+// resume expired requests, stop timer when nobody waits any more
+STATIC void deltaTimerCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_deltapoll *deltapoll = session->deltapoll;
+    long long now = deltaNow ();
+    AJG_delta **prev;
+
+    pthread_mutex_lock (&deltapoll->lock);
+    prev = &deltapoll->parked;
+    while (*prev != NULL) {
+        if ((*prev)->deadline <= now) {
+            deltapoll->expired++;
+            deltaResume (deltapoll, prev, AJG_DELTA_EXPIRED);
+        } else prev = &(*prev)->next;
+    }
+
+    if (deltapoll->parked == NULL && deltapoll->timer) {
+        eventDel (session, deltapoll->timer);
+        deltapoll->timer = NULL;
+    }
+    pthread_mutex_unlock (&deltapoll->lock);
+}
+
+PUBLIC void deltaInit (AJG_session *session) {
+    session->deltapoll = malloc (sizeof (AJG_deltapoll));
+    memset (session->deltapoll, 0, sizeof (AJG_deltapoll));
+    pthread_mutex_init (&session->deltapoll->lock, NULL);
+}
+
+// suspend connection until a change on cardid or timeout ms [card lock held]
+PUBLIC void deltaPark (AJG_session *session, void *connection, void **con_cls, const char *cardid, int timeout) {
+    AJG_deltapoll *deltapoll = session->deltapoll;
+    AJG_delta *delta = *con_cls;
+
+    // first wait for this request, deadline is kept when parked again after a spurious wakeup
+    if (delta == NULL) {
+        delta = malloc (sizeof (AJG_delta));
+        memset (delta, 0, sizeof (AJG_delta));
+        delta->type       = AJG_CONCLS_DELTA;
+        delta->connection = connection;
+        delta->cardid     = strdup (cardid);
+        delta->deadline   = deltaNow () + timeout;
+        *con_cls = delta;
+    }
+
+    pthread_mutex_lock (&deltapoll->lock);
+    delta->state = AJG_DELTA_PARKED;
+    delta->next  = deltapoll->parked;
+    deltapoll->parked = delta;
+    deltapoll->waiting++;
+    MHD_suspend_connection (connection);
+
+    if (deltapoll->timer == NULL) deltapoll->timer = eventTimer (session, AJG_DELTA_TICK, deltaTimerCB, NULL);
+    pthread_mutex_unlock (&deltapoll->lock);
+}
+
+// card got new changes, resume every request waiting on it [card lock held]
+PUBLIC void deltaWake (AJG_session *session, AJG_cardslot *slot) {
+    AJG_deltapoll *deltapoll = session->deltapoll;
+    AJG_delta **prev;
+
+    if (deltapoll->waiting == 0) return;
+
+    pthread_mutex_lock (&deltapoll->lock);
+    prev = &deltapoll->parked;
+    while (*prev != NULL) {
+        if (!strcmp ((*prev)->cardid, slot->cardid)) {
+            deltapoll->woken++;
+            deltaResume (deltapoll, prev, AJG_DELTA_WOKEN);
+        } else prev = &(*prev)->next;
+    }
+    pthread_mutex_unlock (&deltapoll->lock);
+}
+
+// connection is gone, called from endRequest
+PUBLIC void deltaRelease (AJG_session *session, AJG_delta *delta) {
+    AJG_deltapoll *deltapoll = session->deltapoll;
+    AJG_delta **prev;
+
+    pthread_mutex_lock (&deltapoll->lock);
+    for (prev = &deltapoll->parked; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == delta) {
+            *prev = delta->next;
+            deltapoll->waiting--;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&deltapoll->lock);
+
+    free (delta->cardid);
+    free (delta);
+}
+
+PUBLIC json_object *deltaStats (AJG_session *session) {
+    AJG_deltapoll *deltapoll = session->deltapoll;
+    json_object *statsJ = json_object_new_object();
+
+    pthread_mutex_lock (&deltapoll->lock);
+    json_object_object_add (statsJ, "waiting", json_object_new_int64 (deltapoll->waiting));
+    json_object_object_add (statsJ, "woken"  , json_object_new_int64 (deltapoll->woken));
+    json_object_object_add (statsJ, "expired", json_object_new_int64 (deltapoll->expired));
+    pthread_mutex_unlock (&deltapoll->lock);
+
+    return statsJ;
+}
@@ -0,0 +1,163 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Single epoll main loop. Httpd sockets, alsa control poll descriptors and
+    housekeeping timers are all registered here, main thread only wakes up
+    when one of them has something to say.
+
+    Sources may be removed from any thread [worker dropping a sndcard] they are
+    only freed by main loop once the current batch of events is processed.
+
+   References:
+   http://man7.org/linux/man-pages/man7/epoll.7.html
+   http://man7.org/linux/man-pages/man2/timerfd_create.2.html
+*/
+
+#include "local-def-ajg.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define AJG_EVENT_BATCH 32
+
+STATIC pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+STATIC AJG_evsource *eventGarbage = NULL;  // removed sources waiting for end of batch
+
+PUBLIC AJG_ERROR eventInit (AJG_session *session) {
+
+    session->epollfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (session->epollfd < 0) {
+        fprintf (stderr, "AJG: Fail to create epoll error=%s\n", strerror(errno));
+        return AJG_FATAL;
+    }
+    return AJG_SUCCESS;
+}
+
+// watch fd for events, callback is called from main loop thread
+PUBLIC AJG_evsource *eventAdd (AJG_session *session, int fd, uint32_t events, AJG_eventCB callback, void *context) {
+    struct epoll_event epevent;
+    AJG_evsource *source;
+
+    source = malloc (sizeof (AJG_evsource));
+    memset (source, 0, sizeof (AJG_evsource));
+    source->fd       = fd;
+    source->callback = callback;
+    source->context  = context;
+
+    epevent.events   = events;
+    epevent.data.ptr = source;
+    if (epoll_ctl (session->epollfd, EPOLL_CTL_ADD, fd, &epevent) < 0) {
+        fprintf (stderr, "AJG: Fail to watch fd=%d error=%s\n", fd, strerror(errno));
+        free (source);
+        return NULL;
+    }
+    return source;
+}
+
+// change watched events [ex: wait for socket to be writable]
+PUBLIC int eventMod (AJG_session *session, AJG_evsource *source, uint32_t events) {
+    struct epoll_event epevent;
+
+    epevent.events   = events;
+    epevent.data.ptr = source;
+    return epoll_ctl (session->epollfd, EPOLL_CTL_MOD, source->fd, &epevent);
+}
+
+// stop watching source, memory is released by main loop after current batch
+PUBLIC void eventDel (AJG_session *session, AJG_evsource *source) {
+
+    if (source == NULL) return;
+
+    (void) epoll_ctl (session->epollfd, EPOLL_CTL_DEL, source->fd, NULL);
+    if (source->timer) close (source->fd);
+
+    pthread_mutex_lock (&eventLock);
+    source->deleted = TRUE;
+    source->next = eventGarbage;
+    eventGarbage = source;
+    pthread_mutex_unlock (&eventLock);
+}
+
+// timerfd callback, acknowledge expiration and call user callback
+STATIC void eventTimerCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    uint64_t expirations;
+
+    if (read (source->fd, &expirations, sizeof (expirations)) != sizeof (expirations)) return;
+    source->timercb (session, source, revents);
+}
+
+// periodic timer, first call happens after one period
+PUBLIC AJG_evsource *eventTimer (AJG_session *session, int period, AJG_eventCB callback, void *context) {
+    struct itimerspec timer;
+    AJG_evsource *source;
+    int fd;
+
+    fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    timer.it_interval.tv_sec  = period / 1000;
+    timer.it_interval.tv_nsec = (period % 1000) * 1000000;
+    timer.it_value = timer.it_interval;
+    timerfd_settime (fd, 0, &timer, NULL);
+
+    source = eventAdd (session, fd, EPOLLIN, eventTimerCB, context);
+    if (source == NULL) {
+        close (fd);
+        return NULL;
+    }
+    source->timer   = TRUE;
+    source->timercb = callback;
+    return source;
+}
+
+// wait for events [timeout in ms, -1 forever] and dispatch them
+PUBLIC int eventWait (AJG_session *session, int timeout) {
+    struct epoll_event epevents [AJG_EVENT_BATCH];
+    AJG_evsource *garbage;
+    int count, idx;
+
+    count = epoll_wait (session->epollfd, epevents, AJG_EVENT_BATCH, timeout);
+    if (count < 0) {
+        if (errno == EINTR) return 0;
+        fprintf (stderr, "AJG: epoll_wait error=%s\n", strerror(errno));
+        return -1;
+    }
+
+    for (idx=0; idx < count; idx++) {
+        AJG_evsource *source = epevents[idx].data.ptr;
+
+        // source may have been removed by a previous callback of this batch
+        if (source->deleted || source->callback == NULL) continue;
+        source->callback (session, source, epevents[idx].events);
+    }
+
+    // nobody may reference removed sources any more
+    pthread_mutex_lock (&eventLock);
+    garbage = eventGarbage;
+    eventGarbage = NULL;
+    pthread_mutex_unlock (&eventLock);
+
+    while (garbage) {
+        AJG_evsource *next = garbage->next;
+        free (garbage);
+        garbage = next;
+    }
+
+    return count;
+}
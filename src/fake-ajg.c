@@ -0,0 +1,202 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    fakemod responses [rootdir/fakemod/xxx.ajg] are parsed once and kept
+    serialized, hot requests send them as a shared block with their
+    compressed variants exactly like cached ctrl-get-all responses. Callers
+    expecting a json-c tree [batch, binary formats, card name] get a fresh
+    tree parsed from that block, json-c trees are never shared across threads.
+
+    fakemod directory is watched through inotify, a changed file is loaded
+    again on its next request. Without inotify files are read on every
+    request as they used to.
+
+   References:
+   http://man7.org/linux/man-pages/man7/inotify.7.html
+*/
+
+#include "local-def-ajg.h"
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#define AJG_FAKE_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+#define AJG_FAKE_SUFFIX ".ajg"
+
+// release serialized response and its compressed variants [fake lock held]
+STATIC void fakeDrop (AJG_fakefile *file) {
+    int idx;
+
+    for (idx=0; idx < AJG_ENCODINGS; idx++) {
+        jbufRelease (file->cache.variants[idx]);
+        file->cache.variants[idx] = NULL;
+    }
+}
+
+// parse file once and keep it serialized, FALSE when missing or invalid [fake lock held]
+STATIC int fakeLoad (AJG_session *session, AJG_fakefile *file) {
+    json_object *responseJ;
+    const char *serialized;
+    char filepath [512];
+    size_t len;
+
+    fakeDrop (file);
+    file->stale = FALSE;
+
+    snprintf (filepath, sizeof (filepath), "%s/fakemod/%s%s", session->config->rootdir, file->name, AJG_FAKE_SUFFIX);
+    if ((responseJ = json_object_from_file (filepath)) == NULL) return FALSE;
+
+    // same layout as a json-c tree sent by httpd
+    serialized = json_object_to_json_string (responseJ);
+    len = strlen (serialized);
+    file->cache.variants[AJG_ENCODING_IDENTITY] = malloc (sizeof (AJG_rbuf) + len + 1);
+    if (file->cache.variants[AJG_ENCODING_IDENTITY] != NULL) {
+        AJG_rbuf *block = file->cache.variants[AJG_ENCODING_IDENTITY];
+
+        block->refcount = 1;
+        block->len = len;
+        memcpy (block->data, serialized, len + 1);
+    }
+    json_object_put (responseJ);
+
+    file->loads++;
+    if (verbose) fprintf (stderr, "AJG: fakemod load %s%s [%lu bytes]\n", file->name, AJG_FAKE_SUFFIX, (unsigned long) len);
+    return (file->cache.variants[AJG_ENCODING_IDENTITY] != NULL);
+}
+
+// a file changed within fakemod directory, it is loaded again on next request
+STATIC void fakeNotifyCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_fake *fake = session->fake;
+    char events [4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read (fake->inotify, events, sizeof (events))) > 0) {
+        char *ptr;
+
+        pthread_mutex_lock (&fake->lock);
+        for (ptr = events; ptr < events + len; ptr += sizeof (struct inotify_event) + ((struct inotify_event*)ptr)->len) {
+            struct inotify_event *event = (struct inotify_event*)ptr;
+            AJG_fakefile *file;
+
+            for (file = fake->files; file != NULL; file = file->next) {
+                size_t namelen = strlen (file->name);
+
+                // lost events, every file is reloaded
+                if (!(event->mask & IN_Q_OVERFLOW) &&
+                    (event->len == 0 || strncmp (event->name, file->name, namelen) || strcmp (&event->name[namelen], AJG_FAKE_SUFFIX))) continue;
+                if (!file->stale) fake->reloads++;
+                file->stale = TRUE;
+            }
+        }
+        pthread_mutex_unlock (&fake->lock);
+    }
+}
+
+PUBLIC void fakeInit (AJG_session *session) {
+    session->fake = calloc (1, sizeof (AJG_fake));
+    pthread_mutex_init (&session->fake->lock, NULL);
+    session->fake->inotify = -1;
+}
+
+// watch fakemod directory from main loop, without inotify files are read on every request
+PUBLIC void fakeStart (AJG_session *session) {
+    AJG_fake *fake = session->fake;
+    char dirpath [512];
+
+    if (!session->fakemod) return;
+
+    snprintf (dirpath, sizeof (dirpath), "%s/fakemod", session->config->rootdir);
+    fake->inotify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fake->inotify < 0 || inotify_add_watch (fake->inotify, dirpath, AJG_FAKE_EVENTS) < 0
+        || eventAdd (session, fake->inotify, EPOLLIN, fakeNotifyCB, NULL) == NULL) {
+        fprintf (stderr, "AJG: fakemod responses read on every request, inotify %s error=%s\n", dirpath, strerror(errno));
+        if (fake->inotify >= 0) close (fake->inotify);
+        fake->inotify = -1;
+    }
+}
+
+// fake response of name [xxx for rootdir/fakemod/xxx.ajg]. Hot requests get it as request->block
+// and NULL is returned, otherwise a new tree [tree=TRUE forces it]. Error message when file is missing
+PUBLIC json_object *fakeResponse (AJG_session *session, AJG_request *request, const char *name, int tree) {
+    AJG_fake *fake = session->fake;
+    AJG_fakefile *file;
+    json_object *responseJ = NULL;
+
+    // name is partly built from client cardid, it never leaves fakemod directory
+    if (strchr (name, '/')) return jsonNewMessage (AJG_FAIL, "FakeModResponse file=%s invalid name", name);
+
+    pthread_mutex_lock (&fake->lock);
+    for (file = fake->files; file != NULL; file = file->next) {
+        if (!strcmp (file->name, name)) break;
+    }
+
+    if (file == NULL) {
+        file = calloc (1, sizeof (AJG_fakefile));
+        file->name = strdup (name);
+        file->cache.lock = &fake->lock;
+        if (!fakeLoad (session, file)) {
+            // missing files are not remembered, names come from clients
+            pthread_mutex_unlock (&fake->lock);
+            free (file->name);
+            free (file);
+            return jsonNewMessage (AJG_FAIL, "FakeModResponse file=%s%s not found or invalid", name, AJG_FAKE_SUFFIX);
+        }
+        file->next = fake->files;
+        fake->files = file;
+
+    } else if ((file->stale || fake->inotify < 0 || file->cache.variants[AJG_ENCODING_IDENTITY] == NULL) && !fakeLoad (session, file)) {
+        pthread_mutex_unlock (&fake->lock);
+        return jsonNewMessage (AJG_FAIL, "FakeModResponse file=%s%s not found or invalid", name, AJG_FAKE_SUFFIX);
+    }
+
+    file->hits++;
+    if (verbose) fprintf (stderr, "AJG: fakemod %s hits=%lu loads=%lu\n", file->name, file->hits, file->loads);
+
+    if (tree || request->jbuf == NULL || request->format != AJG_FORMAT_JSON) {
+        responseJ = json_tokener_parse (file->cache.variants[AJG_ENCODING_IDENTITY]->data);
+    } else {
+        request->block = file->cache.variants[AJG_ENCODING_IDENTITY];
+        request->respcache = &file->cache;
+        jbufHold (request->block);
+    }
+    pthread_mutex_unlock (&fake->lock);
+
+    return responseJ;
+}
+
+PUBLIC json_object *fakeStats (AJG_session *session) {
+    AJG_fake *fake = session->fake;
+    json_object *statsJ = json_object_new_object();
+    json_object *filesJ = json_object_new_object();
+    AJG_fakefile *file;
+
+    pthread_mutex_lock (&fake->lock);
+    for (file = fake->files; file != NULL; file = file->next) {
+        json_object *fileJ = json_object_new_object();
+
+        json_object_object_add (fileJ, "hits" , json_object_new_int64 (file->hits));
+        json_object_object_add (fileJ, "loads", json_object_new_int64 (file->loads));
+        json_object_object_add (filesJ, file->name, fileJ);
+    }
+    json_object_object_add (statsJ, "reloads", json_object_new_int64 (fake->reloads));
+    json_object_object_add (statsJ, "files"  , filesJ);
+    pthread_mutex_unlock (&fake->lock);
+
+    return statsJ;
+}
@@ -24,7 +24,13 @@
    Syntax:  ./daemon-ajg --verbose --httpdport=1234 --rootdir=$HOME/public
 
    Features/Restriction:
+    - single worker runs httpd from main epoll loop [no thread, no polling]
+    - /jsonapi/ws is upgraded to websocket for realtime control changes
+    - /api/v2/cards/... resource paths run the same commands as /jsonapi?request=
+    - json API responses CBOR or MessagePack encoded when Accept asks for it
+    - ctrl-get-changed long-poll suspends connection until a change or timeout
     - handle ETAG to limit upload to modified/new files [cache default 3600s]
+    - small static files served from memory with their .gz/.br siblings [asset cache]
     - handles redirect to index.htlm when path is a directory [code 301]
     - only support GET method
     - does not follow link.
@@ -38,6 +44,8 @@
 
 #include <microhttpd.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <limits.h>
 
 // proto missing from GCC
 char *strcasestr(const char *haystack, const char *needle);
@@ -47,7 +55,7 @@ char *strcasestr(const char *haystack, const char *needle);
 #define BANNER "<html><head><title>Alsa Json Gateway</title></head><body>Alsa Json Gateway</body></html>"
 
 #define JSON_CONTENT  "application/json"
-#define MAX_POST_SIZE  4096   // maximum size for POST data
+#define HTTPD_VARY_ENCODING "Accept, Accept-Encoding"
 
 
 static  json_object * Request2Commands = NULL;
@@ -62,9 +70,32 @@ static  json_object * Request2Commands = NULL;
 #define SESSION_LIST   8
 #define SESSION_STORE  9
 #define SESSION_LOAD   10
+#define GATEWAY_STATS  11
+#define CTRL_GET_CHANGED 12
+#define REQUEST_BATCH  13
+#define CTRL_GET_MANY  14
+#define CTRL_GET_SCHEMA 15
+#define CTRL_GET_VALUES 16
 
-static int rqtcount  = 0;  // dummy request rqtcount to make each message be different
-static int postcount = 0;
+#define AJG_BATCH_JTYPE "AJG_batch"
+
+#define DELTA_TIMEOUT     25000  // default ctrl-get-changed wait in ms
+#define DELTA_MAX_TIMEOUT 60000
+
+// REST parameter lookup [URL query or batch json object]
+typedef const char* (*AJG_getParam) (void *context, const char *key);
+
+STATIC json_object *requestBatch (AJG_session *session, AJG_request *request, int rqtid);
+
+static int rqtcount  = 0;  // dummy request rqtcount to make each message be different [atomic]
+static int postcount = 0;  // [atomic]
+
+static long long respcount = 0;  // responses sent from memory [atomic]
+static long long respcopied = 0; // bytes copied by MHD [atomic]
+static long long respshared = 0; // bytes handed to MHD without copy [atomic]
+static long long respcompressed = 0; // responses sent gzip/deflate encoded [atomic]
+static long long respsaved = 0;  // bytes saved by compression [atomic]
+static long long respnotmodified = 0; // 304 sent to clients holding current content [atomic]
 
 // use json lib hash table capabilities to handle command parsing
 STATIC void initService (AJG_session *session) {
@@ -81,48 +112,542 @@ STATIC void initService (AJG_session *session) {
     json_object_object_add(Request2Commands, "session-list" , json_object_new_int (SESSION_LIST));
     json_object_object_add(Request2Commands, "session-store", json_object_new_int (SESSION_STORE));
     json_object_object_add(Request2Commands, "session-load" , json_object_new_int (SESSION_LOAD));
+    json_object_object_add(Request2Commands, "gateway-stats", json_object_new_int (GATEWAY_STATS));
+    json_object_object_add(Request2Commands, "ctrl-get-changed", json_object_new_int (CTRL_GET_CHANGED));
+    json_object_object_add(Request2Commands, "batch"        , json_object_new_int (REQUEST_BATCH));
+    json_object_object_add(Request2Commands, "ctrl-get-many", json_object_new_int (CTRL_GET_MANY));
+    json_object_object_add(Request2Commands, "ctrl-get-schema", json_object_new_int (CTRL_GET_SCHEMA));
+    json_object_object_add(Request2Commands, "ctrl-get-values", json_object_new_int (CTRL_GET_VALUES));
+
+    // v2 resource paths are matched from a table compiled once
+    routeInit ();
 }
 
-STATIC  json_object *gatewayPing (void) {
-    json_object * pingJson = jsonNewMessage (AJG_SUCCESS,"%d", rqtcount);
+STATIC  json_object *gatewayPing (int rqtid) {
+    json_object * pingJson = jsonNewMessage (AJG_SUCCESS,"%d", rqtid);
     return (pingJson);
 }
 
 
 // Because of POST call multiple time requestApi we need to free POST handle here
 static void endRequest (void *cls, struct MHD_Connection *connection, void **con_cls, enum MHD_RequestTerminationCode toe) {
+  AJG_session *session = cls;
   AJG_HttpPost *posthandle = *con_cls;
 
+  if (toe == MHD_REQUEST_TERMINATED_TIMEOUT_REACHED) admitTimeout (session);
+  if (posthandle == NULL) return;
+
+  // long-poll request [ctrl-get-changed]
+  if (posthandle->type == AJG_CONCLS_DELTA) {
+     deltaRelease (session, *con_cls);
+     return;
+  }
+
   // if post handle was used let's free everything
-  if (posthandle) {
-     if (verbose) fprintf (stderr, "End Post Request UID=%d\n", posthandle->uid);
-     free (posthandle->data);
-     free (posthandle);
+  if (verbose) fprintf (stderr, "End Post Request UID=%d\n", posthandle->uid);
+  free (posthandle->data);
+  free (posthandle);
+}
+
+
+// REST parameters from URL query
+STATIC const char *httpParam (void *context, const char *key) {
+  return MHD_lookup_connection_value (context, MHD_GET_ARGUMENT_KIND, key);
+}
+
+// run one REST command, parameters come from URL query or from a batch json object.
+// Returns response or NULL with *errMessage set when request itself is invalid.
+STATIC json_object *requestCommand (AJG_session *session, AJG_request *request, int cmd, const char *query
+                                   , AJG_getParam getParam, void *context, int rqtid, json_object **errMessage);
+
+// quiet level is the only query argument shared by every command
+STATIC int requestQuiet (AJG_request *request, const char *query, AJG_getParam getParam, void *context, json_object **errMessage) {
+  const char *param = getParam (context, "quiet");
+
+  if (param && ! sscanf (param, "%d", &request->quiet)) {
+    *errMessage = jsonNewMessage (AJG_FATAL, "Query=%s Quiet not integer &quiet=%s&", query, param);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// boolean query argument [1, true, yes]
+STATIC int requestFlag (const char *param) {
+  if (param == NULL) return FALSE;
+  return (!strcmp (param, "1") || !strcasecmp (param, "true") || !strcasecmp (param, "yes"));
+}
+
+STATIC json_object *requestDispatch (AJG_session *session, AJG_request *request, const char *query
+                                    , AJG_getParam getParam, void *context, int rqtid, json_object **errMessage) {
+  const char  *param;
+  json_object *cmd = NULL;
+
+  *errMessage = NULL;
+
+  // extract command value from json object and process it
+  (void) json_object_object_get_ex (Request2Commands, query, &cmd);
+
+  request->cardid = NULL; // no default card
+  request->cardid = getParam (context, "cardid");
+
+  if (!requestQuiet (request, query, getParam, context, errMessage)) return NULL;
+
+  request->numid = -1;  // no default
+  param = getParam (context, "numid");
+  if (param && ! sscanf (param, "%d", &request->numid)) {
+    *errMessage = jsonNewMessage (AJG_FATAL, "Query=%s NumID not integer &numid=%s&", query, param);
+    return NULL;
+  }
+
+  return requestCommand (session, request, json_object_get_int(cmd), query, getParam, context, rqtid, errMessage);
+}
+
+// v2 path parameters are already parsed, other arguments still come from URL query
+STATIC json_object *requestRoute (AJG_session *session, AJG_request *request, AJG_route *route
+                                 , struct MHD_Connection *connection, int rqtid, json_object **errMessage) {
+  *errMessage = NULL;
+
+  request->cardid = route->cardid[0] ? route->cardid : NULL;
+  request->numid  = route->numid;
+  if (route->session[0]) request->args = route->session;
+
+  if (!requestQuiet (request, route->name, httpParam, connection, errMessage)) return NULL;
+  return requestCommand (session, request, route->cmd, route->name, httpParam, connection, rqtid, errMessage);
+}
+
+// run one command once its card, numid and quiet level are known
+STATIC json_object *requestCommand (AJG_session *session, AJG_request *request, int cmd, const char *query
+                                   , AJG_getParam getParam, void *context, int rqtid, json_object **errMessage) {
+  const char  *param;
+  json_object *jsonResponse = NULL;
+
+  request->dict = FALSE;
+  request->force = FALSE;
+  switch (cmd) {
+
+
+  	case GATEWAY_PING: // http://localhost:1234/jsonapi?request=ping-get [&sndcard=0]
+  	    if (verbose) fprintf (stderr, "%d: alsajson GATEWAY_PING\n", rqtid);
+
+        if (request->cardid == NULL)  jsonResponse = gatewayPing (rqtid);
+        else jsonResponse = alsaProbeCard (session, request);
+  	    break;
+
+  	case CARD_GET_ALL: // http://localhost:1234/jsonapi?request=card-get-all
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CARD_GET_ALL\n", rqtid);
+  	    jsonResponse = alsaFindCard (session, request); // sndcard = -1
+  	    break;
+
+  	case CARD_GET_ONE: // http://localhost:1234/jsonapi?request=card-get-one&sndcard=0
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CARD_GET_ONE cardid=%s\n", rqtid, request->cardid );
+   	    if (request->cardid == NULL) {
+            *errMessage = jsonNewMessage (AJG_FAIL, "CARD_GET_ONE Query=%s Missing &SndCard=xxxx&\n", query);
+   	        return NULL;
+   	    }
+  	    jsonResponse = alsaFindCard (session, request);
+  	    break;
+
+  	case CTRL_GET_ALL: // http://localhost:1234/jsonapi?request=ctrl-get-all&sndcard=0
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_ALL\n", rqtid);
+  	    request->numid = -1; // force list-all
+  	    request->dict  = requestFlag (getParam (context, "dict"));
+  	    jsonResponse = alsaGetControl (session, request);  // numid == -1
+  	    break;
+
+  	case CTRL_GET_ONE: // http://localhost:1234/jsonapi?request=ctrl-get-one&cardid=hw:0&numid=5&quiet=0
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_ONE cardid=%s numid=%d\n", rqtid, request->cardid ,request->numid);
+        jsonResponse = alsaGetControl (session, request);
+ 	    break;
+
+  	case CTRL_GET_MANY: // http://localhost:1234/jsonapi?request=ctrl-get-many&cardid=hw:0&numids=[5,6,12]&quiet=1
+ 	    // if data where not found in POST try to get them from GET [do not forget URL size constrains]
+        if (request->data == NULL) request->data = getParam (context, "numids");
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_MANY cardid=%s numids=%s\n", rqtid, request->cardid ,request->data);
+        jsonResponse = alsaGetManyCtrl (session, request);
+ 	    break;
+
+  	case CTRL_GET_SCHEMA: // http://localhost:1234/jsonapi?request=ctrl-get-schema&cardid=hw:0
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_SCHEMA cardid=%s\n", rqtid, request->cardid);
+  	    request->dict = requestFlag (getParam (context, "dict"));
+  	    jsonResponse = alsaGetSchema (session, request);
+  	    break;
+
+  	case CTRL_GET_VALUES: // http://localhost:1234/jsonapi?request=ctrl-get-values&cardid=hw:0
+  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_VALUES cardid=%s\n", rqtid, request->cardid);
+  	    jsonResponse = alsaGetValues (session, request);
+  	    break;
+
+  	case CTRL_SET_ONE: {// http://localhost:1234/jsonapi?request=ctrl-set-one&cardid=hw:0&quiet=1&numid=128&value=10,5
+  	    if (verbose)  fprintf (stderr, "%d: alsajson processing CTRL_SET_ONE cardid=%s numid=%d args=%s\n", rqtid, request->cardid ,request->numid, request->args);
+        request->args   = getParam (context, "value");
+        jsonResponse = alsaSetOneCtrl (session, request);
+ 	    break;
+ 	    }
+
+  	case CTRL_SET_MANY: {// http://localhost:1234/jsonapi?request=ctrl-set-one&cardid=hw:0&quiet=1&numids=10,12,13&args=10
+ 	    // if data where not found in POST try to get them from GET [do not forget URL size constrains]
+        if (request->data == NULL) request->data = getParam (context, "numids");
+        request->args   = getParam (context, "value");
+
+  	    if (verbose)  fprintf (stderr, "%d: alsajson processing CTRL_SET_MANY cardid=%s numids=%s value=%s\n", rqtid, request->cardid ,request->data, request->args);
+
+        jsonResponse = alsaSetManyCtrl (session, request);
+ 	    break;
+ 	    }
+
+    case SESSION_LIST:  {// http://localhost:1234/jsonapi?request=session-list&sndcard=0
+       jsonResponse = alsaListSession (session, request); // list session for requested sndcard
+       break;
+    }
+
+  	case SESSION_LOAD: { // http://localhost:1234/jsonapi?request=session-load&cardid=hw:0&args=sessionname
+
+       if (request->args == NULL) request->args = getParam (context, "session");
+       request->force = requestFlag (getParam (context, "force"));
+       if (verbose)  fprintf (stderr, "%d: alsajson SESSION_LOAD cardid=%s session=%s\n", rqtid, request->cardid, request->args);
+
+       jsonResponse = alsaLoadSession (session, request);  // push session to alsa board
+
+       break;
+   	}
+
+  	case SESSION_STORE: {// http://localhost:1234/jsonapi?request=session-store&cardid=hw:0&session=sessionname
+
+       if (request->args == NULL) request->args = getParam (context, "session");
+
+  	   // if data where not found in POST try to get them from GET [do not forget URL size constrains]
+   	   if (request->data == NULL) request->data = getParam (context, "info");
+
+       if (verbose)  fprintf (stderr, "%d: alsajson SESSION_STORE cardid=%s session=%s\n", rqtid, request->cardid, request->args );
+       jsonResponse = alsaStoreSession (session, request);  // push session to alsa board
+       break;
+   	}
+
+    case CTRL_GET_CHANGED: { // http://localhost:1234/jsonapi?request=ctrl-get-changed&cardid=hw:0&since=1234&timeout=25000
+       param = getParam (context, "since");
+       if (param && ! sscanf (param, "%lu", &request->since)) {
+           *errMessage = jsonNewMessage (AJG_FATAL, "Query=%s Since not integer &since=%s&", query, param);
+           return NULL;
+       }
+       request->timeout = DELTA_TIMEOUT;
+       param = getParam (context, "timeout");
+       if (param && ! sscanf (param, "%d", &request->timeout)) {
+           *errMessage = jsonNewMessage (AJG_FATAL, "Query=%s Timeout not integer &timeout=%s&", query, param);
+           return NULL;
+       }
+       if (request->timeout > DELTA_MAX_TIMEOUT) request->timeout = DELTA_MAX_TIMEOUT;
+       if (request->cardid == NULL) {
+           *errMessage = jsonNewMessage (AJG_FAIL, "CTRL_GET_CHANGED Query=%s Missing &cardid=xxxx&\n", query);
+           return NULL;
+       }
+       if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_CHANGED cardid=%s since=%lu\n", rqtid, request->cardid, request->since);
+
+       // caller decides to wait when nothing changed
+       jsonResponse = alsaGetChanged (session, request);
+       break;
+    }
+
+    case REQUEST_BATCH: // POST http://localhost:1234/jsonapi?request=batch data=[{"request":"ctrl-set-one","cardid":"hw:0","numid":5,"value":"10,5"},...]
+       if (verbose)  fprintf (stderr, "%d: alsajson REQUEST_BATCH\n", rqtid);
+       jsonResponse = requestBatch (session, request, rqtid);
+       break;
+
+    case GATEWAY_STATS: // http://localhost:1234/jsonapi?request=gateway-stats
+       if (verbose)  fprintf (stderr, "%d: alsajson GATEWAY_STATS\n", rqtid);
+       jsonResponse = poolStats (session);
+       break;
+
+  	default:
+       *errMessage = jsonNewMessage (AJG_FAIL, "%d:unknown Request=%s Cardid=%s NumId=%d\n", rqtid, query, request->cardid ,request->numid);
+  	   return NULL;
+   }
+
+   return jsonResponse;
+}
+
+// batch commands parameters are members of a json object
+STATIC const char *batchParam (void *context, const char *key) {
+  json_object *valueJ;
+
+  if (!json_object_object_get_ex (context, key, &valueJ) || valueJ == NULL) return NULL;
+  return json_object_get_string (valueJ);
+}
+
+// run every command of a POST json array in order. Consecutive commands on the same card
+// keep it opened and locked, last card is released by caller once response is sent.
+STATIC json_object *requestBatch (AJG_session *session, AJG_request *request, int rqtid) {
+  json_object *commands, *results, *response, *errMessage;
+  AJG_request batchreq;
+  int idx;
+
+  commands = request->data ? json_tokener_parse (request->data) : NULL;
+  if (commands == NULL || !json_object_is_type (commands, json_type_array)) {
+     if (commands) json_object_put (commands);
+     return jsonNewMessage (AJG_FATAL, "batch expects a POST json array of commands");
+  }
+
+  memset (&batchreq, 0, sizeof (batchreq));
+  results = json_object_new_array();
+
+  for (idx=0; idx < (int)json_object_array_length (commands); idx++) {
+     json_object *cmdJ = json_object_array_get_idx (commands, idx);
+     AJG_cardslot *cardslot = batchreq.cardslot;
+     char *cardname = batchreq.cardname;
+     const char *query = batchParam (cmdJ, "request");
+     json_object *result;
+
+     // only card handle and name survive from one command to the next
+     memset (&batchreq, 0, sizeof (batchreq));
+     batchreq.cardslot = cardslot;
+     batchreq.cardname = cardname;
+
+     if (!json_object_is_type (cmdJ, json_type_object) || query == NULL) {
+        result = jsonNewMessage (AJG_FATAL, "batch command %d missing request", idx);
+     } else if (!strcmp (query, "batch")) {
+        result = jsonNewMessage (AJG_FATAL, "batch command %d nested batch refused", idx);
+     } else {
+        result = requestDispatch (session, &batchreq, query, batchParam, cmdJ, rqtid, &errMessage);
+        if (result == NULL) result = errMessage ? errMessage : jsonNewMessage (AJG_FATAL, "batch command %d request=%s no response", idx, query);
+     }
+     json_object_array_add (results, result);
+  }
+  json_object_put (commands);
+
+  // last card is released by requestApi after response serialization
+  request->cardslot = batchreq.cardslot;
+  request->cardname = batchreq.cardname;
+
+  response = json_object_new_object();
+  json_object_object_add (response, "ajgtype", json_object_new_string (AJG_BATCH_JTYPE));
+  json_object_object_add (response, "status" , jsonNewStatus (AJG_SUCCESS));
+  json_object_object_add (response, "data"   , results);
+  return response;
+}
+
+// strong etag header of a content tag, each content encoding is a different entity
+STATIC void httpdEtagValue (char *value, size_t maxlen, const char *etag, int encoding) {
+  if (encoding == AJG_ENCODING_IDENTITY) snprintf (value, maxlen, "\"%s\"", etag);
+  else snprintf (value, maxlen, "\"%s-%s\"", etag, compressName (encoding));
+}
+
+// If-None-Match holds etag in any encoding [weak comparison as RFC7232 requires for If-None-Match].
+// Returns 1 + encoding of matching tag, 0 when nothing matches.
+PUBLIC int httpdEtagMatch (const char *header, const char *etag) {
+  const char *token, *end, *suffix;
+  size_t len;
+  int idx;
+
+  if (header == NULL || etag == NULL || etag[0] == '\0') return FALSE;
+  len = strlen (etag);
+
+  for (token = header; *token; token = end) {
+      while (*token == ' ' || *token == '\t' || *token == ',') token++;
+      if (*token == '*') return 1 + AJG_ENCODING_IDENTITY;
+      if (!strncmp (token, "W/", 2)) token += 2;
+
+      // skip anything that is not a quoted tag
+      if (*token != '"') {
+          end = token + strcspn (token, ",");
+          continue;
+      }
+      token++;
+      if ((end = strchr (token, '"')) == NULL) break;
+      end++;
+
+      if ((size_t)(end - 1 - token) < len || strncmp (token, etag, len)) continue;
+      suffix = token + len;
+      if (*suffix == '"') return 1 + AJG_ENCODING_IDENTITY;
+      if (*suffix++ != '-') continue;
+      for (idx=1; idx < AJG_ENCODINGS; idx++) {
+          const char *name = compressName (idx);
+          if (!strncmp (suffix, name, strlen (name)) && suffix[strlen (name)] == '"') return 1 + idx;
+      }
+  }
+  return FALSE;
+}
+
+// MHD free callback, each response holds one reference on its buffer
+STATIC void httpdFreeBuffer (void *data) {
+  jbufRelease (jbufBlock (data));
+}
+
+// queue a shared buffer without copy, same buffer may be queued on many connections
+STATIC int httpdQueueBuffer (struct MHD_Connection *connection, AJG_session *session, unsigned int status, AJG_rbuf *block, int encoding, const char *etag, int format) {
+  struct MHD_Response *response;
+  char etagValue [80];
+  int ret;
+
+  jbufHold (block);
+  response = MHD_create_response_from_buffer_with_free_callback (block->len, block->data, httpdFreeBuffer);
+  if (response == NULL) {
+      jbufRelease (block);
+      return MHD_NO;
+  }
+  __sync_fetch_and_add (&respcount, 1);
+  __sync_fetch_and_add (&respshared, block->len);
+
+  // content depends on Accept [json, cbor, msgpack] and on Accept-Encoding as soon as compression is enabled
+  MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, jbufMime (format));
+  if (encoding != AJG_ENCODING_IDENTITY) MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_ENCODING, compressName (encoding));
+  MHD_add_response_header (response, MHD_HTTP_HEADER_VARY, session->config->compressLevel > 0 ? HTTPD_VARY_ENCODING : MHD_HTTP_HEADER_ACCEPT);
+
+  // tagged content is revalidated on every request, unchanged content costs a 304
+  if (etag && etag[0]) {
+      httpdEtagValue (etagValue, sizeof (etagValue), etag, encoding);
+      MHD_add_response_header (response, MHD_HTTP_HEADER_ETAG, etagValue);
+      MHD_add_response_header (response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+  }
+
+  ret = MHD_queue_response (connection, status, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+// best encoding accepted by client for a response of len bytes
+STATIC int httpdEncoding (struct MHD_Connection *connection, AJG_session *session, size_t len) {
+  const char *accept = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  return compressChoose (session, compressAccept (accept), len);
+}
+
+// send block in best encoding accepted by client, cached responses keep their compressed variants
+STATIC int httpdSendBlock (struct MHD_Connection *connection, AJG_session *session, unsigned int status, AJG_rbuf *block, AJG_respcache *respcache, const char *etag, int format) {
+  AJG_rbuf *compressed = NULL;
+  int encoding, ret;
+
+  encoding = httpdEncoding (connection, session, block->len);
+
+  if (encoding != AJG_ENCODING_IDENTITY) {
+      if (respcache) compressed = cacheEncodeResponse (session, respcache, encoding);
+      else compressed = compressBlock (session, block, encoding);
+  }
+  if (compressed == NULL) return httpdQueueBuffer (connection, session, status, block, AJG_ENCODING_IDENTITY, etag, format);
+
+  __sync_fetch_and_add (&respcompressed, 1);
+  __sync_fetch_and_add (&respsaved, block->len - compressed->len);
+  ret = httpdQueueBuffer (connection, session, status, compressed, encoding, etag, format);
+  jbufRelease (compressed);
+  return ret;
+}
+
+// queue a serialized json-c tree, MHD keeps its own copy unless it gets compressed.
+// Binary formats are written from the tree within a block
+STATIC int httpdQueueJson (struct MHD_Connection *connection, AJG_session *session, unsigned int status, json_object *jsonResponse, const char *etag, int format) {
+  struct MHD_Response *response;
+  const char *serialized;
+  char etagValue [80];
+  size_t len;
+  int ret;
+
+  if (format != AJG_FORMAT_JSON) {
+      AJG_rbuf *block;
+      AJG_jbuf jbuf;
+
+      jbufInit (&jbuf, FALSE);
+      jbuf.format = format;
+      jbufJson (&jbuf, jsonResponse);
+      block = jbufDetach (&jbuf);
+      jbufFree (&jbuf);
+      if (block == NULL) return MHD_NO;
+
+      ret = httpdSendBlock (connection, session, status, block, NULL, etag, format);
+      jbufRelease (block);
+      return ret;
+  }
+
+  serialized = json_object_to_json_string(jsonResponse);
+  len = strlen (serialized);
+  __sync_fetch_and_add (&respcopied, len);
+
+  // large trees [fakemod, session load] are copied once within a block and compressed from there
+  if (httpdEncoding (connection, session, len) != AJG_ENCODING_IDENTITY) {
+      AJG_rbuf *block = malloc (sizeof (AJG_rbuf) + len);
+
+      if (block != NULL) {
+          block->refcount = 1;
+          block->len = len;
+          memcpy (block->data, serialized, len);
+          ret = httpdSendBlock (connection, session, status, block, NULL, etag, format);
+          jbufRelease (block);
+          return ret;
+      }
+  }
+
+  response = MHD_create_response_from_buffer (len, (void*)serialized, MHD_RESPMEM_MUST_COPY);
+  __sync_fetch_and_add (&respcount, 1);
+  MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_TYPE, JSON_CONTENT);
+  MHD_add_response_header (response, MHD_HTTP_HEADER_VARY, session->config->compressLevel > 0 ? HTTPD_VARY_ENCODING : MHD_HTTP_HEADER_ACCEPT);
+  if (etag && etag[0]) {
+      httpdEtagValue (etagValue, sizeof (etagValue), etag, AJG_ENCODING_IDENTITY);
+      MHD_add_response_header (response, MHD_HTTP_HEADER_ETAG, etagValue);
+      MHD_add_response_header (response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
   }
+
+  ret = MHD_queue_response (connection, status, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+// client tag still matches content, empty 304 carries back the tag client holds
+STATIC int httpdQueueNotModified (struct MHD_Connection *connection, const char *etag, int match, const char *cacheControl) {
+  struct MHD_Response *response;
+  char etagValue [80];
+  int ret;
+
+  response = MHD_create_response_from_buffer (0, "", MHD_RESPMEM_PERSISTENT);
+  httpdEtagValue (etagValue, sizeof (etagValue), etag, match - 1);
+  MHD_add_response_header (response, MHD_HTTP_HEADER_ETAG, etagValue);
+  MHD_add_response_header (response, MHD_HTTP_HEADER_CACHE_CONTROL, cacheControl);
+  __sync_fetch_and_add (&respnotmodified, 1);
+
+  ret = MHD_queue_response (connection, MHD_HTTP_NOT_MODIFIED, response);
+  MHD_destroy_response (response);
+  return ret;
 }
 
+// PUT/POST on v2 resources may come with or without a json body
+STATIC int httpdHasBody (struct MHD_Connection *connection) {
+  const char *length = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+  return (length != NULL && atoi (length) > 0);
+}
 
 // process rest API query
 STATIC int requestApi (struct MHD_Connection *connection, AJG_session *session, const char *method,  const char* url
                       , const char *upload_data, size_t *upload_data_size, void **con_cls) {
   const char  *query, *param;
-  json_object *cmd;
-  int ret;
+  int ret, status = MHD_HTTP_BAD_REQUEST;
   json_object *jsonResponse, *errMessage;
-  struct MHD_Response  *response;
   AJG_request request;
-  const char *serialized;
+  AJG_route route;
+  int rqtid, streamed;
 
-  // clean up session
-  rqtcount++;
+  // clean up session [requests may run in parallel worker threads]
+  rqtid = __sync_add_and_fetch (&rqtcount, 1);
   memset (&request, 0, sizeof (request));
+  memset (&route, 0, sizeof (route));
   jsonResponse=NULL;
 
+  // same schema in json, cbor or msgpack depending on Accept header
+  request.format = jbufAccept (MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT));
+
+  // v2 resource path, method is part of the route
+  if (!strncmp (url, AJG_ROUTE_PREFIX, strlen (AJG_ROUTE_PREFIX))) {
+     switch (routeMatch (method, url + strlen (AJG_ROUTE_PREFIX), &route)) {
+        case AJG_ROUTE_NOTFOUND:
+           status = MHD_HTTP_NOT_FOUND;
+           errMessage = jsonNewMessage (AJG_FAIL, "No REST v2 resource %s", url);
+           goto ExitOnError;
+        case AJG_ROUTE_BADMETHOD:
+           status = MHD_HTTP_METHOD_NOT_ALLOWED;
+           errMessage = jsonNewMessage (AJG_FAIL, "Method %s not allowed on %s", method, url);
+           goto ExitOnError;
+     }
+  }
+
   // Process POST action. Libmicrohttpd POST handling is everything except simple!!! Not only the logic is less
   // than obvious to understand. But furthermore documentation and samples are almost each of them more impossible
   // that the other. In AJG it's even worse as we use JSON contend type that is not supported by Libmicrohttpd
   // PostPossessor API. https://www.gnu.org/software/libmicrohttpd/manual/html_node/microhttpd_002dpost.html#microhttpd_002dpost
-  if (0 == strcmp (method, MHD_HTTP_METHOD_POST)) {
+  if (route.cmd ? httpdHasBody (connection) : 0 == strcmp (method, MHD_HTTP_METHOD_POST)) {
     const char *encoding;
     int    contentlen=-1;
     AJG_HttpPost *posthandle = *con_cls;
@@ -133,13 +658,18 @@ STATIC int requestApi (struct MHD_Connection *connection, AJG_session *session,
     if (param) sscanf (param,"%i",&contentlen);
 
     // POST datas may come in multiple chunk. Even when it never happen on AJG, we still have to handle the case
-    if (strcasestr (encoding, JSON_CONTENT) == 0) {
+    if (encoding == NULL || strcasestr (encoding, JSON_CONTENT) == 0) {
         errMessage = jsonNewMessage (AJG_FATAL, "Post Date wrong type encoding=%s != %s", encoding, JSON_CONTENT);
         goto ExitOnError;
     }
 
-    if (contentlen > MAX_POST_SIZE) {
-        errMessage = jsonNewMessage (AJG_FATAL, "Post Date to big %d > %d", contentlen, MAX_POST_SIZE);
+    if (contentlen < 0) {
+        errMessage = jsonNewMessage (AJG_FATAL, "Post Data missing Content-Length");
+        goto ExitOnError;
+    }
+
+    if (contentlen > session->config->maxPost) {
+        errMessage = jsonNewMessage (AJG_FATAL, "Post Date to big %d > %d [see --max-post]", contentlen, session->config->maxPost);
         goto ExitOnError;
     }
 
@@ -147,7 +677,8 @@ STATIC int requestApi (struct MHD_Connection *connection, AJG_session *session,
     // As JSON content is not supported out of box, but must provide something equivalent.
     if (posthandle == NULL) {
        posthandle = malloc (sizeof (AJG_HttpPost));   // allocate application POST processor handle
-       posthandle->uid = postcount ++;                // build a UID for DEBUG
+       posthandle->type= AJG_CONCLS_POST;
+       posthandle->uid = __sync_fetch_and_add (&postcount, 1); // build a UID for DEBUG
        posthandle->len = 0;                           // effective length within POST handler
        posthandle->data= malloc (contentlen +1);      // allocate memory for full POST data + 1 for '\0' enf of string
        *con_cls = posthandle;                         // attache POST handle to current HTTP session
@@ -162,6 +693,11 @@ STATIC int requestApi (struct MHD_Connection *connection, AJG_session *session,
     if (*upload_data_size) {
         if (verbose) fprintf (stderr, "Update Post Request UID=%d\n", posthandle->uid);
 
+        // never trust Content-Length, data should fit within allocated buffer
+        if (posthandle->len + *upload_data_size > (size_t)contentlen) {
+            errMessage = jsonNewMessage (AJG_FATAL, "Post Data UID=%d longer than Content-Length %d", posthandle->uid, contentlen);
+            goto ExitOnError;
+        }
         memcpy (&posthandle->data[posthandle->len], upload_data, *upload_data_size);
         posthandle->len = posthandle->len + *upload_data_size;
         *upload_data_size = 0;
@@ -181,169 +717,139 @@ STATIC int requestApi (struct MHD_Connection *connection, AJG_session *session,
 
     if (verbose == 0) fprintf (stderr, "Post Data Buffer=%s UID=%d\n", request.data, posthandle->uid);
 
-  // process GET method and ignore any other
-  } else if (strcmp (method, MHD_HTTP_METHOD_GET) != 0) {
+  // process GET method and ignore any other [v2 methods were checked by router]
+  } else if (route.cmd == 0 && strcmp (method, MHD_HTTP_METHOD_GET) != 0) {
        errMessage = jsonNewMessage (AJG_FATAL, "Not a POST/GET method=%s", method);
        goto ExitOnError;
 
+  } else if (0 == strcmp (method, MHD_HTTP_METHOD_GET)) {
+       // reads answer with a 304 when client tag still matches card content
+       request.ifnonematch = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
   }
 
   // extract request query attribute from URL through ApiCmd
-  query = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "request");
+  query = route.cmd ? route.name : MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "request");
   if (query == NULL) {
     errMessage = jsonNewMessage (AJG_FATAL, "Invalid AJG REST request &request=xxxxx& missing ");
     goto ExitOnError;
   }
-  // extract command value from json object and process it
-  (void) json_object_object_get_ex (Request2Commands, query, &cmd);
 
-  request.cardid = NULL; // no default card
-  request.cardid = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "cardid");
-
-  param = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "quiet");
-  if (param && ! sscanf (param, "%d", &request.quiet)) {
-    errMessage = jsonNewMessage (AJG_FATAL, "Query=%s Quiet not integer &quiet=%s&", query, param);
-    goto ExitOnError;
+  // hot responses are streamed within thread buffer, others come back as json-c tree
+  request.jbuf = jbufThread ();
+  request.jbuf->format = request.format;
+  if (route.cmd) jsonResponse = requestRoute (session, &request, &route, connection, rqtid, &errMessage);
+  else jsonResponse = requestDispatch (session, &request, query, httpParam, connection, rqtid, &errMessage);
+  if (errMessage) goto ExitOnError;
+
+  // nothing was read nor written, client keeps its copy
+  if (request.notmodified) {
+      if (jsonResponse) json_object_put (jsonResponse);
+      ret = httpdQueueNotModified (connection, request.etag, request.notmodified, "no-cache");
+      if (request.cardname) free (request.cardname);
+      poolReleaseCard (session, request.cardslot);
+      return ret;
   }
-
-  request.numid = -1;  // no default
-  param = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "numid");
-  if (param && ! sscanf (param, "%d", &request.numid)) {
-    errMessage = jsonNewMessage (AJG_FATAL, "Query=%s NumID not integer &numid=%s&", query, param);
-    goto ExitOnError;
+  streamed = (jsonResponse == NULL && (request.block || (request.jbuf->len > 0 && !request.jbuf->failed)));
+
+  // ctrl-get-changed found nothing, suspend connection while card is still locked [no change can be missed]
+  // only GET may wait, resumed on timeout we answer with an empty change list
+  if ((jsonResponse || streamed) && request.timeout > 0 && request.changed == 0 && request.cardslot != NULL && request.data == NULL) {
+      AJG_delta *delta = *con_cls;
+
+      if (delta == NULL || delta->state != AJG_DELTA_EXPIRED) {
+          deltaPark (session, connection, con_cls, request.cardid, request.timeout);
+          if (jsonResponse) json_object_put (jsonResponse);
+          jbufRelease (request.block);
+          if (request.cardname) free (request.cardname);
+          poolReleaseCard (session, request.cardslot);
+          return MHD_YES;
+      }
   }
 
-
-  switch (json_object_get_int(cmd)) {
-
-
-  	case GATEWAY_PING: // http://localhost:1234/jsonapi?request=ping-get [&sndcard=0]
-  	    if (verbose) fprintf (stderr, "%d: alsajson GATEWAY_PING\n", rqtcount);
-
-        if (request.cardid == NULL)  jsonResponse = gatewayPing ();
-        else jsonResponse = alsaProbeCard (session, &request);
-  	    break;
-
-  	case CARD_GET_ALL: // http://localhost:1234/jsonapi?request=card-get-all
-  	    if (verbose)  fprintf (stderr, "%d: alsajson CARD_GET_ALL\n", rqtcount ++);
-  	    jsonResponse = alsaFindCard (session, &request); // sndcard = -1
-  	    break;
-
-  	case CARD_GET_ONE: // http://localhost:1234/jsonapi?request=card-get-one&sndcard=0
-  	    if (verbose)  fprintf (stderr, "%d: alsajson CARD_GET_ONE cardid=%s\n", rqtcount ++, request.cardid );
-   	    if (request.cardid == NULL) {
-            errMessage = jsonNewMessage (AJG_FAIL, "CARD_GET_ONE Query=%s Missing &SndCard=xxxx&\n", query);
-   	        goto ExitOnError;
-   	    }
-  	    jsonResponse = alsaFindCard (session, &request);
-  	    break;
-
-  	case CTRL_GET_ALL: // http://localhost:1234/jsonapi?request=ctrl-get-all&sndcard=0
-  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_ALL\n", rqtcount ++);
-  	    request.numid = -1; // force list-all
-  	    jsonResponse = alsaGetControl (session, &request);  // numid == -1
-  	    break;
-
-  	case CTRL_GET_ONE: // http://localhost:1234/jsonapi?request=ctrl-get-one&cardid=hw:0&numid=5&quiet=0
-  	    if (verbose)  fprintf (stderr, "%d: alsajson CTRL_GET_ONE cardid=%s numid=%d\n", rqtcount ++, request.cardid ,request.numid);
-        jsonResponse = alsaGetControl (session, &request);
- 	    break;
-
-  	case CTRL_SET_ONE: {// http://localhost:1234/jsonapi?request=ctrl-set-one&cardid=hw:0&quiet=1&numid=128&value=10,5
-  	    if (verbose)  fprintf (stderr, "%d: alsajson processing CTRL_SET_ONE cardid=%s numid=%d args=%s\n", rqtcount ++, request.cardid ,request.numid, request.args);
-        request.args   = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "value");
-        jsonResponse = alsaSetOneCtrl (session, &request);
- 	    break;
- 	    }
-
-  	case CTRL_SET_MANY: {// http://localhost:1234/jsonapi?request=ctrl-set-one&cardid=hw:0&quiet=1&numids=10,12,13&args=10
- 	    // if data where not found in POST try to get them from GET [do not forget URL size constrains]
-        if (request.data == NULL) request.data = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "numids");
-        request.args   = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "value");
-
-  	    if (verbose)  fprintf (stderr, "%d: alsajson processing CTRL_SET_MANY cardid=%s numids=%s value=%s\n", rqtcount ++, request.cardid ,request.data, request.args);
-
-        jsonResponse = alsaSetManyCtrl (session, &request);
- 	    break;
- 	    }
-
-    case SESSION_LIST:  {// http://localhost:1234/jsonapi?request=session-list&sndcard=0
-       jsonResponse = alsaListSession (session, &request); // list session for requested sndcard
-       break;
-    }
-
-  	case SESSION_LOAD: { // http://localhost:1234/jsonapi?request=session-load&cardid=hw:0&args=sessionname
-
-       request.args   = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "session");
-       if (verbose)  fprintf (stderr, "%d: alsajson SESSION_LOAD cardid=%s session=%s\n", rqtcount ++, request.cardid, request.args);
-
-       jsonResponse = alsaLoadSession (session, &request);  // push session to alsa board
-
-       break;
-   	}
-
-  	case SESSION_STORE: {// http://localhost:1234/jsonapi?request=session-store&cardid=hw:0&session=sessionname
-
-       request.args   = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "session");
-
-  	   // if data where not found in POST try to get them from GET [do not forget URL size constrains]
-   	   if (request.data == NULL) request.data = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "info");
-
-       if (verbose)  fprintf (stderr, "%d: alsajson SESSION_STORE cardid=%s session=%s\n", rqtcount ++, request.cardid, request.args );
-       jsonResponse = alsaStoreSession (session, &request);  // push session to alsa board
-       break;
-   	}
-
-  	default:
-       errMessage = jsonNewMessage (AJG_FAIL, "%d:unknown Request=%s Cardid=%s NumId=%d\n", rqtcount ++, query, request.cardid ,request.numid);
-  	   goto ExitOnError;
-   }
-
    // send response to client with a http AJG_SUCCESS status code
-   // [note we need to copy serialize object because libmicrohttpd does not provide adequate free callback
-   if (jsonResponse == NULL) {
-       errMessage = jsonNewMessage (AJG_FATAL,"Request:%d Query=%s SndCard=%s NumId=%d Response=>NULL [please report bug]\n", rqtcount ++, query, request.cardid ,request.numid);
+   if (jsonResponse == NULL && !streamed) {
+       errMessage = jsonNewMessage (AJG_FATAL,"Request:%d Query=%s SndCard=%s NumId=%d Response=>NULL [please report bug]\n", rqtid, query, request.cardid ,request.numid);
        goto ExitOnError;
    }
 
-   serialized = json_object_to_json_string(jsonResponse);
-   response = MHD_create_response_from_buffer (strlen (serialized), (void*)serialized, MHD_RESPMEM_MUST_COPY);
-
-   ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
-   MHD_destroy_response (response);
-   json_object_put (jsonResponse); // decrease reference rqtcount to free the json object
+   // streamed or cached buffer goes to MHD as it is [or compressed], it is freed once sent
+   if (streamed) {
+       AJG_rbuf *block = request.block ? request.block : jbufDetach (request.jbuf);
+       ret = httpdSendBlock (connection, session, MHD_HTTP_OK, block, request.respcache, request.etag, request.format);
+       jbufRelease (block);
+   } else {
+       ret = httpdQueueJson (connection, session, MHD_HTTP_OK, jsonResponse, request.etag, request.format);
+       json_object_put (jsonResponse); // decrease reference rqtcount to free the json object
+   }
    if (request.cardname) free (request.cardname); // cardname need to be free
+
+   poolReleaseCard (session, request.cardslot);
    return ret;
 
 ExitOnError:
-   serialized = json_object_to_json_string(errMessage);
-   response = MHD_create_response_from_buffer (strlen (serialized), (void*)serialized, MHD_RESPMEM_MUST_COPY);
-   ret = MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
-   MHD_destroy_response (response);
+   jbufRelease (request.block);
+   ret = httpdQueueJson (connection, session, status, errMessage, NULL, request.format);
    json_object_put (errMessage); // decrease reference rqtcount to free the json object
+   if (request.cardname) free (request.cardname);
+   poolReleaseCard (session, request.cardslot);
    return ret;
 }
 
-// Create check etag value
-STATIC void computeEtag (char *etag, int maxlen, struct stat *sbuf) {
-   int time;
+// static file tag from size and nanosecond mtime, two edits within the same second still differ
+STATIC void computeEtag (char *etag, int maxlen, off_t size, const struct timespec *mtime) {
+   snprintf (etag, maxlen, "%llx-%llx.%lx", (unsigned long long) size, (unsigned long long) mtime->tv_sec, (unsigned long) mtime->tv_nsec);
+}
+
+// send a file from memory, ref->block reference goes to MHD response
+STATIC int httpdQueueAsset (struct MHD_Connection *connection, AJG_session *session, const char *filepath, AJG_assetref *ref) {
+    struct MHD_Response *response;
+    char etag[64], etagValue[80];
+    int ret, match;
+
+    computeEtag (etag, sizeof (etag), ref->size, &ref->mtime);
+    match = httpdEtagMatch (MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH), etag);
+    if (match) {
+        jbufRelease (ref->block);
+        if (verbose) fprintf (stderr, "Not Modify: [%s]\n", filepath);
+        return httpdQueueNotModified (connection, etag, match, session->cacheTimeout);
+    }
+    httpdEtagValue (etagValue, sizeof (etagValue), etag, ref->encoding);
+
+    response = MHD_create_response_from_buffer_with_free_callback (ref->block->len, ref->block->data, httpdFreeBuffer);
+    if (response == NULL) {
+        jbufRelease (ref->block);
+        return MHD_NO;
+    }
+    if (verbose) fprintf (stderr, "Serving: [%s] from memory encoding=%s\n", filepath, compressName (ref->encoding));
+
+    MHD_add_response_header (response,MHD_HTTP_HEADER_CONTENT_TYPE, ref->mime);
+    MHD_add_response_header (response,MHD_HTTP_HEADER_CACHE_CONTROL, session->cacheTimeout);
+    MHD_add_response_header (response,MHD_HTTP_HEADER_ETAG, etagValue);
+    if (ref->encoding != AJG_ENCODING_IDENTITY) MHD_add_response_header (response, MHD_HTTP_HEADER_CONTENT_ENCODING, compressName (ref->encoding));
+    if (ref->vary) MHD_add_response_header (response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
 
-   time = sbuf->st_mtim.tv_sec;
-   snprintf (etag, maxlen, "%d", time);
+    ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+    MHD_destroy_response (response);
+    return ret;
 }
 
-// minimal httpd file server for static HTML,JS,CSS,etc...
+// minimal httpd file server for static HTML,JS,CSS,etc... hot files come from asset cache
 STATIC int requestFile (struct MHD_Connection *connection, AJG_session *session, const char* url) {
     int fd;
-    int ret;
+    int ret, accept;
     struct stat sbuf;
     struct MHD_Response  *response;
     char filepath [512];
+    AJG_assetref ref;
 
     // build full path from rootdir + url
     strncpy (filepath, session->config->rootdir, sizeof (filepath));
     strncat (filepath, url,511);
 
+    // file already in memory, disk is not touched at all
+    accept = compressAccept (MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING));
+    if (assetFind (session, filepath, accept, &ref)) return httpdQueueAsset (connection, session, filepath, &ref);
+
     // try to open file and get its size
     if ( (-1 == (fd = open (filepath, O_RDONLY))) || (0 != fstat (fd, &sbuf)) ) {
 
@@ -381,29 +887,31 @@ STATIC int requestFile (struct MHD_Connection *connection, AJG_session *session,
                          (void *) errorstr,	 MHD_RESPMEM_PERSISTENT);
             ret = MHD_queue_response (connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
 
-        } else {  // we're facing a regular file, check ETAG and if needed send it
-            const char *etagCache;
-            char etagValue[15];
+        } else if (assetLoad (session, filepath, fd, &sbuf, accept, &ref)) { // small enough to be kept in memory
+            close (fd);
+            return httpdQueueAsset (connection, session, filepath, &ref);
+
+        } else {  // large regular file, check ETAG and if needed send it from its fd [sendfile]
+            char etag[64], etagValue[80];
+            int match;
 
             // https://developers.google.com/web/fundamentals/performance/optimizing-content-efficiency/http-caching?hl=fr
             // ftp://ftp.heanet.ie/disk1/www.gnu.org/software/libmicrohttpd/doxygen/dc/d0c/microhttpd_8h.html
 
-            // Check etag value and load file only when modification date changes
-            etagCache = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
-            computeEtag (etagValue, sizeof (etagValue), &sbuf);
-
-            if (etagCache != NULL && strcmp (etagValue, etagCache) == 0) {
+            // Check etag value and load file only when size or modification date changes
+            computeEtag (etag, sizeof (etag), sbuf.st_size, &sbuf.st_mtim);
+            match = httpdEtagMatch (MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH), etag);
 
+            if (match) {
                 close (fd); // file did not change since last upload
                 if (verbose) fprintf (stderr, "Not Modify: [%s]\n", filepath);
-                response = MHD_create_response_from_buffer (0,"", MHD_RESPMEM_PERSISTENT);
-                MHD_add_response_header (response,MHD_HTTP_HEADER_CACHE_CONTROL, session->cacheTimeout); // default one hour cache
-                MHD_add_response_header (response,MHD_HTTP_HEADER_ETAG, etagValue);
-                ret = MHD_queue_response (connection, MHD_HTTP_NOT_MODIFIED, response);
+                return httpdQueueNotModified (connection, etag, match, session->cacheTimeout); // default one hour cache
 
             } else {  // it's a new file, we need to upload it to client
                 if (verbose) fprintf (stderr, "Serving: [%s]\n", filepath);
                 response =  MHD_create_response_from_fd (sbuf.st_size, fd);
+                httpdEtagValue (etagValue, sizeof (etagValue), etag, AJG_ENCODING_IDENTITY);
+                MHD_add_response_header (response,MHD_HTTP_HEADER_CONTENT_TYPE, assetMime (filepath));
                 MHD_add_response_header (response,MHD_HTTP_HEADER_CACHE_CONTROL,session->cacheTimeout); // default one hour cache
                 MHD_add_response_header (response,MHD_HTTP_HEADER_ETAG, etagValue);
                 ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
@@ -424,8 +932,13 @@ STATIC int newRequest (void *cls,
   AJG_session *session = cls;
   int ret;
 
-  if (0 == strcmp (url, "/jsonapi")) {
+  // connection accepted over limits, answer at once and let it close
+  if (admitBusy (session, connection)) return admitReject (session, connection);
+
+  if (0 == strcmp (url, "/jsonapi") || 0 == strncmp (url, AJG_ROUTE_PREFIX, strlen (AJG_ROUTE_PREFIX))) {
        ret = requestApi (connection, session, method, url, upload_data, upload_data_size, con_cls);
+  } else if (0 == strcmp (url, "/jsonapi/ws")) {
+       ret = wsockRequest (connection, session, method);
   } else {
       if (0 != strcmp (method, MHD_HTTP_METHOD_GET)) return MHD_NO;   /* unexpected method */
       ret = requestFile (connection, session, url);
@@ -437,25 +950,47 @@ STATIC int newRequest (void *cls,
 
 STATIC int newClient (void *cls, const struct sockaddr * addr, socklen_t addrlen) {
   // check if client is comming from an acceptable IP
-  return (MHD_YES); // MHD_NO
+  return admitAccept (cls, addr);
+}
+
+// count connections, the ones over limits are marked busy within their socket context
+STATIC void newConnection (void *cls, struct MHD_Connection *connection, void **socket_context, enum MHD_ConnectionNotificationCode toe) {
+  AJG_session *session = cls;
+
+  if (toe == MHD_CONNECTION_NOTIFY_STARTED) *socket_context = admitOpen (session, connection);
+  else admitClose (session, *socket_context);
 }
 
 PUBLIC AJG_ERROR httpdStart (AJG_session *session) {
+  unsigned int maxClients, maxPerIp;
 
   // at 1st call initialise http api hashtable
   if (Request2Commands == NULL) initService (session);
 
+  // MHD closes at accept what is over limits + slack, limits themselves are checked by admitOpen
+  maxClients = (session->config->maxClients > 0) ? session->config->maxClients + AJG_ADMIT_SLACK : FD_SETSIZE - 4;
+  maxPerIp   = (session->config->maxPerIp > 0) ? session->config->maxPerIp + AJG_ADMIT_SLACK : 0;
+
   if (verbose) {
-      printf ("AJG:notice Waiting port=%d rootdir=%s\n", session->config->httpdPort, session->config->rootdir);
+      printf ("AJG:notice Waiting port=%d rootdir=%s workers=%d\n", session->config->httpdPort, session->config->rootdir, session->config->workers);
       printf ("AJG:notice Browser URL= http://localhost:%d\n", session->config->httpdPort);
   }
 
+  // with more than one worker MHD serves connections from a pool of threads,
+  // otherwise httpd has no thread and is driven from main epoll loop.
+  // Epoll in both cases, parked long-poll connections are not limited by FD_SETSIZE
+  session->httpdexternal = (session->config->workers <= 1);
   session->httpd = (void*) MHD_start_daemon (
-			MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG, // use request and not threads
+            (session->httpdexternal ? 0 : MHD_USE_SELECT_INTERNALLY) | MHD_USE_EPOLL_LINUX_ONLY | MHD_ALLOW_UPGRADE | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
             session->config->httpdPort,   // port
-            &newClient, NULL,       // Tcp Accept call back + extra attribute
+            &newClient, session,    // Tcp Accept call back + extra attribute
             &newRequest, session,  // Http Request Call back + extra attribute
-            MHD_OPTION_NOTIFY_COMPLETED, &endRequest, NULL,
+            MHD_OPTION_NOTIFY_COMPLETED, &endRequest, session,
+            MHD_OPTION_NOTIFY_CONNECTION, &newConnection, session,
+            MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) (session->config->workers > 1 ? session->config->workers : 0),
+            MHD_OPTION_CONNECTION_LIMIT, maxClients,
+            MHD_OPTION_PER_IP_CONNECTION_LIMIT, maxPerIp,
+            MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) session->config->connMemory * 1024,
 			MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 15, MHD_OPTION_END); // 15s + options-end
 			// TBD: MHD_OPTION_SOCK_ADDR
 
@@ -463,27 +998,37 @@ PUBLIC AJG_ERROR httpdStart (AJG_session *session) {
      printf ("Error: httpStart invalid httpd port: %d", session->config->httpdPort);
      return AJG_FATAL;
   }
+
+  // MHD epoll fd is nested within main loop, any socket activity wakes it up
+  if (session->httpdexternal) {
+     const union MHD_DaemonInfo *info = MHD_get_daemon_info (session->httpd, MHD_DAEMON_INFO_EPOLL_FD_LINUX_ONLY);
+     if (info == NULL || eventAdd (session, info->epoll_fd, EPOLLIN, NULL, NULL) == NULL) {
+         fprintf (stderr, "AJG: httpStart fail to register httpd within main loop\n");
+         return AJG_FATAL;
+     }
+  }
   return AJG_SUCCESS;
 }
 
-// infinit loop
+// infinite main loop: httpd sockets [single worker], alsa events and timers
 PUBLIC AJG_ERROR httpdLoop (AJG_session *session) {
-    static int count =0;
+    unsigned long long mhdtimeout;
+    int timeout;
 
-    initService(session); // initialise http static data
+    if (verbose) fprintf (stderr, "AJG:notice entering main loop httpd=%s\n", session->httpdexternal ? "epoll" : "threads");
 
-    if (verbose) fprintf (stderr, "AJG:notice entering httpd waiting loop\n");
-    if (session->foreground) {
+    while (TRUE) {
+        timeout = -1;
 
-        while (TRUE)  {
-            fprintf (stderr, "AJG:notice Use Ctrl-C to quit");
-            (void)getc (stdin);
-        }
-    } else {
-        while (TRUE) {
-           sleep (3600);
-           if (verbose) fprintf (stderr, "AJG:notice httpd alive [%d]\n", count++);
+        // MHD may need to be called back before any socket activity [connection timeout]
+        if (session->httpdexternal && MHD_get_timeout (session->httpd, &mhdtimeout) == MHD_YES) {
+            timeout = (mhdtimeout > INT_MAX) ? INT_MAX : (int) mhdtimeout;
         }
+
+        if (eventWait (session, timeout) < 0) break;
+
+        // let httpd process ready sockets and expired connections
+        if (session->httpdexternal) MHD_run (session->httpd);
     }
 
     // should never return from here
@@ -498,3 +1043,15 @@ PUBLIC int httpdStatus (AJG_session *session) {
 PUBLIC void httpdStop (AJG_session *session) {
   MHD_stop_daemon (session->httpd);
 }
+
+PUBLIC json_object *httpdStats (AJG_session *session) {
+  json_object *statsJ = json_object_new_object();
+
+  json_object_object_add (statsJ, "responses", json_object_new_int64 (respcount));
+  json_object_object_add (statsJ, "copied"   , json_object_new_int64 (respcopied));
+  json_object_object_add (statsJ, "zerocopy" , json_object_new_int64 (respshared));
+  json_object_object_add (statsJ, "compressed", json_object_new_int64 (respcompressed));
+  json_object_object_add (statsJ, "saved"    , json_object_new_int64 (respsaved));
+  json_object_object_add (statsJ, "notmodified", json_object_new_int64 (respnotmodified));
+  return statsJ;
+}
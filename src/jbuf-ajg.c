@@ -0,0 +1,532 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Streaming json writer. Hot responses [card list, controls, messages] are
+    written member by member into a growable buffer instead of building a
+    json-c tree that gets serialized afterward. Output is byte-identical to
+    json_object_to_json_string [JSON_C_TO_STRING_SPACED] or, for websocket
+    frames, to JSON_C_TO_STRING_PLAIN. json-c remains in use to parse input.
+
+    The same calls write CBOR [RFC7049] or MessagePack when client asks for
+    them, small control surfaces decode values without parsing text. CBOR
+    containers are indefinite length, MessagePack ones get a 32 bits count
+    patched when they close. Static control metadata is prebuilt once in
+    every format [AJG_prebuilt].
+
+    Buffers are reference counted blocks. Once written, the block is detached
+    and handed as is to libmicrohttpd, which releases it after sending. Each
+    httpd thread remembers the size of its last response, the next one is
+    allocated at once without growing.
+
+   References:
+   https://github.com/json-c/json-c/blob/master/json_object.c
+   https://tools.ietf.org/html/rfc7049
+   https://github.com/msgpack/msgpack/blob/master/spec.md
+*/
+
+#include "local-def-ajg.h"
+#include <stddef.h>
+
+#define AJG_JBUF_CHUNK 4096  // minimum allocation
+
+STATIC pthread_key_t jbufKeyThread;
+STATIC pthread_once_t jbufOnce = PTHREAD_ONCE_INIT;
+
+STATIC const char *jbufMimes [AJG_FORMATS] = {"application/json", "application/cbor", "application/msgpack"};
+STATIC const char *jbufNames [AJG_FORMATS] = {"json", "cbor", "msgpack"};
+
+// make sure at least len more bytes plus final '\0' fit within buffer
+STATIC int jbufGrow (AJG_jbuf *jbuf, size_t len) {
+    AJG_rbuf *block;
+    size_t size;
+
+    if (jbuf->failed) return FALSE;
+    if (jbuf->block && jbuf->len + len < jbuf->size) return TRUE;
+
+    size = jbuf->size ? jbuf->size : (jbuf->hint > AJG_JBUF_CHUNK ? jbuf->hint : AJG_JBUF_CHUNK);
+    while (size <= jbuf->len + len) size *= 2;
+
+    if ((block = realloc (jbuf->block, sizeof (AJG_rbuf) + size)) == NULL) {
+        jbuf->failed = TRUE;
+        return FALSE;
+    }
+    jbuf->block = block;
+    jbuf->data  = block->data;
+    jbuf->size  = size;
+    return TRUE;
+}
+
+STATIC void jbufAppend (AJG_jbuf *jbuf, const char *text, size_t len) {
+    if (!jbufGrow (jbuf, len)) return;
+    memcpy (&jbuf->data[jbuf->len], text, len);
+    jbuf->len += len;
+    jbuf->data[jbuf->len] = '\0';
+}
+
+// separator before a new member of current container, a value following its key has none.
+// Binary formats have no separator, members are only counted [msgpack map counts its keys]
+STATIC void jbufMember (AJG_jbuf *jbuf) {
+
+    if (jbuf->afterkey) {
+        jbuf->afterkey = FALSE;
+        return;
+    }
+    if (jbuf->depth == 0) return;
+
+    if (jbuf->format == AJG_FORMAT_JSON) {
+        if (jbuf->members[jbuf->depth]) jbufAppend (jbuf, ",", 1);
+        if (!jbuf->plain) jbufAppend (jbuf, " ", 1);
+    }
+    jbuf->members[jbuf->depth]++;
+}
+
+// big endian integer on len bytes
+STATIC void jbufPutUint (unsigned char *dest, uint64_t value, int len) {
+    while (len-- > 0) {
+        dest[len] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+// CBOR major type with its argument in shortest form
+STATIC void jbufCborHead (AJG_jbuf *jbuf, int major, uint64_t value) {
+    unsigned char head [9];
+    int len;
+
+    if (value < 24)               { head[0] = (major << 5) | value; len = 0; }
+    else if (value <= 0xff)       { head[0] = (major << 5) | 24; len = 1; }
+    else if (value <= 0xffff)     { head[0] = (major << 5) | 25; len = 2; }
+    else if (value <= 0xffffffff) { head[0] = (major << 5) | 26; len = 4; }
+    else                          { head[0] = (major << 5) | 27; len = 8; }
+
+    jbufPutUint (&head[1], value, len);
+    jbufAppend (jbuf, (char*) head, len + 1);
+}
+
+// MessagePack type byte followed by len bytes of value
+STATIC void jbufPackHead (AJG_jbuf *jbuf, unsigned char type, uint64_t value, int len) {
+    unsigned char head [9];
+
+    head[0] = type;
+    jbufPutUint (&head[1], value, len);
+    jbufAppend (jbuf, (char*) head, len + 1);
+}
+
+// string without member handling [values and map keys]
+STATIC void jbufBinString (AJG_jbuf *jbuf, const char *str) {
+    size_t len = strlen (str);
+
+    if (jbuf->format == AJG_FORMAT_CBOR) jbufCborHead (jbuf, 3, len);
+    else if (len < 32)     jbufPackHead (jbuf, 0xa0 | len, 0, 0);
+    else if (len <= 0xff)  jbufPackHead (jbuf, 0xd9, len, 1);
+    else if (len <= 0xffff) jbufPackHead (jbuf, 0xda, len, 2);
+    else jbufPackHead (jbuf, 0xdb, len, 4);
+    jbufAppend (jbuf, str, len);
+}
+
+// same escaping as json-c json_escape_str [including '/']
+STATIC void jbufEscape (AJG_jbuf *jbuf, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    const char *start = str;
+    char escaped [7];
+
+    jbufAppend (jbuf, "\"", 1);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        const char *replace = NULL;
+
+        switch (c) {
+            case '\b': replace = "\\b";  break;
+            case '\n': replace = "\\n";  break;
+            case '\r': replace = "\\r";  break;
+            case '\t': replace = "\\t";  break;
+            case '\f': replace = "\\f";  break;
+            case '"' : replace = "\\\""; break;
+            case '\\': replace = "\\\\"; break;
+            case '/' : replace = "\\/";  break;
+            default:
+                if (c >= ' ') continue;
+                snprintf (escaped, sizeof (escaped), "\\u00%c%c", hex[c >> 4], hex[c & 0xf]);
+                replace = escaped;
+        }
+
+        // flush unescaped run then replacement
+        jbufAppend (jbuf, start, str - start);
+        jbufAppend (jbuf, replace, strlen (replace));
+        start = str + 1;
+    }
+    jbufAppend (jbuf, start, str - start);
+    jbufAppend (jbuf, "\"", 1);
+}
+
+// json-c SPACED layout closes even empty containers with a space "{ }"
+STATIC void jbufClose (AJG_jbuf *jbuf, char close) {
+
+    if (jbuf->depth == 0) return;
+
+    switch (jbuf->format) {
+        case AJG_FORMAT_CBOR:
+            jbufAppend (jbuf, "\xff", 1);  // break of indefinite length container
+            break;
+        case AJG_FORMAT_MSGPACK:
+            if (!jbuf->failed) jbufPutUint ((unsigned char*) &jbuf->data[jbuf->opened[jbuf->depth] + 1], jbuf->members[jbuf->depth], 4);
+            break;
+        default:
+            if (!jbuf->plain) jbufAppend (jbuf, " ", 1);
+            jbufAppend (jbuf, &close, 1);
+    }
+    jbuf->depth--;
+}
+
+STATIC void jbufOpen (AJG_jbuf *jbuf, char open) {
+    size_t offset;
+
+    jbufMember (jbuf);
+    offset = jbuf->len;
+
+    switch (jbuf->format) {
+        case AJG_FORMAT_CBOR:
+            jbufAppend (jbuf, open == '{' ? "\xbf" : "\x9f", 1);
+            break;
+        case AJG_FORMAT_MSGPACK:  // map32/array32, count is set by jbufClose
+            jbufPackHead (jbuf, open == '{' ? 0xdf : 0xdd, 0, 4);
+            break;
+        default:
+            jbufAppend (jbuf, &open, 1);
+    }
+
+    if (jbuf->depth + 1 >= AJG_JBUF_DEPTH) {
+        jbuf->failed = TRUE;
+        return;
+    }
+    jbuf->depth++;
+    jbuf->members[jbuf->depth] = 0;
+    jbuf->opened[jbuf->depth] = offset;
+}
+
+STATIC void jbufDouble (AJG_jbuf *jbuf, double value) {
+    union { double value; uint64_t bits; } number;
+
+    jbufMember (jbuf);
+    number.value = value;
+    if (jbuf->format == AJG_FORMAT_CBOR) jbufPackHead (jbuf, 0xfb, number.bits, 8);
+    else jbufPackHead (jbuf, 0xcb, number.bits, 8);
+}
+
+// walk a json-c tree with writer calls [binary formats only]
+STATIC void jbufTree (AJG_jbuf *jbuf, json_object *jsonObj) {
+    int idx;
+
+    switch (json_object_get_type (jsonObj)) {
+        case json_type_boolean:
+            jbufBool (jbuf, json_object_get_boolean (jsonObj));
+            break;
+        case json_type_int:
+            jbufInt (jbuf, json_object_get_int64 (jsonObj));
+            break;
+        case json_type_double:
+            jbufDouble (jbuf, json_object_get_double (jsonObj));
+            break;
+        case json_type_string:
+            jbufString (jbuf, json_object_get_string (jsonObj));
+            break;
+        case json_type_object:
+            jbufObjectStart (jbuf);
+            {
+                json_object_object_foreach (jsonObj, key, value) {
+                    jbufKey (jbuf, key);
+                    jbufTree (jbuf, value);
+                }
+            }
+            jbufObjectEnd (jbuf);
+            break;
+        case json_type_array:
+            jbufArrayStart (jbuf);
+            for (idx=0; idx < (int)json_object_array_length (jsonObj); idx++) jbufTree (jbuf, json_object_array_get_idx (jsonObj, idx));
+            jbufArrayEnd (jbuf);
+            break;
+        default:
+            jbufString (jbuf, NULL);
+    }
+}
+
+STATIC void jbufFreeThread (void *jbuf) {
+    jbufFree (jbuf);
+    free (jbuf);
+}
+
+STATIC void jbufInitThread (void) {
+    pthread_key_create (&jbufKeyThread, jbufFreeThread);
+}
+
+PUBLIC void jbufInit (AJG_jbuf *jbuf, int plain) {
+    memset (jbuf, 0, sizeof (AJG_jbuf));
+    jbuf->plain = plain;
+}
+
+// keep allocated memory for next response
+PUBLIC void jbufReset (AJG_jbuf *jbuf) {
+    jbuf->len = 0;
+    jbuf->depth = 0;
+    jbuf->afterkey = FALSE;
+    jbuf->failed = FALSE;
+    if (jbuf->data) jbuf->data[0] = '\0';
+}
+
+PUBLIC void jbufFree (AJG_jbuf *jbuf) {
+    if (jbuf->block) free (jbuf->block);
+    jbuf->block = NULL;
+    jbuf->data = NULL;
+    jbuf->len = jbuf->size = 0;
+}
+
+// take written content away as a shared block [refcount=1], buffer restarts empty
+PUBLIC AJG_rbuf *jbufDetach (AJG_jbuf *jbuf) {
+    AJG_rbuf *block = jbuf->block;
+
+    if (jbuf->failed || block == NULL) return NULL;
+
+    block->refcount = 1;
+    block->len = jbuf->len;
+    jbuf->hint = jbuf->size;
+    jbuf->block = NULL;
+    jbuf->data = NULL;
+    jbuf->size = 0;
+    jbufReset (jbuf);
+    return block;
+}
+
+PUBLIC void jbufHold (AJG_rbuf *block) {
+    __sync_fetch_and_add (&block->refcount, 1);
+}
+
+PUBLIC void jbufRelease (AJG_rbuf *block) {
+    if (block && __sync_sub_and_fetch (&block->refcount, 1) == 0) free (block);
+}
+
+// find block from its payload [MHD free callback only gives payload back]
+PUBLIC AJG_rbuf *jbufBlock (void *data) {
+    return (AJG_rbuf*)((char*)data - offsetof (AJG_rbuf, data));
+}
+
+// reusable buffer of calling thread, returned empty in spaced json layout
+PUBLIC AJG_jbuf *jbufThread (void) {
+    AJG_jbuf *jbuf;
+
+    pthread_once (&jbufOnce, jbufInitThread);
+    jbuf = pthread_getspecific (jbufKeyThread);
+    if (jbuf == NULL) {
+        jbuf = malloc (sizeof (AJG_jbuf));
+        jbufInit (jbuf, FALSE);
+        pthread_setspecific (jbufKeyThread, jbuf);
+    }
+    jbufReset (jbuf);
+    jbuf->plain = FALSE;
+    jbuf->format = AJG_FORMAT_JSON;
+    return jbuf;
+}
+
+PUBLIC void jbufObjectStart (AJG_jbuf *jbuf) { jbufOpen  (jbuf, '{'); }
+PUBLIC void jbufObjectEnd   (AJG_jbuf *jbuf) { jbufClose (jbuf, '}'); }
+PUBLIC void jbufArrayStart  (AJG_jbuf *jbuf) { jbufOpen  (jbuf, '['); }
+PUBLIC void jbufArrayEnd    (AJG_jbuf *jbuf) { jbufClose (jbuf, ']'); }
+
+PUBLIC void jbufKey (AJG_jbuf *jbuf, const char *key) {
+    jbufMember (jbuf);
+    jbuf->afterkey = TRUE;
+
+    if (jbuf->format != AJG_FORMAT_JSON) {
+        jbufBinString (jbuf, key);
+        return;
+    }
+    jbufEscape (jbuf, key);
+    if (jbuf->plain) jbufAppend (jbuf, ":", 1);
+    else jbufAppend (jbuf, ": ", 2);
+}
+
+PUBLIC void jbufString (AJG_jbuf *jbuf, const char *value) {
+    jbufMember (jbuf);
+    switch (jbuf->format) {
+        case AJG_FORMAT_CBOR:
+            if (value == NULL) jbufAppend (jbuf, "\xf6", 1);
+            else jbufBinString (jbuf, value);
+            break;
+        case AJG_FORMAT_MSGPACK:
+            if (value == NULL) jbufAppend (jbuf, "\xc0", 1);
+            else jbufBinString (jbuf, value);
+            break;
+        default:
+            if (value == NULL) jbufAppend (jbuf, "null", 4);
+            else jbufEscape (jbuf, value);
+    }
+}
+
+PUBLIC void jbufInt (AJG_jbuf *jbuf, long long value) {
+    char number [24];
+    int len;
+
+    jbufMember (jbuf);
+    switch (jbuf->format) {
+        case AJG_FORMAT_CBOR:  // negative integers carry -1 - value
+            if (value >= 0) jbufCborHead (jbuf, 0, value);
+            else jbufCborHead (jbuf, 1, -(value + 1));
+            break;
+        case AJG_FORMAT_MSGPACK:  // smallest of fixint, uint8..64, int8..64
+            if (value >= 0) {
+                if (value < 128)              jbufPackHead (jbuf, value, 0, 0);
+                else if (value <= 0xff)       jbufPackHead (jbuf, 0xcc, value, 1);
+                else if (value <= 0xffff)     jbufPackHead (jbuf, 0xcd, value, 2);
+                else if (value <= 0xffffffff) jbufPackHead (jbuf, 0xce, value, 4);
+                else jbufPackHead (jbuf, 0xcf, value, 8);
+            } else {
+                if (value >= -32)             jbufPackHead (jbuf, value & 0xff, 0, 0);
+                else if (value >= INT8_MIN)   jbufPackHead (jbuf, 0xd0, value, 1);
+                else if (value >= INT16_MIN)  jbufPackHead (jbuf, 0xd1, value, 2);
+                else if (value >= INT32_MIN)  jbufPackHead (jbuf, 0xd2, value, 4);
+                else jbufPackHead (jbuf, 0xd3, value, 8);
+            }
+            break;
+        default:
+            len = snprintf (number, sizeof (number), "%lld", value);
+            jbufAppend (jbuf, number, len);
+    }
+}
+
+PUBLIC void jbufBool (AJG_jbuf *jbuf, int value) {
+    jbufMember (jbuf);
+    switch (jbuf->format) {
+        case AJG_FORMAT_CBOR:    jbufAppend (jbuf, value ? "\xf5" : "\xf4", 1); break;
+        case AJG_FORMAT_MSGPACK: jbufAppend (jbuf, value ? "\xc3" : "\xc2", 1); break;
+        default:
+            if (value) jbufAppend (jbuf, "true", 4);
+            else jbufAppend (jbuf, "false", 5);
+    }
+}
+
+// json text already serialized with the same layout, binary formats have to parse it back
+PUBLIC void jbufRaw (AJG_jbuf *jbuf, const char *text) {
+    json_object *jsonObj;
+
+    if (jbuf->format != AJG_FORMAT_JSON) {
+        jsonObj = json_tokener_parse (text);
+        jbufTree (jbuf, jsonObj);
+        if (jsonObj) json_object_put (jsonObj);
+        return;
+    }
+    jbufMember (jbuf);
+    jbufAppend (jbuf, text, strlen (text));
+}
+
+// embed a json-c tree [fake responses, session info, ...]
+PUBLIC void jbufJson (AJG_jbuf *jbuf, json_object *jsonObj) {
+    if (jbuf->format != AJG_FORMAT_JSON) jbufTree (jbuf, jsonObj);
+    else if (jsonObj == NULL) jbufRaw (jbuf, "null");
+    else jbufRaw (jbuf, json_object_to_json_string_ext (jsonObj, jbuf->plain ? JSON_C_TO_STRING_PLAIN : JSON_C_TO_STRING_SPACED));
+}
+
+// serialize a value once in every format [control metadata built at card load]
+PUBLIC void jbufPrebuild (AJG_prebuilt *prebuilt, json_object *jsonObj) {
+    AJG_jbuf jbuf;
+    int format;
+
+    for (format=0; format < AJG_FORMATS; format++) {
+        jbufInit (&jbuf, FALSE);
+        jbuf.format = format;
+        jbufJson (&jbuf, jsonObj);
+        prebuilt->formats[format] = jbufDetach (&jbuf);
+        jbufFree (&jbuf);
+    }
+}
+
+PUBLIC void jbufPrebuiltFree (AJG_prebuilt *prebuilt) {
+    int format;
+
+    for (format=0; format < AJG_FORMATS; format++) {
+        jbufRelease (prebuilt->formats[format]);
+        prebuilt->formats[format] = NULL;
+    }
+}
+
+// copy prebuilt value in buffer format
+PUBLIC void jbufPrebuilt (AJG_jbuf *jbuf, const AJG_prebuilt *prebuilt) {
+    const AJG_rbuf *block = prebuilt->formats[jbuf->format];
+
+    if (block == NULL) {
+        jbuf->failed = TRUE;
+        return;
+    }
+    jbufMember (jbuf);
+    jbufAppend (jbuf, block->data, block->len);
+}
+
+// rebuild a json-c tree for internal consumers [batch, session store]
+PUBLIC json_object *jbufParse (AJG_jbuf *jbuf) {
+    if (jbuf->failed || jbuf->len == 0 || jbuf->format != AJG_FORMAT_JSON) return NULL;
+    return json_tokener_parse (jbuf->data);
+}
+
+// response format from Accept header, best quality among json, cbor and msgpack [json by default]
+PUBLIC int jbufAccept (const char *header) {
+    const char *token;
+    float best = 0;
+    int format = AJG_FORMAT_JSON;
+
+    if (header == NULL) return AJG_FORMAT_JSON;
+
+    for (token = header; *token; ) {
+        const char *params;
+        size_t len;
+        float quality = 1;
+        int found = -1;
+
+        while (*token == ' ' || *token == '\t' || *token == ',') token++;
+        if (*token == '\0') break;
+
+        len = strcspn (token, " \t;,");
+        if (len == 16 && !strncasecmp (token, "application/json", len)) found = AJG_FORMAT_JSON;
+        else if (len == 16 && !strncasecmp (token, "application/cbor", len)) found = AJG_FORMAT_CBOR;
+        else if (len == 19 && !strncasecmp (token, "application/msgpack", len)) found = AJG_FORMAT_MSGPACK;
+        else if (len == 21 && !strncasecmp (token, "application/x-msgpack", len)) found = AJG_FORMAT_MSGPACK;
+
+        params = token + len;
+        while (*params && *params != ',') {
+            if ((params[0] == 'q' || params[0] == 'Q') && params[1] == '=') sscanf (&params[2], "%f", &quality);
+            params++;
+        }
+        token = params;
+
+        // first listed wins on equal quality
+        if (found >= 0 && quality > best) {
+            best = quality;
+            format = found;
+        }
+    }
+    return format;
+}
+
+PUBLIC const char *jbufMime (int format) {
+    if (format < 0 || format >= AJG_FORMATS) return NULL;
+    return jbufMimes[format];
+}
+
+PUBLIC const char *jbufFormatName (int format) {
+    if (format < 0 || format >= AJG_FORMATS) return NULL;
+    return jbufNames[format];
+}
@@ -44,6 +44,16 @@
  #define SET_CONFIG_FILE    117
  #define SET_CONFIG_SAVE    118
  #define SET_CONFIG_EXIT    119
+ #define SET_POOL_IDLE      122
+ #define SET_VOLAT_REFRESH  123
+ #define SET_WORKERS        124
+ #define SET_MAX_POST       125
+ #define SET_COMPRESS       126
+ #define SET_ASSET_CACHE    127
+ #define SET_MAX_CLIENTS    128
+ #define SET_MAX_PER_IP     129
+ #define SET_CONN_MEMORY    130
+ #define SET_FAKE_FAULTS    133
 
  #define SET_LOCAL_ONLY     120
  #define CHECK_ALSA_CARDS   121
@@ -66,6 +76,15 @@ static  AJG_options cliOptions [] = {
   {SET_TCP_PORT     ,1,"port"            , "HTTP listening TCP port  [default 1234]"},
   {SET_ROOT_DIR     ,1,"rootdir"         , "HTTP Root Directory [default $HOME/.ajg"},
   {SET_CACHE_TO     ,1,"cache-eol"       , "Client cache end of live [default 3600s]"},
+  {SET_POOL_IDLE    ,1,"pool-idle"       , "Close sndcard handles idle for more than xxx seconds [default 300s]"},
+  {SET_VOLAT_REFRESH,1,"volatile-refresh", "Cache volatile controls for xxx ms [default 0=read live]"},
+  {SET_WORKERS      ,1,"workers"         , "Number of httpd worker threads [default 1]"},
+  {SET_MAX_POST     ,1,"max-post"        , "Max POST data size in bytes [default 65536]"},
+  {SET_COMPRESS     ,1,"compress"        , "Zlib level 1-9 of gzip/deflate json responses [default 6, -1=off]"},
+  {SET_ASSET_CACHE  ,1,"asset-cache"     , "Keep static files in memory up to xxx KB [default 4096, -1=off]"},
+  {SET_MAX_CLIENTS  ,1,"max-clients"     , "Answer 503 over xxx simultaneous connections [default 256, -1=no limit]"},
+  {SET_MAX_PER_IP   ,1,"max-per-ip"      , "Answer 503 over xxx connections from one client [default 32, -1=no limit]"},
+  {SET_CONN_MEMORY  ,1,"conn-memory"     , "Memory of one http connection in KB [default 32]"},
   {SET_cardid       ,1,"setuid"          , "Change user id [default don't change]"},
   {SET_PID_FILE     ,1,"pidfile"         , "PID file path [default none]"},
   {SET_SESSION_DIR  ,1,"sessiondir"      , "Sessions file path [default rootdir/sessions]"},
@@ -73,9 +92,10 @@ static  AJG_options cliOptions [] = {
   {SET_CONFIG_SAVE  ,0,"save"            , "Save config on disk [default no]"},
   {SET_CONFIG_EXIT  ,0,"saveonly"        , "Save config on disk and then exit"},
 
-  //  {SET_LOCAL_ONLY   ,0,"localhost"       , "Restric client to localhost"},
+  {SET_LOCAL_ONLY   ,0,"localhost"       , "Restric client to localhost"},
   {CHECK_ALSA_CARDS ,0,"checkalsa"       , "List Alsa Sound Card"},
   {SET_FAKE_MOD     ,0,"fakemod"         , "Fake mode accept/respond request without touching sndcard"},
+  {SET_FAKE_FAULTS  ,1,"fake-faults"     , "Fake mode latency and errors of simulated cards [read=2-20,write-errors=1,removal=0.1 ...]"},
 
   {DISPLAY_VERSION  ,0,"version"         , "Display version and copyright"},
   {DISPLAY_HELP     ,0,"help"            , "Display this help"},
@@ -213,6 +233,7 @@ static int readPidFile (AJG_config *config) {
  +--------------------------------------------------------- */
 static void closeSession (AJG_session *session) {
 
+  poolCloseAll (session);  // release sndcard handles
 
 }
 
@@ -232,6 +253,13 @@ static void listenLoop (AJG_session *session) {
   // ------ Start httpd server
   if (session->config->httpdPort > 0) {
 
+        // main loop watches httpd sockets, sndcard events and housekeeping timers
+        if (eventInit (session) != AJG_SUCCESS) return;
+        poolStartTimer (session);
+        poolStartHotplug (session);
+        assetStart (session);
+        fakeStart (session);
+
         err = httpdStart (session);
         if (err != AJG_SUCCESS) return;
 
@@ -286,6 +314,7 @@ static AJG_ERROR probeAlsa (AJG_session *session) {
          fprintf (stderr, " + %-2d cardid=%-5s name:%-25s [%s]\n", index, cardid, name, info);
       }
       fprintf (stderr,"---- Check Alsa Done ------");
+      poolReleaseCard (session, request.cardslot);
 
   return AJG_SUCCESS;
 }
@@ -366,6 +395,56 @@ int main(int argc, char *argv[])  {
        if (!sscanf (optarg, "%d", &cliconfig.cacheTimeout)) goto notAnInteger;
        break;
 
+    case  SET_POOL_IDLE:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.poolIdle)) goto notAnInteger;
+       break;
+
+    case  SET_VOLAT_REFRESH:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.volatileRefresh)) goto notAnInteger;
+       break;
+
+    case  SET_WORKERS:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.workers)) goto notAnInteger;
+       break;
+
+    case  SET_MAX_POST:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.maxPost)) goto notAnInteger;
+       break;
+
+    case  SET_COMPRESS:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.compressLevel)) goto notAnInteger;
+       break;
+
+    case  SET_ASSET_CACHE:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.assetCache)) goto notAnInteger;
+       break;
+
+    case  SET_MAX_CLIENTS:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.maxClients)) goto notAnInteger;
+       break;
+
+    case  SET_MAX_PER_IP:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.maxPerIp)) goto notAnInteger;
+       break;
+
+    case  SET_CONN_MEMORY:
+       if (optarg == 0) goto needValueForOption;
+       if (!sscanf (optarg, "%d", &cliconfig.connMemory)) goto notAnInteger;
+       break;
+
+    case SET_LOCAL_ONLY:
+       if (optarg != 0) goto noValueForOption;
+       cliconfig.localhostOnly = 1;
+       break;
+
     case SET_CONFIG_EXIT:
        if (optarg != 0) goto noValueForOption;
        session->configsave  = 1;
@@ -387,6 +466,11 @@ int main(int argc, char *argv[])  {
        session->fakemod  = 1;
        break;
 
+    case SET_FAKE_FAULTS:
+       if (optarg == 0) goto needValueForOption;
+       cliconfig.fakeFaults = optarg;
+       break;
+
     case SET_FORGROUND:
        if (optarg != 0) goto noValueForOption;
        session->foreground  = 1;
@@ -436,6 +520,11 @@ int main(int argc, char *argv[])  {
      exit (-1);
   }
 
+  if (session->fakemod && !simulSetFaults (session, session->config->fakeFaults)) {
+    fprintf (stderr, "%s ERR: invalid --fake-faults [%s]\n",configTime(), session->config->fakeFaults);
+     exit (-1);
+  }
+
   // ------------------ Some useful default values -------------------------
   if  ((session->background == 0) && (session->foreground == 0)) session->foreground=1;
 
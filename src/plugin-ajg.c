@@ -0,0 +1,529 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    alsa-lib external control plugin [libasound_module_ctl_ajg.so] showing a
+    virtual sndcard described by a CTRL_GET_ALL sample. Unlike --fakemod the
+    daemon runs its real alsa code on it [hctl, element info and values, TLV
+    decode, ascii value parse, events], without any sound hardware.
+
+      ctl.ajg18i8 {
+          type ajg
+          sample "/usr/local/var/www/fakemod/CTRL_GET_ALL-hw:18i8.ajg"
+      }
+
+      ajg-daemon --rootdir=... ; curl 'localhost:1234/jsonapi?request=ctrl-get-all&cardid=ajg18i8'
+
+    Elements are listed in numid order, ctl_ext numbers them from their
+    position, samples hold numids 1..n so sample numids are kept. BOOLEAN,
+    INTEGER and ENUMERATED controls are supported, dbscale, dblinear,
+    dbminmax and chmap TLV are encoded back from their json form. Values live
+    within the opened handle and start from sample at each open, a changed
+    value is sent as an event to the handle subscribed to them.
+
+   References:
+   https://www.alsa-project.org/alsa-doc/alsa-lib/ctl_external_plugins.html
+   https://www.alsa-project.org/alsa-doc/alsa-lib/group___ctl___plugin___s_d_k.html
+*/
+
+#include "local-def-ajg.h"
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+#include <alsa/control_external.h>
+
+#define AJG_PLUGIN_TLV 64   // max TLV words of one element
+
+typedef struct {
+  char   *name;
+  snd_ctl_elem_iface_t iface;
+  int     type;            // SND_CTL_ELEM_TYPE_xxx
+  unsigned int access;     // SND_CTL_EXT_ACCESS_xxx
+  unsigned int count;
+  long    min, max, step;
+  char  **enums;
+  unsigned int items;
+  long   *values;
+  unsigned int *tlv;       // encoded TLV, NULL when none
+  int     changed;         // waiting within event queue
+} AJG_plugelem;
+
+typedef struct {
+  snd_ctl_ext_t ext;
+  AJG_plugelem *elems;     // by numid - 1, NULL name for numids missing from sample
+  int     count;
+  int    *events;          // changed element offsets, fifo
+  int     head;
+  int     tail;
+} AJG_plugin;
+
+STATIC const char *pluginIfaces [] = {"CARD", "HWDEP", "MIXER", "PCM", "RAWMIDI", "TIMER", "SEQUENCER", NULL};
+
+STATIC snd_ctl_elem_iface_t pluginIface (const char *iface) {
+    int idx;
+
+    for (idx=0; pluginIfaces[idx] != NULL; idx++) {
+        if (!strcmp (iface, pluginIfaces[idx])) return (snd_ctl_elem_iface_t) idx;
+    }
+    return SND_CTL_ELEM_IFACE_MIXER;
+}
+
+STATIC const char *pluginString (json_object *objJ, const char *key) {
+    json_object *valueJ;
+
+    if (!json_object_object_get_ex (objJ, key, &valueJ)) return "";
+    return json_object_get_string (valueJ);
+}
+
+// "-128.00dB" as 0.01dB units, like decodeTlv prints them
+STATIC unsigned int pluginDb (json_object *objJ, const char *key) {
+    double db = 0;
+
+    sscanf (pluginString (objJ, key), "%lf", &db);
+    return (unsigned int) (int) (db < 0 ? db * 100 - 0.5 : db * 100 + 0.5);
+}
+
+// encode one decoded TLV back in tlv [type, size, data], returns words written or 0 when unsupported
+STATIC unsigned int pluginTlv (json_object *tlvJ, unsigned int *tlv, unsigned int space) {
+    json_object *valueJ, *chmapJ;
+    unsigned int idx, len, used;
+
+    if (space < 4) return 0;
+
+    if (json_object_object_get_ex (tlvJ, "container", &valueJ)) {
+        used = 2;
+        for (idx=0; idx < json_object_array_length (valueJ); idx++) {
+            if ((len = pluginTlv (json_object_array_get_idx (valueJ, idx), &tlv[used], space - used)) == 0) return 0;
+            used += len;
+        }
+        tlv[0] = SND_CTL_TLVT_CONTAINER;
+        tlv[1] = (used - 2) * sizeof (unsigned int);
+        return used;
+    }
+
+    if (json_object_object_get_ex (tlvJ, "dbscale", &valueJ)) {
+        tlv[0] = SND_CTL_TLVT_DB_SCALE;
+        tlv[2] = pluginDb (valueJ, "min");
+        tlv[3] = (pluginDb (valueJ, "step") & 0xffff) | (pluginDb (valueJ, "mute") ? 0x10000 : 0);
+    } else if (json_object_object_get_ex (tlvJ, "dblinear", &valueJ)) {
+        tlv[0] = SND_CTL_TLVT_DB_LINEAR;
+        tlv[2] = pluginDb (valueJ, "min");
+        tlv[3] = pluginDb (valueJ, "max");
+    } else if (json_object_object_get_ex (tlvJ, "dbminmax", &valueJ) || json_object_object_get_ex (tlvJ, "dbminmaxmute", &valueJ)) {
+        tlv[0] = json_object_object_get_ex (tlvJ, "dbminmax", NULL) ? SND_CTL_TLVT_DB_MINMAX : SND_CTL_TLVT_DB_MINMAX_MUTE;
+        tlv[2] = pluginDb (valueJ, "min");
+        tlv[3] = pluginDb (valueJ, "max");
+    } else if (json_object_object_get_ex (tlvJ, "chmap", &chmapJ)) {
+        if (json_object_object_get_ex (chmapJ, "fixed", &valueJ)) tlv[0] = SND_CTL_TLVT_CHMAP_FIXED;
+        else if (json_object_object_get_ex (chmapJ, "variable", &valueJ)) tlv[0] = SND_CTL_TLVT_CHMAP_VAR;
+        else if (json_object_object_get_ex (chmapJ, "paired", &valueJ)) tlv[0] = SND_CTL_TLVT_CHMAP_PAIRED;
+        else return 0;
+
+        len = json_object_array_length (valueJ);
+        if (len + 2 > space) return 0;
+        for (idx=0; idx < len; idx++) {
+            int pos = snd_pcm_chmap_from_string (json_object_get_string (json_object_array_get_idx (valueJ, idx)));
+            tlv[2 + idx] = pos < 0 ? SND_CHMAP_UNKNOWN : (unsigned int) pos;
+        }
+        tlv[1] = len * sizeof (unsigned int);
+        return len + 2;
+    } else {
+        return 0;
+    }
+    tlv[1] = 2 * sizeof (unsigned int);
+    return 4;
+}
+
+// one sample control at its numid position, FALSE when its type cannot be shown
+STATIC int pluginLoadElem (AJG_plugelem *elem, json_object *ctrlJ) {
+    json_object *classJ = NULL, *aclJ = NULL, *valueJ, *enumsJ, *tlvJ, *flagJ;
+    unsigned int tlv [AJG_PLUGIN_TLV], idx, len;
+    const char *type;
+
+    json_object_object_get_ex (ctrlJ, "ctrl", &classJ);
+    json_object_object_get_ex (ctrlJ, "acl", &aclJ);
+    type = pluginString (classJ, "type");
+
+    elem->count = json_object_object_get_ex (classJ, "count", &valueJ) ? json_object_get_int (valueJ) : 1;
+    if (elem->count < 1 || elem->count > 128) return FALSE;
+
+    if (!strcmp (type, "BOOLEAN")) {
+        elem->type = SND_CTL_ELEM_TYPE_BOOLEAN;
+        elem->max  = 1;
+        elem->step = 1;
+    } else if (!strcmp (type, "INTEGER")) {
+        elem->type = SND_CTL_ELEM_TYPE_INTEGER;
+        if (json_object_object_get_ex (classJ, "min", &valueJ)) elem->min = json_object_get_int64 (valueJ);
+        if (json_object_object_get_ex (classJ, "max", &valueJ)) elem->max = json_object_get_int64 (valueJ);
+        if (json_object_object_get_ex (classJ, "step", &valueJ)) elem->step = json_object_get_int64 (valueJ);
+    } else if (!strcmp (type, "ENUMERATED") && json_object_object_get_ex (classJ, "enums", &enumsJ)) {
+        elem->type  = SND_CTL_ELEM_TYPE_ENUMERATED;
+        elem->items = json_object_array_length (enumsJ);
+        elem->enums = calloc (elem->items, sizeof (char*));
+        for (idx=0; idx < elem->items; idx++) elem->enums[idx] = strdup (json_object_get_string (json_object_array_get_idx (enumsJ, idx)));
+        elem->max = elem->items - 1;
+    } else {
+        return FALSE;
+    }
+
+    elem->name  = strdup (pluginString (ctrlJ, "name"));
+    elem->iface = pluginIface (pluginString (ctrlJ, "iface"));
+
+    if (!json_object_object_get_ex (aclJ, "read", &flagJ) || json_object_get_boolean (flagJ)) elem->access |= SND_CTL_EXT_ACCESS_READ;
+    if (json_object_object_get_ex (aclJ, "write", &flagJ) && json_object_get_boolean (flagJ)) elem->access |= SND_CTL_EXT_ACCESS_WRITE;
+    if (json_object_object_get_ex (aclJ, "volat", &flagJ) && json_object_get_boolean (flagJ)) elem->access |= SND_CTL_EXT_ACCESS_VOLATILE;
+    if (json_object_object_get_ex (ctrlJ, "actif", &flagJ) && !json_object_get_boolean (flagJ)) elem->access |= SND_CTL_EXT_ACCESS_INACTIVE;
+
+    // decoded TLV is kept encoded, read through ext tlv callback
+    if (json_object_object_get_ex (ctrlJ, "tlv", &tlvJ) && (len = pluginTlv (tlvJ, tlv, AJG_PLUGIN_TLV)) > 0) {
+        elem->tlv = malloc (len * sizeof (unsigned int));
+        memcpy (elem->tlv, tlv, len * sizeof (unsigned int));
+        elem->access |= SND_CTL_EXT_ACCESS_TLV_READ | SND_CTL_EXT_ACCESS_TLV_CALLBACK;
+    }
+
+    elem->values = calloc (elem->count, sizeof (long));
+    if (json_object_object_get_ex (ctrlJ, "value", &valueJ)) {
+        for (idx=0; idx < elem->count && idx < json_object_array_length (valueJ); idx++) {
+            elem->values[idx] = json_object_get_int64 (json_object_array_get_idx (valueJ, idx));
+        }
+    }
+    return TRUE;
+}
+
+STATIC void pluginFree (AJG_plugin *plugin) {
+    int idx;
+    unsigned int item;
+
+    for (idx=0; idx < plugin->count; idx++) {
+        AJG_plugelem *elem = &plugin->elems[idx];
+
+        for (item=0; item < elem->items; item++) free (elem->enums[item]);
+        free (elem->enums);
+        free (elem->name);
+        free (elem->values);
+        free (elem->tlv);
+    }
+    if (plugin->ext.poll_fd >= 0) close (plugin->ext.poll_fd);
+    free (plugin->elems);
+    free (plugin->events);
+    free (plugin);
+}
+
+// sample sndcard becomes card info, controls go at numid - 1
+STATIC int pluginLoad (AJG_plugin *plugin, const char *sample) {
+    json_object *sampleJ, *sndcardJ, *dataJ, *valueJ;
+    int idx, count, numid;
+
+    if ((sampleJ = json_object_from_file (sample)) == NULL) {
+        SNDERR ("ajg: cannot read sample %s", sample);
+        return -ENOENT;
+    }
+    if (!json_object_object_get_ex (sampleJ, "sndcard", &sndcardJ) || !json_object_object_get_ex (sampleJ, "data", &dataJ)) {
+        SNDERR ("ajg: sample %s has no sndcard or data", sample);
+        json_object_put (sampleJ);
+        return -EINVAL;
+    }
+
+    snprintf (plugin->ext.id, sizeof (plugin->ext.id), "%s", pluginString (sndcardJ, "cardid"));
+    snprintf (plugin->ext.driver, sizeof (plugin->ext.driver), "%s", pluginString (sndcardJ, "driver"));
+    snprintf (plugin->ext.name, sizeof (plugin->ext.name), "%s", pluginString (sndcardJ, "name"));
+    snprintf (plugin->ext.longname, sizeof (plugin->ext.longname), "%s", pluginString (sndcardJ, "info"));
+    snprintf (plugin->ext.mixername, sizeof (plugin->ext.mixername), "%s", pluginString (sndcardJ, "name"));
+
+    count = json_object_array_length (dataJ);
+    for (idx=0; idx < count; idx++) {
+        if (!json_object_object_get_ex (json_object_array_get_idx (dataJ, idx), "numid", &valueJ)) continue;
+        if ((numid = json_object_get_int (valueJ)) > plugin->count && numid <= 65536) plugin->count = numid;
+    }
+    plugin->elems  = calloc (plugin->count + 1, sizeof (AJG_plugelem));
+    plugin->events = calloc (plugin->count + 1, sizeof (int));
+
+    for (idx=0; idx < count; idx++) {
+        json_object *ctrlJ = json_object_array_get_idx (dataJ, idx);
+
+        if (!json_object_object_get_ex (ctrlJ, "numid", &valueJ)) continue;
+        numid = json_object_get_int (valueJ);
+        if (numid < 1 || numid > plugin->count || plugin->elems[numid-1].name) continue;
+        if (!pluginLoadElem (&plugin->elems[numid-1], ctrlJ)) SNDERR ("ajg: numid=%d unsupported control type ignored", numid);
+    }
+    json_object_put (sampleJ);
+    return 0;
+}
+
+STATIC void pluginCloseCB (snd_ctl_ext_t *ext) {
+    pluginFree (ext->private_data);
+}
+
+STATIC int pluginCountCB (snd_ctl_ext_t *ext) {
+    AJG_plugin *plugin = ext->private_data;
+    return plugin->count;
+}
+
+// numids missing from sample are shown as inactive read only placeholders, ctl_ext needs a continuous list
+STATIC int pluginListCB (snd_ctl_ext_t *ext, unsigned int offset, snd_ctl_elem_id_t *id) {
+    AJG_plugin *plugin = ext->private_data;
+    char name [44];
+
+    if (offset >= (unsigned int) plugin->count) return -EINVAL;
+    if (plugin->elems[offset].name == NULL) {
+        snprintf (name, sizeof (name), "AJG Missing %u", offset + 1);
+        snd_ctl_elem_id_set_interface (id, SND_CTL_ELEM_IFACE_CARD);
+        snd_ctl_elem_id_set_name (id, name);
+        return 0;
+    }
+    snd_ctl_elem_id_set_interface (id, plugin->elems[offset].iface);
+    snd_ctl_elem_id_set_name (id, plugin->elems[offset].name);
+    return 0;
+}
+
+STATIC snd_ctl_ext_key_t pluginFindCB (snd_ctl_ext_t *ext, const snd_ctl_elem_id_t *id) {
+    AJG_plugin *plugin = ext->private_data;
+    const char *name = snd_ctl_elem_id_get_name (id);
+    unsigned int numid = snd_ctl_elem_id_get_numid (id);
+    int idx;
+
+    if (numid > 0 && numid <= (unsigned int) plugin->count) return numid - 1;
+
+    for (idx=0; idx < plugin->count; idx++) {
+        AJG_plugelem *elem = &plugin->elems[idx];
+
+        if (elem->name && elem->iface == snd_ctl_elem_id_get_interface (id) && !strcmp (elem->name, name)) return idx;
+    }
+    return SND_CTL_EXT_KEY_NOT_FOUND;
+}
+
+STATIC int pluginAttributeCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, int *type, unsigned int *acc, unsigned int *count) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+
+    if (elem->name == NULL) {
+        *type  = SND_CTL_ELEM_TYPE_BOOLEAN;
+        *acc   = SND_CTL_EXT_ACCESS_READ | SND_CTL_EXT_ACCESS_INACTIVE;
+        *count = 1;
+        return 0;
+    }
+    *type  = elem->type;
+    *acc   = elem->access;
+    *count = elem->count;
+    return 0;
+}
+
+STATIC int pluginIntegerInfoCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, long *imin, long *imax, long *istep) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+
+    *imin  = elem->min;
+    *imax  = elem->name ? elem->max : 1;
+    *istep = elem->step;
+    return 0;
+}
+
+STATIC int pluginEnumInfoCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, unsigned int *items) {
+    AJG_plugin *plugin = ext->private_data;
+
+    *items = plugin->elems[key].items;
+    return 0;
+}
+
+STATIC int pluginEnumNameCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, unsigned int item, char *name, size_t name_max_len) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+
+    if (item >= elem->items) return -EINVAL;
+    snprintf (name, name_max_len, "%s", elem->enums[item]);
+    return 0;
+}
+
+STATIC int pluginReadIntegerCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, long *value) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+
+    if (elem->name == NULL) { value[0] = 0; return 0; }
+    memcpy (value, elem->values, elem->count * sizeof (long));
+    return 0;
+}
+
+STATIC int pluginReadEnumCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, unsigned int *items) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+    unsigned int idx;
+
+    for (idx=0; idx < elem->count; idx++) items[idx] = (unsigned int) elem->values[idx];
+    return 0;
+}
+
+// queue a value event for subscribed handle
+STATIC void pluginNotify (AJG_plugin *plugin, snd_ctl_ext_key_t key) {
+    uint64_t one = 1;
+
+    if (!plugin->ext.subscribed || plugin->elems[key].changed) return;
+    plugin->elems[key].changed = TRUE;
+    plugin->events[plugin->tail] = (int) key;
+    plugin->tail = (plugin->tail + 1) % (plugin->count + 1);
+    if (write (plugin->ext.poll_fd, &one, sizeof (one)) < 0 && errno != EAGAIN) SNDERR ("ajg: event write %s", strerror (errno));
+}
+
+// values out of range are refused as most drivers do, returns 1 when value changed
+STATIC int pluginWrite (AJG_plugin *plugin, snd_ctl_ext_key_t key, const long *values) {
+    AJG_plugelem *elem = &plugin->elems[key];
+    unsigned int idx;
+
+    if (elem->name == NULL || !(elem->access & SND_CTL_EXT_ACCESS_WRITE)) return -EPERM;
+    for (idx=0; idx < elem->count; idx++) {
+        if (values[idx] < elem->min || values[idx] > elem->max) return -EINVAL;
+    }
+    if (!memcmp (elem->values, values, elem->count * sizeof (long))) return 0;
+
+    memcpy (elem->values, values, elem->count * sizeof (long));
+    pluginNotify (plugin, key);
+    return 1;
+}
+
+STATIC int pluginWriteIntegerCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, long *value) {
+    return pluginWrite (ext->private_data, key, value);
+}
+
+STATIC int pluginWriteEnumCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, unsigned int *items) {
+    long values [128];
+    unsigned int idx;
+    AJG_plugin *plugin = ext->private_data;
+
+    for (idx=0; idx < plugin->elems[key].count; idx++) values[idx] = items[idx];
+    return pluginWrite (plugin, key, values);
+}
+
+STATIC void pluginSubscribeCB (snd_ctl_ext_t *ext, int subscribe) {
+    AJG_plugin *plugin = ext->private_data;
+
+    ext->subscribed = subscribe;
+    if (subscribe) return;
+
+    // unsubscribed handle forgets pending events
+    while (plugin->head != plugin->tail) {
+        plugin->elems[plugin->events[plugin->head]].changed = FALSE;
+        plugin->head = (plugin->head + 1) % (plugin->count + 1);
+    }
+}
+
+// one pending event per call, -EAGAIN once queue is empty
+STATIC int pluginReadEventCB (snd_ctl_ext_t *ext, snd_ctl_elem_id_t *id, unsigned int *event_mask) {
+    AJG_plugin *plugin = ext->private_data;
+    uint64_t count;
+    int key;
+
+    if (plugin->head == plugin->tail) {
+        if (read (ext->poll_fd, &count, sizeof (count)) < 0 && errno != EAGAIN) return -errno;
+        return -EAGAIN;
+    }
+    key = plugin->events[plugin->head];
+    plugin->head = (plugin->head + 1) % (plugin->count + 1);
+    plugin->elems[key].changed = FALSE;
+
+    snd_ctl_elem_id_clear (id);
+    pluginListCB (ext, key, id);
+    snd_ctl_elem_id_set_numid (id, key + 1);
+    *event_mask = SND_CTL_EVENT_MASK_VALUE;
+    return 1;
+}
+
+// TLV is read only, written TLV are refused
+STATIC int pluginTlvCB (snd_ctl_ext_t *ext, snd_ctl_ext_key_t key, int op_flag, unsigned int numid, unsigned int *tlv, unsigned int tlv_size) {
+    AJG_plugin *plugin = ext->private_data;
+    AJG_plugelem *elem = &plugin->elems[key];
+    unsigned int len;
+
+    if (op_flag != 0) return -ENXIO;
+    if (elem->tlv == NULL) return -ENXIO;
+
+    len = elem->tlv[1] + 2 * sizeof (unsigned int);
+    if (len > tlv_size) return -ENOMEM;
+    memcpy (tlv, elem->tlv, len);
+    return 0;
+}
+
+STATIC const snd_ctl_ext_callback_t pluginCallbacks = {
+    .close               = pluginCloseCB,
+    .elem_count          = pluginCountCB,
+    .elem_list           = pluginListCB,
+    .find_elem           = pluginFindCB,
+    .get_attribute       = pluginAttributeCB,
+    .get_integer_info    = pluginIntegerInfoCB,
+    .get_enumerated_info = pluginEnumInfoCB,
+    .get_enumerated_name = pluginEnumNameCB,
+    .read_integer        = pluginReadIntegerCB,
+    .read_enumerated     = pluginReadEnumCB,
+    .write_integer       = pluginWriteIntegerCB,
+    .write_enumerated    = pluginWriteEnumCB,
+    .subscribe_events    = pluginSubscribeCB,
+    .read_event          = pluginReadEventCB,
+};
+
+// ctl.xxx { type ajg; sample "/path/CTRL_GET_ALL-hw:18i8.ajg" }
+SND_CTL_PLUGIN_DEFINE_FUNC (ajg) {
+    snd_config_iterator_t iter, next;
+    const char *sample = NULL;
+    AJG_plugin *plugin;
+    int err;
+
+    snd_config_for_each (iter, next, conf) {
+        snd_config_t *node = snd_config_iterator_entry (iter);
+        const char *id;
+
+        if (snd_config_get_id (node, &id) < 0) continue;
+        if (!strcmp (id, "comment") || !strcmp (id, "type") || !strcmp (id, "hint")) continue;
+        if (!strcmp (id, "sample")) {
+            if (snd_config_get_string (node, &sample) < 0) {
+                SNDERR ("ajg: sample should be a file path");
+                return -EINVAL;
+            }
+            continue;
+        }
+        SNDERR ("ajg: unknown field %s", id);
+        return -EINVAL;
+    }
+    if (sample == NULL) {
+        SNDERR ("ajg: no sample file [sample \"/path/CTRL_GET_ALL-xxx.ajg\"]");
+        return -EINVAL;
+    }
+
+    if ((plugin = calloc (1, sizeof (AJG_plugin))) == NULL) return -ENOMEM;
+    plugin->ext.poll_fd = -1;
+
+    if ((err = pluginLoad (plugin, sample)) < 0) goto OnErrorExit;
+    if ((plugin->ext.poll_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        err = -errno;
+        goto OnErrorExit;
+    }
+
+    plugin->ext.version = SND_CTL_EXT_VERSION;
+    plugin->ext.card_idx = 0;
+    plugin->ext.callback = &pluginCallbacks;
+    plugin->ext.private_data = plugin;
+    plugin->ext.tlv.c = pluginTlvCB;
+
+    if ((err = snd_ctl_ext_create (&plugin->ext, name, mode)) < 0) goto OnErrorExit;
+
+    *handlep = plugin->ext.handle;
+    return 0;
+
+OnErrorExit:
+    pluginFree (plugin);
+    return err;
+}
+
+SND_CTL_PLUGIN_SYMBOL (ajg);
@@ -0,0 +1,473 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Keep sndcard handles open across requests. Opening a card and loading its
+    hctl element list costs a full round-trip to the kernel for every control,
+    on an 18i20 this is hundreds of elements for every UI poll.
+
+    - ctl handle is opened at first probe, hctl element list is only loaded when
+      a request needs to walk controls.
+    - handles unused for more than config->poolIdle seconds are closed.
+    - any error that looks like a card removal drops the handle, next request reopens it.
+    - loaded handles run in non-blocking mode with events subscribed to feed control cache.
+    - with --workers=N requests run in parallel: each slot has its own lock, a request
+      holds it from probe until response is sent. Pool lock only protects slot table
+      and is never held while waiting for a slot or opening a card.
+    - loaded handles have their poll descriptors watched by main loop, control events
+      are consumed as they arrive instead of waiting for next request. Idle handles
+      are evicted from a main loop timer.
+    - card list generation moves with slot open, close and /dev/snd inotify events,
+      card-get-all answers a matching If-None-Match without probing any card.
+
+   References:
+   http://alsa-lib.sourcearchive.com/documentation/1.0.20/group___h_control.html
+*/
+
+#include "local-def-ajg.h"
+#include <alsa/asoundlib.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#define AJG_POOL_DEVDIR "/dev/snd"
+
+#define AJG_POOL_JTYPE "AJG_stats"
+
+// release every alsa resource attached to a slot and make it free again [pool lock held]
+STATIC void poolCloseSlot (AJG_session *session, AJG_cardslot *slot) {
+    int idx;
+
+    if (verbose) fprintf (stderr, "AJG:pool close cardid=%s\n", slot->cardid);
+    session->cardpool->cards++;
+
+    // main loop should stop watching descriptors before they get closed
+    for (idx=0; idx < slot->watchcount; idx++) eventDel (session, slot->watch[idx]);
+    slot->watchcount = 0;
+
+    // hctl owns the ctl handle it was built on [closing it removes every control from index]
+    if (slot->hctl) snd_hctl_close (slot->hctl);
+    else if (slot->ctl) snd_ctl_close (slot->ctl);
+    free (slot->index);
+    slot->index = NULL;
+    slot->indexsize = 0;
+    cacheDropResponses (slot);
+    cacheDropDicts (slot);
+
+    free (slot->cardid);
+    free (slot->id);
+    free (slot->name);
+    free (slot->driver);
+    free (slot->longname);
+
+    // lock and users belong to the slot not to the card
+    slot->cardid = slot->id = slot->name = slot->driver = slot->longname = NULL;
+    slot->ctl = slot->hctl = NULL;
+    slot->changed = NULL;
+    slot->loaded  = FALSE;
+    slot->lastused = 0;
+    slot->volatiles = 0;
+}
+
+// close a slot on behalf of its current user [slot lock held]
+STATIC void poolDropSlot (AJG_session *session, AJG_cardslot *slot) {
+    AJG_cardpool *pool = session->cardpool;
+
+    pthread_mutex_lock (&pool->lock);
+    pool->reopens++;
+    poolCloseSlot (session, slot);
+    pthread_mutex_unlock (&pool->lock);
+}
+
+// open sndcard and get its static info, runs without pool lock [a slow or hung card only blocks its caller]
+STATIC int poolOpenCard (const char *cardid, snd_ctl_t **handle, snd_ctl_card_info_t *cardinfo) {
+    int err;
+
+    if ((err = snd_ctl_open(handle, cardid, 0)) < 0) return err;
+
+    if ((err = snd_ctl_card_info(*handle, cardinfo)) < 0) {
+        snd_ctl_close(*handle);
+        return err;
+    }
+    return 0;
+}
+
+// save an opened handle and its static info within a free slot [pool lock held]
+STATIC void poolFillSlot (AJG_cardslot *slot, const char *cardid, snd_ctl_t *handle, snd_ctl_card_info_t *cardinfo) {
+
+    slot->cardid   = strdup (cardid);
+    slot->ctl      = handle;
+    slot->id       = strdup (snd_ctl_card_info_get_id(cardinfo));
+    slot->name     = strdup (snd_ctl_card_info_get_name (cardinfo));
+    slot->driver   = strdup (snd_ctl_card_info_get_driver(cardinfo));
+    slot->longname = strdup (snd_ctl_card_info_get_longname (cardinfo));
+
+    if (verbose) fprintf (stderr, "AJG:pool open cardid=%s name=%s\n", cardid, slot->name);
+}
+
+// close handles unused for more than poolIdle seconds [pool lock held]
+STATIC void poolEvictLocked (AJG_session *session) {
+    AJG_cardpool *pool = session->cardpool;
+    time_t now = time (NULL);
+    int idx;
+
+    if (session->config->poolIdle <= 0) return;
+
+    for (idx=0; idx < MAX_SNDCARDS; idx++) {
+        AJG_cardslot *slot = &pool->slots[idx];
+
+        if (slot->cardid == NULL || slot->users > 0) continue;
+        if (now - slot->lastused < session->config->poolIdle) continue;
+
+        // websocket subscribers rely on card events, keep their handle open
+        if (slot->hctl && wsockWatching (session, slot->cardid)) continue;
+
+        pool->evictions++;
+        poolCloseSlot (session, slot);
+    }
+}
+
+// alsa poll descriptor is readable, consume control events from main loop
+STATIC void poolEventCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_cardpool *pool = session->cardpool;
+    AJG_cardslot *slot = source->context;
+    int err;
+
+    // slot may have been closed by a worker since epoll returned
+    pthread_mutex_lock (&pool->lock);
+    if (source->deleted) {
+        pthread_mutex_unlock (&pool->lock);
+        return;
+    }
+    slot->users++;
+    pthread_mutex_unlock (&pool->lock);
+
+    // wait for any request currently using this card, then check it was not dropped meanwhile
+    pthread_mutex_lock (&slot->lock);
+    if (!source->deleted) {
+        // hangup means card was unplugged, drop it before epoll spins on a dead descriptor
+        if (revents & (EPOLLERR | EPOLLHUP)) err = -ENODEV;
+        else err = cacheUpdateCard (session, slot);
+        if (err < 0) poolFailCard (session, slot, err);
+    }
+    poolReleaseCard (session, slot);
+}
+
+// register hctl poll descriptors within main loop [slot lock held]
+STATIC void poolWatchSlot (AJG_session *session, AJG_cardslot *slot) {
+    struct pollfd pfds [AJG_POLL_MAX];
+    int count, idx;
+
+    if (session->epollfd < 0) return;
+
+    count = snd_hctl_poll_descriptors (slot->hctl, pfds, AJG_POLL_MAX);
+    for (idx=0; idx < count; idx++) {
+        AJG_evsource *source = eventAdd (session, pfds[idx].fd, EPOLLIN, poolEventCB, slot);
+        if (source == NULL) continue;
+
+        pthread_mutex_lock (&session->cardpool->lock);
+        slot->watch[slot->watchcount++] = source;
+        pthread_mutex_unlock (&session->cardpool->lock);
+    }
+}
+
+// main loop timer, close idle handles even when no request comes in
+STATIC void poolTimerCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    poolEvictIdle (session);
+}
+
+// allocate slots and their locks
+PUBLIC void poolInit (AJG_session *session) {
+    pthread_mutexattr_t attr;
+    int idx;
+
+    session->cardpool = malloc (sizeof (AJG_cardpool));
+    memset (session->cardpool,0, sizeof (AJG_cardpool));
+    session->cardpool->started = time (NULL);
+    session->cardpool->cards = 1;
+    session->cardpool->hotplug = -1;
+
+    pthread_mutexattr_init (&attr);
+    pthread_mutex_init (&session->cardpool->lock, &attr);
+    for (idx=0; idx < MAX_SNDCARDS; idx++) pthread_mutex_init (&session->cardpool->slots[idx].lock, &attr);
+    pthread_mutexattr_destroy (&attr);
+}
+
+// start housekeeping timer once main loop exist
+PUBLIC void poolStartTimer (AJG_session *session) {
+    int period = session->config->poolIdle * 1000 / 2;
+
+    if (session->config->poolIdle <= 0) return;
+    if (period < 1000) period = 1000;
+    eventTimer (session, period, poolTimerCB, NULL);
+}
+
+// a card device was added or removed, card list has to be probed again
+STATIC void poolHotplugCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_cardpool *pool = session->cardpool;
+    char events [4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while (read (pool->hotplug, events, sizeof (events)) > 0) {
+        pthread_mutex_lock (&pool->lock);
+        pool->cards++;
+        pthread_mutex_unlock (&pool->lock);
+    }
+}
+
+// watch sndcard devices from main loop, without it card-get-all probes every card before tagging its response
+PUBLIC void poolStartHotplug (AJG_session *session) {
+    AJG_cardpool *pool = session->cardpool;
+
+    pool->hotplug = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (pool->hotplug < 0 || inotify_add_watch (pool->hotplug, AJG_POOL_DEVDIR, IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) < 0
+        || eventAdd (session, pool->hotplug, EPOLLIN, poolHotplugCB, NULL) == NULL) {
+        if (verbose) fprintf (stderr, "AJG:pool no hotplug watch on %s error=%s\n", AJG_POOL_DEVDIR, strerror(errno));
+        if (pool->hotplug >= 0) close (pool->hotplug);
+        pool->hotplug = -1;
+    }
+}
+
+// card list generation, 0 when hotplug is not watched and card list cannot be trusted without probing
+PUBLIC unsigned long poolCardsGeneration (AJG_session *session) {
+    AJG_cardpool *pool = session->cardpool;
+    unsigned long cards;
+
+    if (pool->hotplug < 0) return 0;
+    pthread_mutex_lock (&pool->lock);
+    cards = pool->cards;
+    pthread_mutex_unlock (&pool->lock);
+    return cards;
+}
+
+// slot holding cardid, otherwise first free slot and least recently used idle unwatched one [pool lock held]
+STATIC AJG_cardslot *poolFindSlot (AJG_session *session, const char *cardid, AJG_cardslot **freeslot, AJG_cardslot **oldslot) {
+    AJG_cardpool *pool = session->cardpool;
+    AJG_cardslot *slot;
+    int idx;
+
+    *freeslot = *oldslot = NULL;
+    for (idx=0; idx < MAX_SNDCARDS; idx++) {
+        slot = &pool->slots[idx];
+
+        if (slot->cardid == NULL) {
+            if (*freeslot == NULL && slot->users == 0) *freeslot = slot;
+            continue;
+        }
+        if (!strcmp (slot->cardid, cardid)) return slot;
+
+        // as for idle eviction, cards with websocket subscribers are never recycled
+        if (slot->users > 0 || (slot->hctl && wsockWatching (session, slot->cardid))) continue;
+        if (*oldslot == NULL || slot->lastused < (*oldslot)->lastused) *oldslot = slot;
+    }
+    return NULL;
+}
+
+// return an opened and locked handle for cardid, reuse existing one when possible.
+// Accesses to one card are serialized, requests on different cards run in parallel.
+// A new card is opened without pool lock, a slot is only taken [or recycled] once open succeeded.
+// Every returned slot should be given back with poolReleaseCard.
+PUBLIC AJG_cardslot *poolGetCard (AJG_session *session, const char *cardid, int *err) {
+    AJG_cardpool *pool = session->cardpool;
+    AJG_cardslot *slot, *freeslot, *oldslot;
+    snd_ctl_card_info_t *cardinfo;
+    snd_ctl_t *handle = NULL;
+
+    *err = 0;
+    if (cardid == NULL) {
+        *err = -ENODEV;
+        return NULL;
+    }
+    snd_ctl_card_info_alloca(&cardinfo);
+
+    while (TRUE) {
+        pthread_mutex_lock (&pool->lock);
+
+        // drop handles nobody used for a while before looking for ours
+        poolEvictLocked (session);
+        slot = poolFindSlot (session, cardid, &freeslot, &oldslot);
+
+        // card already in pool, wait for previous user to release it
+        if (slot != NULL) {
+            slot->users++;
+            pool->hits++;
+            pthread_mutex_unlock (&pool->lock);
+
+            // another worker inserted this card while we were opening it
+            if (handle != NULL) snd_ctl_close (handle);
+            handle = NULL;
+
+            pthread_mutex_lock (&slot->lock);
+
+            // card may have been dropped by previous user, let's retry
+            if (slot->cardid != NULL && !strcmp (slot->cardid, cardid)) break;
+            poolReleaseCard (session, slot);
+            continue;
+        }
+
+        // open card outside of pool lock then look again, a missing card leaves pool untouched
+        if (handle == NULL) {
+            pthread_mutex_unlock (&pool->lock);
+            if ((*err = poolOpenCard (cardid, &handle, cardinfo)) < 0) return NULL;
+            continue;
+        }
+
+        // pool is full let's recycle the least recently used handle, EBUSY when only watched or busy cards remain
+        if (freeslot == NULL) {
+            if (oldslot == NULL) {
+                pthread_mutex_unlock (&pool->lock);
+                snd_ctl_close (handle);
+                *err = -EBUSY;
+                return NULL;
+            }
+            pool->evictions++;
+            poolCloseSlot (session, oldslot);
+            freeslot = oldslot;
+        }
+
+        pool->misses++;
+        slot = freeslot;
+        poolFillSlot (slot, cardid, handle, cardinfo);
+        slot->epoch = ++pool->epochs;
+        pool->cards++;
+        slot->users++;
+        pthread_mutex_unlock (&pool->lock);
+        pthread_mutex_lock (&slot->lock);
+        break;
+    }
+
+    slot->lastused = time (NULL);
+    return slot;
+}
+
+// give back a slot obtained from poolGetCard
+PUBLIC void poolReleaseCard (AJG_session *session, AJG_cardslot *slot) {
+    AJG_cardpool *pool = session->cardpool;
+
+    if (slot == NULL) return;
+
+    pthread_mutex_unlock (&slot->lock);
+    pthread_mutex_lock (&pool->lock);
+    slot->users--;
+    pthread_mutex_unlock (&pool->lock);
+}
+
+// make sure hctl element list is loaded, this is only done once per handle
+// Warning: on error the card is dropped, slot should only be released
+PUBLIC int poolLoadCard (AJG_session *session, AJG_cardslot *slot) {
+    snd_hctl_t *hctl;
+    int err;
+
+    if (slot->hctl) return 0;
+    if (slot->ctl == NULL) return -ENODEV;
+
+    if ((err = snd_hctl_open_ctl (&hctl, slot->ctl)) < 0) return err;
+
+    // control cache entries are created while elements get loaded, all with a fresh generation
+    cacheAttachCard (session, slot, hctl);
+    slot->generation = __sync_add_and_fetch (&session->cardpool->generation, 1);
+
+    // on failure hctl closes its ctl with it, card will be reopened by next request
+    slot->hctl = hctl;
+    if ((err = snd_hctl_load (hctl)) < 0 || (err = snd_hctl_nonblock (hctl, 1)) < 0 || (err = snd_ctl_subscribe_events (slot->ctl, 1)) < 0) {
+        poolDropSlot (session, slot);
+        return err;
+    }
+
+    __sync_fetch_and_add (&session->cardpool->loads, 1);
+    slot->loaded = TRUE;
+    poolWatchSlot (session, slot);
+    return 0;
+}
+
+// an alsa call failed on this handle, when error means card is gone drop the handle
+PUBLIC void poolFailCard (AJG_session *session, AJG_cardslot *slot, int err) {
+
+    switch (err) {
+      case -ENODEV:
+      case -ENXIO:
+      case -EBADFD:
+      case -EIO:
+      case -EPIPE:
+          if (verbose) fprintf (stderr, "AJG:pool cardid=%s dropped error=%s\n", slot->cardid, snd_strerror(err));
+          poolDropSlot (session, slot);
+          break;
+
+      default: // regular error [invalid value, read only control, ...] handle remains valid
+          break;
+    }
+}
+
+// close handles unused for more than poolIdle seconds
+PUBLIC void poolEvictIdle (AJG_session *session) {
+    pthread_mutex_lock (&session->cardpool->lock);
+    poolEvictLocked (session);
+    pthread_mutex_unlock (&session->cardpool->lock);
+}
+
+// close every handle [used when leaving]
+PUBLIC void poolCloseAll (AJG_session *session) {
+    int idx;
+
+    if (session->cardpool == NULL) return;
+
+    pthread_mutex_lock (&session->cardpool->lock);
+    for (idx=0; idx < MAX_SNDCARDS; idx++) {
+        if (session->cardpool->slots[idx].cardid != NULL) poolCloseSlot (session, &session->cardpool->slots[idx]);
+    }
+    pthread_mutex_unlock (&session->cardpool->lock);
+}
+
+// return pool counters as a json object
+PUBLIC json_object *poolStats (AJG_session *session) {
+    AJG_cardpool *pool = session->cardpool;
+    json_object *ajgResponse, *poolJ, *cardsJ;
+    int idx;
+
+    cardsJ = json_object_new_array();
+    pthread_mutex_lock (&pool->lock);
+    for (idx=0; idx < MAX_SNDCARDS; idx++) {
+        if (pool->slots[idx].cardid == NULL) continue;
+        json_object_array_add (cardsJ, json_object_new_string (pool->slots[idx].cardid));
+    }
+    pthread_mutex_unlock (&pool->lock);
+
+    poolJ = json_object_new_object();
+    json_object_object_add (poolJ, "hits"     , json_object_new_int64 (pool->hits));
+    json_object_object_add (poolJ, "misses"   , json_object_new_int64 (pool->misses));
+    json_object_object_add (poolJ, "loads"    , json_object_new_int64 (pool->loads));
+    json_object_object_add (poolJ, "reopens"  , json_object_new_int64 (pool->reopens));
+    json_object_object_add (poolJ, "evictions", json_object_new_int64 (pool->evictions));
+    json_object_object_add (poolJ, "events"   , json_object_new_int64 (pool->events));
+    json_object_object_add (poolJ, "cached"   , json_object_new_int64 (pool->cached));
+    json_object_object_add (poolJ, "reads"    , json_object_new_int64 (pool->reads));
+    json_object_object_add (poolJ, "cards"    , cardsJ);
+
+    ajgResponse = json_object_new_object();
+    json_object_object_add (ajgResponse, "ajgtype" , json_object_new_string (AJG_POOL_JTYPE));
+    json_object_object_add (ajgResponse, "status"  , jsonNewStatus(AJG_SUCCESS));
+    json_object_object_add (ajgResponse, "pool"    , poolJ);
+    json_object_object_add (ajgResponse, "websock" , wsockStats (session));
+    json_object_object_add (ajgResponse, "longpoll", deltaStats (session));
+    json_object_object_add (ajgResponse, "httpd"   , httpdStats (session));
+    json_object_object_add (ajgResponse, "assets"  , assetStats (session));
+    json_object_object_add (ajgResponse, "connections", admitStats (session));
+    if (session->fakemod) json_object_object_add (ajgResponse, "fakemod", fakeStats (session));
+    if (session->fakemod) json_object_object_add (ajgResponse, "simulated", simulStats (session));
+
+    return (ajgResponse);
+}
@@ -0,0 +1,191 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Resource style REST v2 API. Each route is a method plus a path pattern
+    mapped on one of the request= commands. Patterns are split into segments
+    once at startup, a request path is then matched segment by segment
+    without copy and its parameters [cardid, numid, session] are parsed into
+    a typed AJG_route. Query arguments [quiet, value, since ...] remain the
+    ones of the request= API.
+
+      GET  /api/v2/cards                                 card-get-all
+      GET  /api/v2/cards/{cardid}                        card-get-one
+      GET  /api/v2/cards/{cardid}/controls               ctrl-get-all
+      GET  /api/v2/cards/{cardid}/controls/{numid}       ctrl-get-one
+      PUT  /api/v2/cards/{cardid}/controls/{numid}       ctrl-set-one  [?value=10,5]
+      GET  /api/v2/cards/{cardid}/schema                 ctrl-get-schema
+      GET  /api/v2/cards/{cardid}/values                 ctrl-get-values
+      GET  /api/v2/cards/{cardid}/changes                ctrl-get-changed
+      GET  /api/v2/cards/{cardid}/sessions               session-list
+      PUT  /api/v2/cards/{cardid}/sessions/{session}     session-store [json info as body]
+      POST /api/v2/cards/{cardid}/sessions/{session}     session-load
+      GET  /api/v2/stats                                 gateway-stats
+
+   References:
+   https://tools.ietf.org/html/rfc7231#section-4.3
+*/
+
+#include "local-def-ajg.h"
+
+#define ROUTE_LITERAL 0
+#define ROUTE_CARDID  1
+#define ROUTE_NUMID   2
+#define ROUTE_SESSION 3
+
+typedef struct {
+  int     type;
+  const char *literal;
+  size_t  len;
+} AJG_routeseg;
+
+typedef struct {
+  const char *method;
+  const char *pattern;
+  AJG_REST_CMD cmd;
+  const char *name;
+  int     count;           // segments, set by routeInit
+  AJG_routeseg segments [AJG_ROUTE_DEPTH];
+} AJG_routedef;
+
+STATIC AJG_routedef routeTable [] = {
+  {"GET" , "cards"                             , CARD_GET_ALL    , "card-get-all"},
+  {"GET" , "cards/{cardid}"                    , CARD_GET_ONE    , "card-get-one"},
+  {"GET" , "cards/{cardid}/controls"           , CTRL_GET_ALL    , "ctrl-get-all"},
+  {"GET" , "cards/{cardid}/controls/{numid}"   , CTRL_GET_ONE    , "ctrl-get-one"},
+  {"PUT" , "cards/{cardid}/controls/{numid}"   , CTRL_SET_ONE    , "ctrl-set-one"},
+  {"GET" , "cards/{cardid}/schema"             , CTRL_GET_SCHEMA , "ctrl-get-schema"},
+  {"GET" , "cards/{cardid}/values"             , CTRL_GET_VALUES , "ctrl-get-values"},
+  {"GET" , "cards/{cardid}/changes"            , CTRL_GET_CHANGED, "ctrl-get-changed"},
+  {"GET" , "cards/{cardid}/sessions"           , SESSION_LIST    , "session-list"},
+  {"PUT" , "cards/{cardid}/sessions/{session}" , SESSION_STORE   , "session-store"},
+  {"POST", "cards/{cardid}/sessions/{session}" , SESSION_LOAD    , "session-load"},
+  {"GET" , "stats"                             , GATEWAY_STATS   , "gateway-stats"},
+  {NULL}
+};
+
+// split path in at most AJG_ROUTE_DEPTH segments [pointers within path], -1 when deeper
+STATIC int routeSplit (const char *path, AJG_routeseg *segments) {
+    int count = 0;
+
+    while (*path) {
+        size_t len = strcspn (path, "/");
+
+        if (len > 0) {
+            if (count == AJG_ROUTE_DEPTH) return -1;
+            segments[count].type    = ROUTE_LITERAL;
+            segments[count].literal = path;
+            segments[count].len     = len;
+            count++;
+        }
+        path += len;
+        if (*path == '/') path++;
+    }
+    return count;
+}
+
+// copy a string parameter, refuse empty, too long and hidden names [session names become filenames]
+STATIC int routeString (const AJG_routeseg *segment, char *value, size_t maxlen) {
+    if (segment->len == 0 || segment->len >= maxlen || segment->literal[0] == '.') return FALSE;
+    memcpy (value, segment->literal, segment->len);
+    value[segment->len] = '\0';
+    return TRUE;
+}
+
+STATIC int routeNumid (const AJG_routeseg *segment, int *numid) {
+    size_t idx;
+    int value = 0;
+
+    if (segment->len == 0 || segment->len > 9) return FALSE;
+    for (idx=0; idx < segment->len; idx++) {
+        if (segment->literal[idx] < '0' || segment->literal[idx] > '9') return FALSE;
+        value = value * 10 + (segment->literal[idx] - '0');
+    }
+    *numid = value;
+    return TRUE;
+}
+
+// compare path segments with one route, parameters are only parsed when every literal matches
+STATIC int routeCompare (const AJG_routedef *def, const AJG_routeseg *segments, int count, AJG_route *route) {
+    int idx;
+
+    if (def->count != count) return FALSE;
+    for (idx=0; idx < count; idx++) {
+        if (def->segments[idx].type != ROUTE_LITERAL) continue;
+        if (def->segments[idx].len != segments[idx].len || strncmp (def->segments[idx].literal, segments[idx].literal, segments[idx].len)) return FALSE;
+    }
+
+    route->numid = -1;
+    route->cardid[0] = route->session[0] = '\0';
+    for (idx=0; idx < count; idx++) {
+        switch (def->segments[idx].type) {
+            case ROUTE_CARDID:
+                if (!routeString (&segments[idx], route->cardid, sizeof (route->cardid))) return FALSE;
+                break;
+            case ROUTE_NUMID:
+                if (!routeNumid (&segments[idx], &route->numid)) return FALSE;
+                break;
+            case ROUTE_SESSION:
+                if (!routeString (&segments[idx], route->session, sizeof (route->session))) return FALSE;
+                break;
+        }
+    }
+    return TRUE;
+}
+
+// split route patterns once, {xxx} segments become typed parameters
+PUBLIC void routeInit (void) {
+    AJG_routedef *def;
+    int idx;
+
+    for (def = routeTable; def->method != NULL; def++) {
+        def->count = routeSplit (def->pattern, def->segments);
+        for (idx=0; idx < def->count; idx++) {
+            AJG_routeseg *segment = &def->segments[idx];
+
+            if (segment->literal[0] != '{') continue;
+            if (!strncmp (segment->literal, "{cardid}", segment->len)) segment->type = ROUTE_CARDID;
+            else if (!strncmp (segment->literal, "{numid}", segment->len)) segment->type = ROUTE_NUMID;
+            else if (!strncmp (segment->literal, "{session}", segment->len)) segment->type = ROUTE_SESSION;
+            else fprintf (stderr, "AJG: routeInit unknown parameter %.*s in %s\n", (int) segment->len, segment->literal, def->pattern);
+        }
+    }
+}
+
+// path is the url after AJG_ROUTE_PREFIX. Returns matching command with route filled in,
+// AJG_ROUTE_NOTFOUND or AJG_ROUTE_BADMETHOD when path exists for other methods only
+PUBLIC int routeMatch (const char *method, const char *path, AJG_route *route) {
+    AJG_routeseg segments [AJG_ROUTE_DEPTH];
+    AJG_routedef *def;
+    int count, status = AJG_ROUTE_NOTFOUND;
+
+    if ((count = routeSplit (path, segments)) <= 0) return AJG_ROUTE_NOTFOUND;
+
+    for (def = routeTable; def->method != NULL; def++) {
+        if (!routeCompare (def, segments, count, route)) continue;
+        if (strcmp (def->method, method)) {
+            status = AJG_ROUTE_BADMETHOD;
+            continue;
+        }
+        route->cmd  = def->cmd;
+        route->name = def->name;
+        return def->cmd;
+    }
+    return status;
+}
@@ -228,20 +228,24 @@ PUBLIC json_object *sessionFromDisk (AJG_session *session, AJG_request *request)
 // push Json session object to disk
 PUBLIC json_object * sessionToDisk (AJG_session *session, AJG_request *request, json_object *jsonSession) {
    char filename [256];
+   char timestamp [32];
    time_t rawtime;
-   struct tm * timeinfo;
+   struct tm timeinfo;
    int err, defsession;
-   static json_object *response;
+   json_object *response;
 
-   // we should have a session name
-   if (request->args == NULL) return (jsonNewMessage (AJG_FATAL,"session name missing &session=MySessionName", filename));
+   // we should have a session name [jsonSession is always released]
+   if (request->args == NULL) {
+       json_object_put (jsonSession);
+       return (jsonNewMessage (AJG_FATAL,"session name missing &session=MySessionName"));
+   }
 
    // check for current session request
    defsession = (strcmp (request->args, AJG_DEFAULT_SESSION) ==0);
 
    // if directory for card's sessions does not exist create it
    response = checkCardDirExist (session, request);
-   if (response != NULL) return response;
+   if (response != NULL) goto OnErrorExit;
 
    // add cardname and file extension to session name
    strncpy (filename, request->cardname, sizeof(filename));
@@ -253,15 +257,15 @@ PUBLIC json_object * sessionToDisk (AJG_session *session, AJG_request *request,
 
    json_object_object_add(jsonSession, "ajgtype", json_object_new_string (AJG_SESSION_JTYPE));
 
-   // add a timestamp and store session on disk
-   time ( &rawtime );  timeinfo = localtime ( &rawtime );
+   // add a timestamp and store session on disk [reentrant calls, sessions of different cards are saved in parallel]
+   time ( &rawtime );  localtime_r ( &rawtime, &timeinfo );
    // A copy of the string is made and the memory is managed by the json_object
-   json_object_object_add (jsonSession, "timestamp", json_object_new_string (asctime (timeinfo)));
+   json_object_object_add (jsonSession, "timestamp", json_object_new_string (asctime_r (&timeinfo, timestamp)));
 
 
    // do we have extra session info ?
    if (request->data) {
-       static json_object *info, *ajgtype;
+       json_object *info, *ajgtype;
        const char  *ajglabel;
 
        // extract session info from args
@@ -273,6 +277,7 @@ PUBLIC json_object * sessionToDisk (AJG_session *session, AJG_request *request,
 
        // info is a valid AJG_info type
        if (!json_object_object_get_ex (info, "ajgtype", &ajgtype)) {
+            json_object_put   (info); // release info json object
             response = jsonNewMessage (AJG_EMPTY,"sndcard=%s session=%s No 'AJG_type' args=%s", request->cardname, request->args, request->data);
             goto OnErrorExit;
        }
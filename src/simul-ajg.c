@@ -0,0 +1,746 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    fakemod simulated sndcards. A card whose cardid has a sample
+    [rootdir/fakemod/CTRL_GET_ALL-<cardid>.ajg] is simulated from it: numids,
+    types, ranges, enums and acl are the sample ones, values start from the
+    sample and are changed by ctrl-set-one, ctrl-set-many and session-load.
+    ctrl-get-all, ctrl-get-one and ctrl-get-many return current values with
+    the same layout and quiet levels as a real card.
+
+    Sample is parsed once into a read only model shared by every card built
+    from it. cardid <sample>~<n> [hw:18i8~12] is another card of the same
+    model with its own values, as many as AJG_SIMUL_MAXCARDS cards can be
+    simulated at once [not limited by MAX_SNDCARDS pool slots].
+
+    Faults [--fake-faults] make simulated cards behave like slow usb mixers:
+    probe, element read, element write and tlv read get a latency drawn
+    within min-max, a tail latency for tailrate% of them and fail with EAGAIN
+    for errors% of them. Latency is spent with card lock held, requests on a
+    slow card queue behind it as they do on a real one. With removal% a probe
+    removes the card for removal-time ms [Not Found] before it comes back.
+
+   References:
+   http://git.alsa-project.org/?p=alsa-lib.git;a=blob;f=src/control/ctlparse.c
+*/
+
+#include "local-def-ajg.h"
+#include <limits.h>
+
+#define AJG_ALSACTL_JTYPE "AJG_ctrls"
+#define AJG_SNDCARD_JTYPE "AJG_sndcard"
+#define AJG_SIMUL_SUFFIX  ".ajg"
+
+STATIC unsigned int simulHash (const char *cardid) {
+    unsigned int hash = 2166136261u;
+
+    while (*cardid) hash = (hash ^ (unsigned char) *cardid++) * 16777619u;
+    return hash % AJG_SIMUL_BUCKETS;
+}
+
+STATIC char *simulString (json_object *objJ, const char *key) {
+    json_object *valueJ;
+
+    if (!json_object_object_get_ex (objJ, key, &valueJ)) return strdup ("");
+    return strdup (json_object_get_string (valueJ));
+}
+
+STATIC int simulFlag (json_object *objJ, const char *key, int defval) {
+    json_object *valueJ;
+
+    if (!json_object_object_get_ex (objJ, key, &valueJ)) return defval;
+    return json_object_get_boolean (valueJ);
+}
+
+STATIC long long simulClamp (AJG_simctrl *ctrl, long long value) {
+    if (value < ctrl->min) return ctrl->min;
+    if (value > ctrl->max) return ctrl->max;
+    return value;
+}
+
+// static part of one sample control, values go in model defaults
+STATIC void simulLoadCtrl (AJG_simmodel *model, AJG_simctrl *ctrl, json_object *ctrlJ) {
+    json_object *classJ = NULL, *aclJ = NULL, *tlvJ, *valueJ, *enumsJ;
+    const char *type = "";
+    int idx;
+
+    json_object_object_get_ex (ctrlJ, "ctrl", &classJ);
+    json_object_object_get_ex (ctrlJ, "acl", &aclJ);
+    if (json_object_object_get_ex (classJ, "type", &valueJ)) type = json_object_get_string (valueJ);
+
+    ctrl->numid    = json_object_object_get_ex (ctrlJ, "numid", &valueJ) ? json_object_get_int (valueJ) : 0;
+    ctrl->name     = simulString (ctrlJ, "name");
+    ctrl->iface    = simulString (ctrlJ, "iface");
+    ctrl->actif    = simulFlag (ctrlJ, "actif", TRUE);
+    ctrl->readable = simulFlag (aclJ, "read", TRUE) && json_object_object_get_ex (ctrlJ, "value", NULL);
+    ctrl->writable = simulFlag (aclJ, "write", FALSE);
+    ctrl->count    = json_object_object_get_ex (classJ, "count", &valueJ) ? json_object_get_int (valueJ) : 1;
+    if (ctrl->count < 1 || ctrl->count > 128) ctrl->count = 1;
+
+    if (!strcmp (type, "BOOLEAN")) {
+        ctrl->type = AJG_SIMUL_BOOLEAN;
+        ctrl->min  = 0;
+        ctrl->max  = 1;
+    } else if (!strcmp (type, "INTEGER")) {
+        ctrl->type = AJG_SIMUL_INTEGER;
+        ctrl->min  = json_object_object_get_ex (classJ, "min", &valueJ) ? json_object_get_int64 (valueJ) : 0;
+        ctrl->max  = json_object_object_get_ex (classJ, "max", &valueJ) ? json_object_get_int64 (valueJ) : 0;
+    } else if (!strcmp (type, "ENUMERATED") && json_object_object_get_ex (classJ, "enums", &enumsJ)) {
+        ctrl->type  = AJG_SIMUL_ENUMERATED;
+        ctrl->items = json_object_array_length (enumsJ);
+        ctrl->enums = calloc (ctrl->items, sizeof (char*));
+        for (idx=0; idx < ctrl->items; idx++) ctrl->enums[idx] = strdup (json_object_get_string (json_object_array_get_idx (enumsJ, idx)));
+        ctrl->min  = 0;
+        ctrl->max  = ctrl->items - 1;
+    } else {
+        // other types are returned as sampled and never written
+        ctrl->type = AJG_SIMUL_OTHER;
+        ctrl->writable = FALSE;
+        ctrl->min  = LLONG_MIN;
+        ctrl->max  = LLONG_MAX;
+    }
+
+    if (classJ) jbufPrebuild (&ctrl->metaCtrl, classJ);
+    if (aclJ) jbufPrebuild (&ctrl->metaAcl, aclJ);
+    if (json_object_object_get_ex (ctrlJ, "tlv", &tlvJ)) jbufPrebuild (&ctrl->metaTlv, tlvJ);
+
+    ctrl->offset = model->values;
+    model->values += ctrl->count;
+    if (ctrl->numid > model->maxnumid) model->maxnumid = ctrl->numid;
+}
+
+// parse sample once, NULL when missing or invalid [simul lock held]
+STATIC AJG_simmodel *simulLoadModel (AJG_session *session, const char *name) {
+    json_object *sampleJ, *sndcardJ, *dataJ;
+    AJG_simmodel *model;
+    char filepath [512];
+    int idx, count;
+
+    snprintf (filepath, sizeof (filepath), "%s/fakemod/CTRL_GET_ALL-%s%s", session->config->rootdir, name, AJG_SIMUL_SUFFIX);
+    if ((sampleJ = json_object_from_file (filepath)) == NULL) return NULL;
+    if (!json_object_object_get_ex (sampleJ, "sndcard", &sndcardJ) || !json_object_object_get_ex (sampleJ, "data", &dataJ)
+        || !json_object_is_type (dataJ, json_type_array)) {
+        fprintf (stderr, "AJG: fakemod sample %s has no sndcard or data\n", filepath);
+        json_object_put (sampleJ);
+        return NULL;
+    }
+
+    model = calloc (1, sizeof (AJG_simmodel));
+    model->name     = strdup (name);
+    model->id       = simulString (sndcardJ, "cardid");
+    model->cardname = simulString (sndcardJ, "name");
+    model->driver   = simulString (sndcardJ, "driver");
+    model->info     = simulString (sndcardJ, "info");
+
+    count = json_object_array_length (dataJ);
+    model->ctrls = calloc (count, sizeof (AJG_simctrl));
+    for (idx=0; idx < count; idx++) simulLoadCtrl (model, &model->ctrls[model->count++], json_object_array_get_idx (dataJ, idx));
+
+    // numid index and sample values, initial state of every card of this model
+    model->index = calloc (model->maxnumid + 1, sizeof (AJG_simctrl*));
+    model->defaults = calloc (model->values + 1, sizeof (long long));
+    for (idx=0; idx < model->count; idx++) {
+        AJG_simctrl *ctrl = &model->ctrls[idx];
+        json_object *valueJ;
+        int elem;
+
+        if (ctrl->numid > 0) model->index[ctrl->numid] = ctrl;
+        if (!json_object_object_get_ex (json_object_array_get_idx (dataJ, idx), "value", &valueJ)) continue;
+        for (elem=0; elem < ctrl->count && elem < (int) json_object_array_length (valueJ); elem++) {
+            model->defaults[ctrl->offset + elem] = simulClamp (ctrl, json_object_get_int64 (json_object_array_get_idx (valueJ, elem)));
+        }
+    }
+    json_object_put (sampleJ);
+
+    if (verbose) fprintf (stderr, "AJG: fakemod sample %s loaded [%d controls]\n", name, model->count);
+    return model;
+}
+
+PUBLIC void simulInit (AJG_session *session) {
+    session->simul = calloc (1, sizeof (AJG_simul));
+    pthread_mutex_init (&session->simul->lock, NULL);
+}
+
+// simulated card of cardid, created from its sample at first access. NULL when cardid has no sample.
+// Cards and models are never freed, callers keep returned card without holding simul lock
+PUBLIC AJG_simcard *simulFind (AJG_session *session, const char *cardid) {
+    AJG_simul *simul = session->simul;
+    AJG_simmodel *model;
+    AJG_simcard *card;
+    unsigned int bucket;
+    char name [64];
+    size_t len;
+
+    // cardid is part of a filename, it never leaves fakemod directory
+    if (cardid == NULL || strchr (cardid, '/')) return NULL;
+    bucket = simulHash (cardid);
+
+    pthread_mutex_lock (&simul->lock);
+    for (card = simul->buckets[bucket]; card != NULL; card = card->next) {
+        if (!strcmp (card->cardid, cardid)) break;
+    }
+    if (card != NULL || simul->cards >= AJG_SIMUL_MAXCARDS) goto OnExit;
+
+    // hw:18i8~12 is one more card simulated from hw:18i8 sample
+    len = strcspn (cardid, AJG_SIMUL_CLONE);
+    if (len == 0 || len >= sizeof (name)) goto OnExit;
+    memcpy (name, cardid, len);
+    name[len] = '\0';
+
+    for (model = simul->models; model != NULL; model = model->next) {
+        if (!strcmp (model->name, name)) break;
+    }
+    if (model == NULL) {
+        // missing samples are not remembered, cardids come from clients
+        if ((model = simulLoadModel (session, name)) == NULL) goto OnExit;
+        model->next = simul->models;
+        simul->models = model;
+    }
+
+    card = calloc (1, sizeof (AJG_simcard));
+    card->cardid = strdup (cardid);
+    card->model  = model;
+    card->values = malloc ((model->values + 1) * sizeof (long long));
+    memcpy (card->values, model->defaults, (model->values + 1) * sizeof (long long));
+    pthread_mutex_init (&card->lock, NULL);
+    card->next = simul->buckets[bucket];
+    simul->buckets[bucket] = card;
+    simul->cards++;
+
+OnExit:
+    pthread_mutex_unlock (&simul->lock);
+    return card;
+}
+
+STATIC AJG_simctrl *simulFindCtrl (AJG_simcard *card, int numid) {
+    if (numid <= 0 || numid > card->model->maxnumid) return NULL;
+    return card->model->index[numid];
+}
+
+STATIC json_object *simulNotFound (AJG_request *request) {
+    return jsonNewMessage (AJG_EMPTY, "SndCard [%s] Not Found", request->cardid);
+}
+
+STATIC unsigned long simulNow (void) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+STATIC unsigned int simulRandom (void) {
+    static __thread unsigned int seed;  // one sequence per thread
+
+    if (seed == 0) seed = (unsigned int) time (NULL) ^ (unsigned int) pthread_self ();
+    return (unsigned int) rand_r (&seed);
+}
+
+// TRUE for pct% of calls
+STATIC int simulRoll (double pct) {
+    if (pct <= 0) return FALSE;
+    return (simulRandom () % 1000000) < pct * 10000;
+}
+
+STATIC int simulFaulty (AJG_simul *simul, AJG_simcard *card) {
+    return (simul->faulty && (simul->faultcard == NULL || !strcmp (simul->faultcard, card->cardid)));
+}
+
+// injected latency and error of one card operation, 0 or -EAGAIN [card lock held, sleeps as a slow sndcard]
+STATIC int simulFault (AJG_simul *simul, AJG_simcard *card, int op) {
+    AJG_simfault *fault = &simul->faults[op];
+    long delay;
+
+    if (!simulFaulty (simul, card)) return 0;
+
+    delay = fault->min;
+    if (fault->max > fault->min) delay += simulRandom () % (fault->max - fault->min + 1);
+    if (fault->tail > 0 && simulRoll (fault->tailrate)) delay = fault->tail;
+    if (delay > 0) {
+        struct timespec pause = {delay / 1000, (delay % 1000) * 1000000};
+
+        nanosleep (&pause, NULL);
+        __sync_fetch_and_add (&fault->delayed, 1);
+    }
+
+    if (!simulRoll (fault->errors)) return 0;
+    __sync_fetch_and_add (&fault->failed, 1);
+    return -EAGAIN;
+}
+
+// simulated card locked for one request, NULL with an error message when missing, removed or failing
+STATIC AJG_simcard *simulProbe (AJG_session *session, AJG_request *request, json_object **errMessage) {
+    AJG_simul *simul = session->simul;
+    AJG_simcard *card;
+    int err;
+
+    if ((card = simulFind (session, request->cardid)) == NULL) {
+        *errMessage = simulNotFound (request);
+        return NULL;
+    }
+
+    pthread_mutex_lock (&card->lock);
+
+    // removed card comes back after removal-time as after a usb replug
+    if (card->removed && simulNow () < card->removed) goto OnRemoved;
+    card->removed = 0;
+    if (simulFaulty (simul, card) && simulRoll (simul->removal)) {
+        card->removed = simulNow () + simul->removaltime;
+        __sync_fetch_and_add (&simul->removals, 1);
+        if (verbose) fprintf (stderr, "AJG: fakemod card %s removed for %dms\n", card->cardid, simul->removaltime);
+        goto OnRemoved;
+    }
+
+    if ((err = simulFault (simul, card, AJG_SIMUL_PROBE)) < 0) {
+        pthread_mutex_unlock (&card->lock);
+        *errMessage = jsonNewMessage (AJG_FAIL, "SndCard [%s] info error: %s", request->cardid, strerror (-err));
+        return NULL;
+    }
+    return card;
+
+OnRemoved:
+    pthread_mutex_unlock (&card->lock);
+    *errMessage = simulNotFound (request);
+    return NULL;
+}
+
+// values are read once per response, tlv with verbose responses [card lock held]
+STATIC json_object *simulRead (AJG_session *session, AJG_request *request, AJG_simcard *card) {
+    int err;
+
+    if ((err = simulFault (session->simul, card, AJG_SIMUL_READ)) < 0) {
+        return jsonNewMessage (AJG_FAIL, "alsaGetControl cardid=[%s] element read error: %s", request->cardid, strerror (-err));
+    }
+    if (!request->quiet && (err = simulFault (session->simul, card, AJG_SIMUL_TLV)) < 0) {
+        return jsonNewMessage (AJG_FAIL, "alsaGetControl cardid=[%s] tlv read error: %s", request->cardid, strerror (-err));
+    }
+    __sync_fetch_and_add (&card->reads, 1);
+    return NULL;
+}
+
+// same description as a real card, cardname is pushed into request for session management
+STATIC void simulWriteCard (AJG_jbuf *jbuf, AJG_simcard *card, AJG_request *request) {
+    AJG_simmodel *model = card->model;
+
+    if (request->cardname) free (request->cardname);
+    request->cardname = strdup (model->cardname);
+
+    jbufObjectStart (jbuf);
+    jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_SNDCARD_JTYPE);
+    jbufKey (jbuf, "cardid");  jbufString (jbuf, model->id);
+    jbufKey (jbuf, "name");    jbufString (jbuf, model->cardname);
+
+    if (!request->quiet) {
+        jbufKey (jbuf, "devid");  jbufString (jbuf, card->cardid);
+        jbufKey (jbuf, "driver"); jbufString (jbuf, model->driver);
+        jbufKey (jbuf, "info");   jbufString (jbuf, model->info);
+    }
+    jbufObjectEnd (jbuf);
+}
+
+// one control with the quiet levels of alsaWriteCtrl [card lock held]
+STATIC void simulWriteCtrl (AJG_jbuf *jbuf, AJG_simcard *card, AJG_simctrl *ctrl, AJG_request *request) {
+    int idx;
+
+    jbufObjectStart (jbuf);
+    jbufKey (jbuf, "numid"); jbufInt (jbuf, ctrl->numid);
+    if (request->quiet < 2) { jbufKey (jbuf, "name");  jbufString (jbuf, ctrl->name); }
+    if (request->quiet < 1) { jbufKey (jbuf, "iface"); jbufString (jbuf, ctrl->iface); }
+    if (request->quiet < 3) { jbufKey (jbuf, "actif"); jbufBool (jbuf, ctrl->actif); }
+
+    if (ctrl->readable) {
+        jbufKey (jbuf, "value");
+        jbufArrayStart (jbuf);
+        for (idx=0; idx < ctrl->count; idx++) {
+            if (ctrl->type == AJG_SIMUL_BOOLEAN) jbufBool (jbuf, (int) card->values[ctrl->offset + idx]);
+            else jbufInt (jbuf, card->values[ctrl->offset + idx]);
+        }
+        jbufArrayEnd (jbuf);
+    }
+
+    if (!request->quiet) {
+        jbufKey (jbuf, "ctrl"); jbufPrebuilt (jbuf, &ctrl->metaCtrl);
+        jbufKey (jbuf, "acl");  jbufPrebuilt (jbuf, &ctrl->metaAcl);
+        if (ctrl->metaTlv.formats[AJG_FORMAT_JSON]) { jbufKey (jbuf, "tlv"); jbufPrebuilt (jbuf, &ctrl->metaTlv); }
+    }
+    jbufObjectEnd (jbuf);
+}
+
+STATIC void simulOpenControls (AJG_jbuf *jbuf, AJG_simcard *card, AJG_request *request) {
+    jbufObjectStart (jbuf);
+    jbufKey (jbuf, "sndcard");
+    simulWriteCard (jbuf, card, request);
+    jbufKey (jbuf, "data");
+    jbufArrayStart (jbuf);
+}
+
+STATIC void simulCloseControls (AJG_jbuf *jbuf) {
+    jbufArrayEnd (jbuf);
+    jbufKey (jbuf, "ajgtype"); jbufString (jbuf, AJG_ALSACTL_JTYPE);
+    jbufKey (jbuf, "status");  jsonWriteStatus (jbuf, AJG_SUCCESS);
+    jbufObjectEnd (jbuf);
+}
+
+// sndcard description of a simulated card
+PUBLIC json_object *simulWriteProbe (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+    json_object *errMessage;
+    AJG_simcard *card;
+
+    if ((card = simulProbe (session, request, &errMessage)) == NULL) return errMessage;
+    simulWriteCard (jbuf, card, request);
+    pthread_mutex_unlock (&card->lock);
+    return NULL;
+}
+
+// ctrl-get-all, or ctrl-get-one when request->numid is set [unknown numid returns an empty data array]
+PUBLIC json_object *simulWriteControls (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+    json_object *errMessage;
+    AJG_simcard *card;
+    int idx;
+
+    if ((card = simulProbe (session, request, &errMessage)) == NULL) return errMessage;
+    if ((errMessage = simulRead (session, request, card)) != NULL) {
+        pthread_mutex_unlock (&card->lock);
+        return errMessage;
+    }
+
+    simulOpenControls (jbuf, card, request);
+    if (request->numid < 0) {
+        for (idx=0; idx < card->model->count; idx++) simulWriteCtrl (jbuf, card, &card->model->ctrls[idx], request);
+    } else {
+        AJG_simctrl *ctrl = simulFindCtrl (card, request->numid);
+        if (ctrl) simulWriteCtrl (jbuf, card, ctrl, request);
+    }
+    simulCloseControls (jbuf);
+    pthread_mutex_unlock (&card->lock);
+    return NULL;
+}
+
+// ctrl-get-many, listed numids in requested order
+PUBLIC json_object *simulWriteManyCtrl (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+    json_object *numids, *errMessage;
+    AJG_simcard *card;
+    unsigned int index;
+
+    numids = request->data ? json_tokener_parse (request->data) : NULL;
+    if (numids == NULL || !json_object_is_type (numids, json_type_array)) {
+        if (numids) json_object_put (numids);
+        return (jsonNewMessage (AJG_FATAL,"alsaGetManyCtrl cardid=[%s] invalid json numids array=%s\n", request->cardid, request->data));
+    }
+    if ((card = simulProbe (session, request, &errMessage)) == NULL) {
+        json_object_put (numids);
+        return errMessage;
+    }
+    if ((errMessage = simulRead (session, request, card)) != NULL) {
+        pthread_mutex_unlock (&card->lock);
+        json_object_put (numids);
+        return errMessage;
+    }
+
+    simulOpenControls (jbuf, card, request);
+    for (index=0; index < json_object_array_length (numids); index++) {
+        int numid = json_object_get_int (json_object_array_get_idx (numids, index));
+        AJG_simctrl *ctrl = simulFindCtrl (card, numid);
+
+        if (ctrl == NULL) {
+            jbufObjectStart (jbuf);
+            jbufKey (jbuf, "numid"); jbufInt (jbuf, numid);
+            jbufKey (jbuf, "error"); jbufString (jbuf, "unknown numid");
+            jbufObjectEnd (jbuf);
+            continue;
+        }
+        simulWriteCtrl (jbuf, card, ctrl, request);
+    }
+    simulCloseControls (jbuf);
+    pthread_mutex_unlock (&card->lock);
+
+    json_object_put (numids);
+    return NULL;
+}
+
+// one element of ctrl-set-one args, same rules as snd_ctl_ascii_value_parse. FALSE when refused
+STATIC int simulParseValue (AJG_simctrl *ctrl, const char *text, long long current, long long *value) {
+    char *end;
+    long long number;
+    int idx;
+
+    switch (ctrl->type) {
+      case AJG_SIMUL_BOOLEAN:
+          if (!strcasecmp (text, "on") || !strcasecmp (text, "up") || !strcasecmp (text, "true")) { *value = 1; return TRUE; }
+          if (!strcasecmp (text, "off") || !strcasecmp (text, "down") || !strcasecmp (text, "false")) { *value = 0; return TRUE; }
+          if (!strcasecmp (text, "toggle")) { *value = !current; return TRUE; }
+          break;
+
+      case AJG_SIMUL_ENUMERATED:
+          for (idx=0; idx < ctrl->items; idx++) {
+              if (!strcmp (text, ctrl->enums[idx])) { *value = idx; return TRUE; }
+          }
+          break;
+    }
+
+    // integers are clamped within control range, xx% is relative to it
+    number = strtoll (text, &end, 10);
+    if (end == text) return FALSE;
+    if (*end == '%' && ctrl->type == AJG_SIMUL_INTEGER) number = ctrl->min + ((ctrl->max - ctrl->min) * number + 50) / 100;
+    else if (*end != '\0') return FALSE;
+
+    *value = simulClamp (ctrl, number);
+    return TRUE;
+}
+
+// parse "10,5" into control values, a single value is applied to every channel [card lock held]
+STATIC int simulParseArgs (AJG_simcard *card, AJG_simctrl *ctrl, const char *args) {
+    long long values [128];
+    char element [128];
+    const char *ptr = args;
+    int idx;
+
+    for (idx=0; idx < ctrl->count && *ptr; idx++) {
+        size_t len = strcspn (ptr, ",");
+
+        while (len > 0 && *ptr == ' ') { ptr++; len--; }
+        if (len >= sizeof (element)) return FALSE;
+        memcpy (element, ptr, len);
+        while (len > 0 && element[len-1] == ' ') len--;
+        element[len] = '\0';
+
+        if (!simulParseValue (ctrl, element, card->values[ctrl->offset + idx], &values[idx])) return FALSE;
+
+        if (!strchr (args, ',')) ptr = args;
+        else { ptr += strcspn (ptr, ","); if (*ptr == ',') ptr++; }
+    }
+
+    // nothing is written when one element is refused
+    memcpy (&card->values[ctrl->offset], values, idx * sizeof (long long));
+    return (idx > 0);
+}
+
+// ctrl-set-one, quiet=0 returns written control as ctrl-get-one&quiet=1 does
+PUBLIC json_object *simulWriteSetOne (AJG_session *session, AJG_request *request, AJG_jbuf *jbuf) {
+    json_object *response = NULL;
+    AJG_simcard *card;
+    AJG_simctrl *ctrl;
+    int readback, err;
+
+    readback = !request->quiet;
+    if (readback) request->quiet=1;
+
+    if ((card = simulProbe (session, request, &response)) == NULL) {
+        json_object_put (response);
+        return (jsonNewMessage (AJG_FATAL,"Sound card [%s] has no 'name' element", request->cardid));
+    }
+    if (request->args == NULL || request->numid < 0) {
+        response = jsonNewMessage (AJG_FAIL,"setcontrol Card=%s NumId=%d no values missing &numid=xx&args='values'\n", card->model->cardname, request->numid);
+        goto OnExit;
+    }
+    if ((ctrl = simulFindCtrl (card, request->numid)) == NULL) {
+        response = jsonNewMessage (AJG_FAIL,"Cannot find the given element from control %s\n", request->cardid);
+        goto OnExit;
+    }
+    if (!ctrl->writable || (err = simulFault (session->simul, card, AJG_SIMUL_WRITE)) < 0) {
+        response = jsonNewMessage (AJG_FAIL,"Control %s element write error: %s\n", request->cardid, strerror (ctrl->writable ? -err : EPERM));
+        goto OnExit;
+    }
+    if (!simulParseArgs (card, ctrl, request->args)) {
+        response = jsonNewMessage (AJG_FAIL,"Control %s fail to parse args=%s: %s\n", request->cardid, request->args, strerror (EINVAL));
+        goto OnExit;
+    }
+    __sync_fetch_and_add (&card->writes, 1);
+
+    if (!readback) {
+        jsonWriteMessage (jbuf, AJG_SUCCESS, "done");
+        goto OnExit;
+    }
+    simulOpenControls (jbuf, card, request);
+    simulWriteCtrl (jbuf, card, ctrl, request);
+    simulCloseControls (jbuf);
+
+OnExit:
+    pthread_mutex_unlock (&card->lock);
+    return response;
+}
+
+// write integer values of a json array [session, set-many], same value count rules as alsaSimpleSetCtrl.
+// Unless forced a control already holding those values is not written and AJG_EMPTY is returned [card lock held]
+STATIC AJG_ERROR simulSetValues (AJG_session *session, AJG_simcard *card, json_object *ctrlnumid, json_object *ctrlvalue, int force) {
+    AJG_simctrl *ctrl;
+    int idx, length, changed = force;
+
+    if (!json_object_is_type (ctrlnumid, json_type_int) || !json_object_is_type (ctrlvalue, json_type_array)) return AJG_FAIL;
+    if ((ctrl = simulFindCtrl (card, json_object_get_int (ctrlnumid))) == NULL) return AJG_FAIL;
+    if (!ctrl->writable) return AJG_EMPTY;
+
+    length = json_object_array_length (ctrlvalue);
+    for (idx=0; idx < ctrl->count && idx < length && !changed; idx++) {
+        changed = (card->values[ctrl->offset + idx] != simulClamp (ctrl, json_object_get_int64 (json_object_array_get_idx (ctrlvalue, idx))));
+    }
+    if (!changed) return AJG_EMPTY;
+
+    // only written controls pay write latency and errors, as driver writes on a real card
+    if (simulFault (session->simul, card, AJG_SIMUL_WRITE) < 0) return AJG_FAIL;
+
+    for (idx=0; idx < ctrl->count && idx < length; idx++) {
+        card->values[ctrl->offset + idx] = simulClamp (ctrl, json_object_get_int64 (json_object_array_get_idx (ctrlvalue, idx)));
+    }
+    __sync_fetch_and_add (&card->writes, 1);
+    return AJG_SUCCESS;
+}
+
+// ctrl-set-many, every listed numid gets the same values
+PUBLIC json_object *simulSetMany (AJG_session *session, AJG_request *request) {
+    json_object *numids, *ctrlvalue, *response = NULL;
+    AJG_simcard *card;
+    unsigned int index;
+
+    if ((card = simulProbe (session, request, &response)) == NULL) {
+        json_object_put (response);
+        return jsonNewMessage (AJG_FATAL,"Sound card [%s] has no 'name' element", request->cardid);
+    }
+
+    numids = request->data ? json_tokener_parse (request->data) : NULL;
+    ctrlvalue = request->args ? json_tokener_parse (request->args) : NULL;
+    if (!json_object_is_type (numids, json_type_array) || !json_object_is_type (ctrlvalue, json_type_array)) {
+        response = jsonNewMessage (AJG_FATAL,"sndcard=%s invalid json numids=%s or args array=%s", card->model->cardname, request->data, request->args);
+        goto OnExit;
+    }
+
+    for (index=0; index < json_object_array_length (numids); index++) {
+        if (simulSetValues (session, card, json_object_array_get_idx (numids, index), ctrlvalue, TRUE) != AJG_SUCCESS) {
+            response = jsonNewMessage (AJG_FAIL,"%s alsaSetManyCtrl:%d request refused numids=%s args=%s\n", card->model->cardname, index, request->data, request->args);
+            goto OnExit;
+        }
+    }
+    response = jsonNewStatus (AJG_SUCCESS);
+
+OnExit:
+    pthread_mutex_unlock (&card->lock);
+    if (numids) json_object_put (numids);
+    if (ctrlvalue) json_object_put (ctrlvalue);
+    return response;
+}
+
+// session-load, session controls are applied ignoring errors as on a real card [card already probed by caller].
+// Only controls differing from card are written unless request is forced. FALSE without simulated card
+PUBLIC int simulLoadSession (AJG_session *session, AJG_request *request, json_object *controls, AJG_loadcount *count) {
+    AJG_simcard *card;
+    unsigned int index;
+
+    if ((card = simulFind (session, request->cardid)) == NULL) return FALSE;
+
+    pthread_mutex_lock (&card->lock);
+    for (index=0; index < json_object_array_length (controls); index++) {
+        json_object *ctrlnumid = NULL, *ctrlvalue = NULL, *control = json_object_array_get_idx (controls, index);
+
+        json_object_object_get_ex (control, "numid", &ctrlnumid);
+        json_object_object_get_ex (control, "value", &ctrlvalue);
+        switch (simulSetValues (session, card, ctrlnumid, ctrlvalue, request->force)) {
+           case AJG_SUCCESS: count->written++; break;
+           case AJG_EMPTY:   count->skipped++; break;
+           default:          count->failed++;
+        }
+    }
+    pthread_mutex_unlock (&card->lock);
+    return TRUE;
+}
+
+// --fake-faults spec, comma separated key=value [read=2-20,read-tail=80@1,write-errors=2,removal=0.1,cardid=hw:18i8~3].
+// FALSE on invalid spec
+PUBLIC int simulSetFaults (AJG_session *session, const char *spec) {
+    static const char *operations [AJG_SIMUL_FAULTS] = {"probe", "read", "write", "tlv"};
+    AJG_simul *simul = session->simul;
+    char *copy, *item, *saveptr;
+    int op, valid = TRUE;
+
+    if (spec == NULL || spec[0] == '\0') return TRUE;
+
+    copy = strdup (spec);
+    for (item = strtok_r (copy, ",", &saveptr); item != NULL && valid; item = strtok_r (NULL, ",", &saveptr)) {
+        char *value = strchr (item, '=');
+        size_t len;
+
+        if (value == NULL) { valid = FALSE; break; }
+        *value++ = '\0';
+
+        if (!strcmp (item, "removal")) { valid = (sscanf (value, "%lf", &simul->removal) == 1); continue; }
+        if (!strcmp (item, "removal-time")) { valid = (sscanf (value, "%d", &simul->removaltime) == 1); continue; }
+        if (!strcmp (item, "cardid")) { free (simul->faultcard); simul->faultcard = strdup (value); continue; }
+
+        // <op>=min[-max] <op>-tail=ms@pct <op>-errors=pct
+        for (op=0; op < AJG_SIMUL_FAULTS; op++) {
+            len = strlen (operations[op]);
+            if (!strncmp (item, operations[op], len) && (item[len] == '\0' || item[len] == '-')) break;
+        }
+        if (op == AJG_SIMUL_FAULTS) { valid = FALSE; break; }
+
+        if (item[len] == '\0') {
+            int count = sscanf (value, "%d-%d", &simul->faults[op].min, &simul->faults[op].max);
+            if (count == 1) simul->faults[op].max = simul->faults[op].min;
+            valid = (count >= 1 && simul->faults[op].min >= 0 && simul->faults[op].max >= simul->faults[op].min);
+        } else if (!strcmp (&item[len], "-tail")) {
+            valid = (sscanf (value, "%d@%lf", &simul->faults[op].tail, &simul->faults[op].tailrate) == 2);
+        } else if (!strcmp (&item[len], "-errors")) {
+            valid = (sscanf (value, "%lf", &simul->faults[op].errors) == 1);
+        } else {
+            valid = FALSE;
+        }
+    }
+    if (!valid) fprintf (stderr, "AJG: invalid fake-faults [%s]\n", spec);
+    free (copy);
+
+    if (simul->removaltime <= 0) simul->removaltime = AJG_SIMUL_REMOVAL_TIME;
+    simul->faulty = valid;
+    return valid;
+}
+
+PUBLIC json_object *simulStats (AJG_session *session) {
+    static const char *operations [AJG_SIMUL_FAULTS] = {"probe", "read", "write", "tlv"};
+    AJG_simul *simul = session->simul;
+    json_object *statsJ = json_object_new_object();
+    unsigned long reads = 0, writes = 0;
+    AJG_simcard *card;
+    int bucket, op;
+
+    // counters are atomic, a card sleeping on a fault does not hold stats
+    pthread_mutex_lock (&simul->lock);
+    for (bucket=0; bucket < AJG_SIMUL_BUCKETS; bucket++) {
+        for (card = simul->buckets[bucket]; card != NULL; card = card->next) {
+            reads  += card->reads;
+            writes += card->writes;
+        }
+    }
+    json_object_object_add (statsJ, "cards" , json_object_new_int (simul->cards));
+    pthread_mutex_unlock (&simul->lock);
+    json_object_object_add (statsJ, "reads" , json_object_new_int64 (reads));
+    json_object_object_add (statsJ, "writes", json_object_new_int64 (writes));
+
+    if (simul->faulty) {
+        json_object *faultsJ = json_object_new_object();
+
+        for (op=0; op < AJG_SIMUL_FAULTS; op++) {
+            json_object *faultJ = json_object_new_object();
+
+            json_object_object_add (faultJ, "delayed", json_object_new_int64 (simul->faults[op].delayed));
+            json_object_object_add (faultJ, "failed" , json_object_new_int64 (simul->faults[op].failed));
+            json_object_object_add (faultsJ, operations[op], faultJ);
+        }
+        json_object_object_add (faultsJ, "removals", json_object_new_int64 (simul->removals));
+        json_object_object_add (statsJ, "faults", faultsJ);
+    }
+    return statsJ;
+}
@@ -0,0 +1,684 @@
+/*
+   alsajson-gw -- provide a REST/HTTP interface to ALSA-Mixer
+
+   Copyright (C) 2018, Fulup Ar Foll, Google LLC
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Object:
+    Realtime control change push through websocket [/jsonapi/ws].
+    Connection is upgraded by libmicrohttpd, then socket is handled by main
+    epoll loop. Clients send json text messages:
+
+     {"request":"subscribe", "cardid":"hw:0", "numids":[1,2,3]}  numids optional
+     {"request":"unsubscribe", "cardid":"hw:0"}                   cardid optional
+     {"request":"ctrl-set-one", "cardid":"hw:0", "numid":5, "value":"10,5"}
+     {"request":"ping-get"}
+
+    An optional "id" is echoed back within response. Each alsa value change is
+    pushed as {"cardid":"hw:0","numid":5,"value":[10,5]}. Change is serialized
+    and framed once, the same buffer is queued to every subscriber.
+
+    Only main loop reads sockets and closes clients. Queues and subscriptions
+    are protected by websock lock, changes may be queued from any worker.
+    Lock order is pool -> slot -> websock, websock lock is never held while
+    calling alsa.
+
+   References:
+   https://tools.ietf.org/html/rfc6455
+   https://www.gnu.org/software/libmicrohttpd/manual/html_node/microhttpd_002dupgrade.html
+*/
+
+#include <microhttpd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// proto missing from GCC
+char *strcasestr(const char *haystack, const char *needle);
+
+#include "local-def-ajg.h"
+
+#define AJG_WS_GUID   "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OPCODE_CONT   0x0
+#define WS_OPCODE_TEXT   0x1
+#define WS_OPCODE_CLOSE  0x8
+#define WS_OPCODE_PING   0x9
+#define WS_OPCODE_PONG   0xA
+
+#define WS_CLOSE_NORMAL      1000
+#define WS_CLOSE_PROTOCOL    1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOOBIG      1009
+
+#define WS_ROTL(value,bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+// minimal SHA1, only used to compute handshake accept key
+STATIC void wsockSha1 (const unsigned char *data, size_t len, unsigned char digest[20]) {
+    uint32_t hash[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint32_t words[80], a, b, c, d, e, f, k, tmp;
+    size_t padlen = ((len + 8) / 64 + 1) * 64;
+    uint64_t bitlen = (uint64_t)len * 8;
+    unsigned char *msg;
+    size_t block;
+    int idx;
+
+    msg = calloc (padlen, 1);
+    memcpy (msg, data, len);
+    msg[len] = 0x80;
+    for (idx=0; idx < 8; idx++) msg[padlen - 1 - idx] = (unsigned char)(bitlen >> (8 * idx));
+
+    for (block=0; block < padlen; block += 64) {
+        for (idx=0; idx < 16; idx++) {
+            words[idx] = (uint32_t)msg[block+idx*4] << 24 | (uint32_t)msg[block+idx*4+1] << 16 | (uint32_t)msg[block+idx*4+2] << 8 | msg[block+idx*4+3];
+        }
+        for (idx=16; idx < 80; idx++) words[idx] = WS_ROTL(words[idx-3] ^ words[idx-8] ^ words[idx-14] ^ words[idx-16], 1);
+
+        a = hash[0]; b = hash[1]; c = hash[2]; d = hash[3]; e = hash[4];
+        for (idx=0; idx < 80; idx++) {
+            if (idx < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (idx < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (idx < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else               { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            tmp = WS_ROTL(a, 5) + f + e + k + words[idx];
+            e = d; d = c; c = WS_ROTL(b, 30); b = a; a = tmp;
+        }
+        hash[0] += a; hash[1] += b; hash[2] += c; hash[3] += d; hash[4] += e;
+    }
+    free (msg);
+
+    for (idx=0; idx < 20; idx++) digest[idx] = (unsigned char)(hash[idx / 4] >> (24 - 8 * (idx % 4)));
+}
+
+STATIC void wsockBase64 (const unsigned char *data, size_t len, char *output) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t idx;
+    int out = 0;
+
+    for (idx=0; idx < len; idx += 3) {
+        uint32_t triple = (uint32_t)data[idx] << 16;
+        if (idx+1 < len) triple |= (uint32_t)data[idx+1] << 8;
+        if (idx+2 < len) triple |= data[idx+2];
+
+        output[out++] = table[(triple >> 18) & 0x3F];
+        output[out++] = table[(triple >> 12) & 0x3F];
+        output[out++] = (idx+1 < len) ? table[(triple >> 6) & 0x3F] : '=';
+        output[out++] = (idx+2 < len) ? table[triple & 0x3F] : '=';
+    }
+    output[out] = '\0';
+}
+
+// build a server frame [never masked], returned message is not yet referenced
+STATIC AJG_wsmsg *wsockFrame (int opcode, const char *payload, size_t len) {
+    AJG_wsmsg *msg;
+    size_t hdrlen;
+    int idx;
+
+    hdrlen = (len < 126) ? 2 : (len < 65536) ? 4 : 10;
+    msg = malloc (sizeof (AJG_wsmsg) + hdrlen + len);
+    msg->refcount = 0;
+    msg->len = hdrlen + len;
+
+    msg->frame[0] = (char)(0x80 | opcode); // single fragment
+    if (len < 126) {
+        msg->frame[1] = (char)len;
+    } else if (len < 65536) {
+        msg->frame[1] = 126;
+        msg->frame[2] = (char)(len >> 8);
+        msg->frame[3] = (char)len;
+    } else {
+        msg->frame[1] = 127;
+        for (idx=0; idx < 8; idx++) msg->frame[9-idx] = (char)((uint64_t)len >> (8 * idx));
+    }
+    memcpy (&msg->frame[hdrlen], payload, len);
+    return msg;
+}
+
+// [websock lock held]
+STATIC void wsockUnref (AJG_wsmsg *msg) {
+    if (--msg->refcount == 0) free (msg);
+}
+
+// ask main loop to watch socket for write [websock lock held]
+STATIC void wsockArmWrite (AJG_session *session, AJG_wsclient *client, int writing) {
+    if (client->writing == writing) return;
+    client->writing = writing;
+    eventMod (session, client->source, writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
+// drop every pending frame [websock lock held]
+STATIC void wsockPurge (AJG_wsclient *client) {
+    while (client->qcount > 0) {
+        wsockUnref (client->queue[client->qhead]);
+        client->qhead = (client->qhead + 1) % AJG_WS_QUEUE;
+        client->qcount--;
+    }
+    client->qoffset = 0;
+}
+
+// send as much as socket accepts without blocking [websock lock held]
+STATIC void wsockFlush (AJG_session *session, AJG_wsclient *client) {
+    ssize_t count;
+
+    while (client->qcount > 0) {
+        AJG_wsmsg *msg = client->queue[client->qhead];
+
+        count = send (client->fd, &msg->frame[client->qoffset], msg->len - client->qoffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+            wsockPurge (client);     // peer is gone, nothing more can be sent
+            client->closing = TRUE;  // main loop closes it on next wakeup
+            break;
+        }
+
+        client->qoffset += count;
+        if (client->qoffset < msg->len) continue;
+
+        wsockUnref (msg);
+        client->qhead = (client->qhead + 1) % AJG_WS_QUEUE;
+        client->qcount--;
+        client->qoffset = 0;
+    }
+
+    // main loop has to finish writing or closing
+    wsockArmWrite (session, client, client->qcount > 0 || client->closing);
+}
+
+// queue a frame to one client [websock lock held]
+STATIC void wsockQueue (AJG_session *session, AJG_wsclient *client, AJG_wsmsg *msg) {
+
+    if (client->closing) return;
+
+    // client does not read its socket, stop feeding it
+    if (client->qcount == AJG_WS_QUEUE) {
+        if (verbose) fprintf (stderr, "AJG:websock fd=%d queue full, client dropped\n", client->fd);
+        session->websock->dropped++;
+        wsockPurge (client);
+        client->closing = TRUE;
+        wsockArmWrite (session, client, TRUE);
+        return;
+    }
+
+    msg->refcount++;
+    client->queue[(client->qhead + client->qcount) % AJG_WS_QUEUE] = msg;
+    client->qcount++;
+    session->websock->frames++;
+
+    // a partial write is pending, main loop will continue
+    if (client->qcount == 1) wsockFlush (session, client);
+}
+
+// queue a json message to one client [websock lock held]
+STATIC void wsockQueueJson (AJG_session *session, AJG_wsclient *client, json_object *jsonMsg) {
+    const char *serialized = json_object_to_json_string_ext (jsonMsg, JSON_C_TO_STRING_PLAIN);
+    AJG_wsmsg *msg = wsockFrame (WS_OPCODE_TEXT, serialized, strlen (serialized));
+
+    msg->refcount++;   // keep message until queued
+    wsockQueue (session, client, msg);
+    wsockUnref (msg);
+}
+
+// start closing handshake [websock lock held]
+STATIC void wsockQueueClose (AJG_session *session, AJG_wsclient *client, int status) {
+    char payload[2];
+    AJG_wsmsg *msg;
+
+    payload[0] = (char)(status >> 8);
+    payload[1] = (char)status;
+    msg = wsockFrame (WS_OPCODE_CLOSE, payload, sizeof (payload));
+
+    msg->refcount++;
+    wsockQueue (session, client, msg);
+    wsockUnref (msg);
+    client->closing = TRUE;
+    wsockArmWrite (session, client, TRUE);
+}
+
+STATIC void wsockFreeSub (AJG_wssub *sub) {
+    free (sub->cardid);
+    free (sub->numids);
+    free (sub);
+}
+
+// release client and give socket back to MHD [main loop, websock lock held]
+STATIC void wsockClose (AJG_session *session, AJG_wsclient *client) {
+    AJG_websock *websock = session->websock;
+    AJG_wsclient **prev;
+
+    if (verbose) fprintf (stderr, "AJG:websock fd=%d closed\n", client->fd);
+
+    for (prev = &websock->clients; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == client) {
+            *prev = client->next;
+            break;
+        }
+    }
+    websock->connected--;
+
+    eventDel (session, client->source);
+    wsockPurge (client);
+    while (client->subs) {
+        AJG_wssub *next = client->subs->next;
+        wsockFreeSub (client->subs);
+        client->subs = next;
+    }
+
+    MHD_upgrade_action (client->urh, MHD_UPGRADE_ACTION_CLOSE);
+    free (client);
+}
+
+// does client subscription cover this control [websock lock held]
+STATIC int wsockMatch (AJG_wsclient *client, const char *cardid, int numid) {
+    AJG_wssub *sub;
+    int idx;
+
+    for (sub = client->subs; sub != NULL; sub = sub->next) {
+        if (strcmp (sub->cardid, cardid)) continue;
+        if (sub->numids == NULL) return TRUE;
+        for (idx=0; idx < sub->count; idx++) if (sub->numids[idx] == numid) return TRUE;
+    }
+    return FALSE;
+}
+
+// record subscription then make sure card events are flowing
+STATIC json_object *wsockSubscribe (AJG_session *session, AJG_wsclient *client, const char *cardid, json_object *numidsJ) {
+    AJG_websock *websock = session->websock;
+    AJG_cardslot *slot;
+    AJG_wssub *sub;
+    int err, idx;
+
+    if (cardid == NULL) return jsonNewMessage (AJG_FAIL, "websocket subscribe missing cardid");
+    if (session->fakemod) return jsonNewMessage (AJG_FAIL, "websocket subscribe not available in fakemod");
+
+    // card should exist and have its element list loaded to receive events
+    slot = poolGetCard (session, cardid, &err);
+    if (slot == NULL) return jsonNewMessage (AJG_FAIL, "websocket subscribe cardid=%s error=%s", cardid, strerror(-err));
+    if ((err = poolLoadCard (session, slot)) < 0) {
+        poolReleaseCard (session, slot);
+        return jsonNewMessage (AJG_FAIL, "websocket subscribe cardid=%s load error=%s", cardid, strerror(-err));
+    }
+
+    sub = malloc (sizeof (AJG_wssub));
+    memset (sub, 0, sizeof (AJG_wssub));
+    sub->cardid = strdup (cardid);
+    if (numidsJ && json_object_is_type (numidsJ, json_type_array)) {
+        sub->count  = json_object_array_length (numidsJ);
+        sub->numids = malloc (sizeof (int) * (sub->count +1));
+        for (idx=0; idx < sub->count; idx++) sub->numids[idx] = json_object_get_int (json_object_array_get_idx (numidsJ, idx));
+    }
+
+    // changes processed while subscribing are still sent, subscription is registered before card is released
+    pthread_mutex_lock (&websock->lock);
+    {
+        AJG_wssub **prev;
+        for (prev = &client->subs; *prev != NULL; prev = &(*prev)->next) {
+            if (!strcmp ((*prev)->cardid, cardid)) {
+                AJG_wssub *old = *prev;
+                *prev = old->next;
+                wsockFreeSub (old);
+                break;
+            }
+        }
+    }
+    sub->next = client->subs;
+    client->subs = sub;
+    pthread_mutex_unlock (&websock->lock);
+
+    poolReleaseCard (session, slot);
+    return jsonNewMessage (AJG_SUCCESS, "subscribed cardid=%s numids=%d", cardid, sub->numids ? sub->count : -1);
+}
+
+STATIC json_object *wsockUnsubscribe (AJG_session *session, AJG_wsclient *client, const char *cardid) {
+    AJG_wssub **prev;
+
+    pthread_mutex_lock (&session->websock->lock);
+    prev = &client->subs;
+    while (*prev != NULL) {
+        AJG_wssub *sub = *prev;
+        if (cardid == NULL || !strcmp (sub->cardid, cardid)) {
+            *prev = sub->next;
+            wsockFreeSub (sub);
+        } else prev = &sub->next;
+    }
+    pthread_mutex_unlock (&session->websock->lock);
+
+    return jsonNewMessage (AJG_SUCCESS, "unsubscribed cardid=%s", cardid ? cardid : "all");
+}
+
+// same as REST ctrl-set-one, value may be a string "10,5" or an array [10,5]
+STATIC json_object *wsockSetCtrl (AJG_session *session, json_object *cmdJ, const char *cardid) {
+    json_object *tmpJ, *response;
+    AJG_request request;
+    char values[256];
+
+    memset (&request, 0, sizeof (request));
+    request.cardid = cardid;
+    request.numid  = -1;
+    request.quiet  = 1;
+    if (json_object_object_get_ex (cmdJ, "numid", &tmpJ)) request.numid = json_object_get_int (tmpJ);
+    if (json_object_object_get_ex (cmdJ, "quiet", &tmpJ)) request.quiet = json_object_get_int (tmpJ);
+
+    if (json_object_object_get_ex (cmdJ, "value", &tmpJ)) {
+        if (json_object_is_type (tmpJ, json_type_array)) {
+            int idx, len = 0;
+            values[0] = '\0';
+            for (idx=0; idx < (int)json_object_array_length (tmpJ) && len < (int)sizeof (values); idx++) {
+                len += snprintf (&values[len], sizeof (values) - len, "%s%d", idx ? "," : "", json_object_get_int (json_object_array_get_idx (tmpJ, idx)));
+            }
+            request.args = values;
+        } else {
+            request.args = json_object_get_string (tmpJ);
+        }
+    }
+
+    response = alsaSetOneCtrl (session, &request);
+    if (request.cardname) free (request.cardname);
+    poolReleaseCard (session, request.cardslot);
+    return response;
+}
+
+// process one client text message [main loop, websock lock not held]
+STATIC void wsockCommand (AJG_session *session, AJG_wsclient *client, const char *text) {
+    json_object *cmdJ, *tmpJ, *idJ = NULL, *numidsJ = NULL, *response;
+    const char *query = NULL, *cardid = NULL;
+
+    cmdJ = json_tokener_parse (text);
+    if (cmdJ == NULL || !json_object_is_type (cmdJ, json_type_object)) {
+        response = jsonNewMessage (AJG_FAIL, "websocket invalid json message");
+        goto SendResponse;
+    }
+
+    if (json_object_object_get_ex (cmdJ, "request", &tmpJ)) query  = json_object_get_string (tmpJ);
+    if (json_object_object_get_ex (cmdJ, "cardid" , &tmpJ)) cardid = json_object_get_string (tmpJ);
+    (void) json_object_object_get_ex (cmdJ, "id", &idJ);
+
+    if (query == NULL) {
+        response = jsonNewMessage (AJG_FAIL, "websocket missing request");
+    } else if (!strcmp (query, "subscribe")) {
+        (void) json_object_object_get_ex (cmdJ, "numids", &numidsJ);
+        response = wsockSubscribe (session, client, cardid, numidsJ);
+    } else if (!strcmp (query, "unsubscribe")) {
+        response = wsockUnsubscribe (session, client, cardid);
+    } else if (!strcmp (query, "ctrl-set-one")) {
+        response = wsockSetCtrl (session, cmdJ, cardid);
+    } else if (!strcmp (query, "ping-get")) {
+        response = jsonNewMessage (AJG_SUCCESS, "pong");
+    } else {
+        response = jsonNewMessage (AJG_FAIL, "websocket unknown request=%s", query);
+    }
+
+    if (idJ) json_object_object_add (response, "id", json_object_get (idJ));
+
+SendResponse:
+    pthread_mutex_lock (&session->websock->lock);
+    wsockQueueJson (session, client, response);
+    pthread_mutex_unlock (&session->websock->lock);
+
+    json_object_put (response);
+    if (cmdJ) json_object_put (cmdJ);
+}
+
+// decode every complete frame from input buffer [main loop]
+STATIC void wsockParse (AJG_session *session, AJG_wsclient *client) {
+    unsigned char *buffer = (unsigned char*) client->inbuf;
+    uint64_t paylen;
+    size_t hdrlen, idx;
+    int opcode, status = 0;
+
+    while (client->inlen >= 2 && !client->closing) {
+        opcode = buffer[0] & 0x0F;
+        paylen = buffer[1] & 0x7F;
+        hdrlen = 2;
+
+        if (paylen == 126) {
+            if (client->inlen < 4) return;
+            paylen = (uint64_t)buffer[2] << 8 | buffer[3];
+            hdrlen = 4;
+        } else if (paylen == 127) {
+            if (client->inlen < 10) return;
+            for (paylen=0, idx=2; idx < 10; idx++) paylen = paylen << 8 | buffer[idx];
+            hdrlen = 10;
+        }
+
+        // rfc6455 client frames are always masked
+        if (!(buffer[1] & 0x80)) { status = WS_CLOSE_PROTOCOL; break; }
+        hdrlen += 4;
+
+        if (paylen >= AJG_WS_INSIZE - hdrlen) { status = WS_CLOSE_TOOBIG; break; }
+        if (client->inlen < hdrlen + paylen) return; // wait for remaining data
+
+        for (idx=0; idx < paylen; idx++) buffer[hdrlen + idx] ^= buffer[hdrlen - 4 + (idx % 4)];
+
+        // fragmented messages are not used for json commands
+        if (!(buffer[0] & 0x80) || opcode == WS_OPCODE_CONT) { status = WS_CLOSE_UNSUPPORTED; break; }
+
+        switch (opcode) {
+          case WS_OPCODE_TEXT: {
+              char text [AJG_WS_INSIZE];
+              memcpy (text, &buffer[hdrlen], paylen);
+              text[paylen] = '\0';
+              wsockCommand (session, client, text);
+              break;
+          }
+          case WS_OPCODE_PING: {
+              AJG_wsmsg *msg = wsockFrame (WS_OPCODE_PONG, (char*)&buffer[hdrlen], paylen);
+              pthread_mutex_lock (&session->websock->lock);
+              msg->refcount++;
+              wsockQueue (session, client, msg);
+              wsockUnref (msg);
+              pthread_mutex_unlock (&session->websock->lock);
+              break;
+          }
+          case WS_OPCODE_PONG:
+              break;
+          case WS_OPCODE_CLOSE:
+              status = WS_CLOSE_NORMAL;
+              break;
+          default:
+              status = WS_CLOSE_UNSUPPORTED;
+              break;
+        }
+
+        client->inlen -= hdrlen + paylen;
+        memmove (buffer, &buffer[hdrlen + paylen], client->inlen);
+        if (status) break;
+    }
+
+    if (status) {
+        if (verbose) fprintf (stderr, "AJG:websock fd=%d closing status=%d\n", client->fd, status);
+        pthread_mutex_lock (&session->websock->lock);
+        wsockQueueClose (session, client, status);
+        pthread_mutex_unlock (&session->websock->lock);
+        client->inlen = 0;
+    }
+}
+
+// socket activity [main loop]
+STATIC void wsockEventCB (AJG_session *session, AJG_evsource *source, uint32_t revents) {
+    AJG_wsclient *client = source->context;
+    ssize_t count;
+    int closed = FALSE;
+
+    if (revents & (EPOLLERR | EPOLLHUP)) closed = TRUE;
+
+    // read everything available, frames are decoded once socket is empty
+    while (!closed && (revents & EPOLLIN) && client->inlen < AJG_WS_INSIZE) {
+        count = recv (client->fd, &client->inbuf[client->inlen], AJG_WS_INSIZE - client->inlen, MSG_DONTWAIT);
+        if (count == 0) closed = TRUE;
+        if (count <= 0) break;
+        client->inlen += count;
+    }
+    if (!closed) wsockParse (session, client);
+
+    pthread_mutex_lock (&session->websock->lock);
+    if (!closed) wsockFlush (session, client);
+    if (closed || (client->closing && client->qcount == 0)) wsockClose (session, client);
+    pthread_mutex_unlock (&session->websock->lock);
+}
+
+// MHD gave us the socket, from now on it is handled by main loop [may run from a worker]
+STATIC void wsockUpgrade (void *cls, struct MHD_Connection *connection, void *con_cls, const char *extra_in, size_t extra_in_size, MHD_socket sock, struct MHD_UpgradeResponseHandle *urh) {
+    AJG_session *session = cls;
+    AJG_websock *websock = session->websock;
+    AJG_wsclient *client;
+
+    if (extra_in_size > AJG_WS_INSIZE) {
+        MHD_upgrade_action (urh, MHD_UPGRADE_ACTION_CLOSE);
+        return;
+    }
+
+    client = malloc (sizeof (AJG_wsclient));
+    memset (client, 0, sizeof (AJG_wsclient));
+    client->fd  = sock;
+    client->urh = urh;
+    client->inlen = extra_in_size;
+    if (extra_in_size) memcpy (client->inbuf, extra_in, extra_in_size);
+    fcntl (sock, F_SETFL, fcntl (sock, F_GETFL) | O_NONBLOCK);
+
+    // hold lock until source is set, main loop may call us back immediately
+    pthread_mutex_lock (&websock->lock);
+    client->source = eventAdd (session, sock, EPOLLIN, wsockEventCB, client);
+    if (client->source == NULL) {
+        pthread_mutex_unlock (&websock->lock);
+        MHD_upgrade_action (urh, MHD_UPGRADE_ACTION_CLOSE);
+        free (client);
+        return;
+    }
+    client->next = websock->clients;
+    websock->clients = client;
+    websock->connected++;
+    websock->accepted++;
+
+    // data received with handshake, let main loop decode it
+    if (client->inlen) wsockArmWrite (session, client, TRUE);
+    pthread_mutex_unlock (&websock->lock);
+
+    if (verbose) fprintf (stderr, "AJG:websock fd=%d connected\n", sock);
+}
+
+PUBLIC void wsockInit (AJG_session *session) {
+    session->websock = malloc (sizeof (AJG_websock));
+    memset (session->websock, 0, sizeof (AJG_websock));
+    pthread_mutex_init (&session->websock->lock, NULL);
+}
+
+// check websocket handshake and ask MHD to upgrade connection
+PUBLIC int wsockRequest (void *handle, AJG_session *session, const char *method) {
+    struct MHD_Connection *connection = handle;
+    const char *upgrade, *version, *key;
+    unsigned char digest[20];
+    char keyguid[128], accept[32];
+    struct MHD_Response *response;
+    json_object *errMessage;
+    const char *serialized;
+    int ret;
+
+    upgrade = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_UPGRADE);
+    version = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, "Sec-WebSocket-Version");
+    key     = MHD_lookup_connection_value (connection, MHD_HEADER_KIND, "Sec-WebSocket-Key");
+
+    if (strcmp (method, MHD_HTTP_METHOD_GET) || upgrade == NULL || strcasestr (upgrade, "websocket") == NULL
+        || version == NULL || strcmp (version, "13") || key == NULL || strlen (key) > sizeof (keyguid) - sizeof (AJG_WS_GUID)) {
+        errMessage = jsonNewMessage (AJG_FAIL, "Invalid websocket handshake upgrade=%s version=%s", upgrade, version);
+        serialized = json_object_to_json_string (errMessage);
+        response = MHD_create_response_from_buffer (strlen (serialized), (void*)serialized, MHD_RESPMEM_MUST_COPY);
+        ret = MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
+        MHD_destroy_response (response);
+        json_object_put (errMessage);
+        return ret;
+    }
+
+    // Sec-WebSocket-Accept = base64 (sha1 (key + guid))
+    snprintf (keyguid, sizeof (keyguid), "%s%s", key, AJG_WS_GUID);
+    wsockSha1 ((unsigned char*)keyguid, strlen (keyguid), digest);
+    wsockBase64 (digest, sizeof (digest), accept);
+
+    response = MHD_create_response_for_upgrade (wsockUpgrade, session);
+    MHD_add_response_header (response, MHD_HTTP_HEADER_UPGRADE, "websocket");
+    MHD_add_response_header (response, "Sec-WebSocket-Accept", accept);
+    ret = MHD_queue_response (connection, MHD_HTTP_SWITCHING_PROTOCOLS, response);
+    MHD_destroy_response (response);
+    return ret;
+}
+
+// push a changed control to its subscribers [slot lock held]
+PUBLIC void wsockNotify (AJG_session *session, AJG_cardslot *slot, AJG_sndctrl *ctrl) {
+    AJG_websock *websock = session->websock;
+    AJG_wsclient *client;
+    AJG_jbuf jbuf;
+    AJG_wsmsg *msg;
+    int subscribed = FALSE;
+
+    if (websock->connected == 0) return;
+
+    pthread_mutex_lock (&websock->lock);
+    for (client = websock->clients; client != NULL && !subscribed; client = client->next) {
+        subscribed = wsockMatch (client, slot->cardid, ctrl->numid);
+    }
+    pthread_mutex_unlock (&websock->lock);
+    if (!subscribed) return;
+
+    // read value once, serialize and frame once for every subscriber
+    jbufInit (&jbuf, TRUE);
+    if (!alsaWriteChange (session, ctrl, &jbuf, slot->cardid) || jbuf.failed) {
+        jbufFree (&jbuf);
+        return;
+    }
+    msg = wsockFrame (WS_OPCODE_TEXT, jbuf.data, jbuf.len);
+    jbufFree (&jbuf);
+
+    pthread_mutex_lock (&websock->lock);
+    msg->refcount++;
+    websock->messages++;
+    for (client = websock->clients; client != NULL; client = client->next) {
+        if (wsockMatch (client, slot->cardid, ctrl->numid)) wsockQueue (session, client, msg);
+    }
+    wsockUnref (msg);
+    pthread_mutex_unlock (&websock->lock);
+}
+
+// used by pool to keep watched cards open
+PUBLIC int wsockWatching (AJG_session *session, const char *cardid) {
+    AJG_websock *websock = session->websock;
+    AJG_wsclient *client;
+    AJG_wssub *sub;
+    int watching = FALSE;
+
+    if (websock->connected == 0) return FALSE;
+
+    pthread_mutex_lock (&websock->lock);
+    for (client = websock->clients; client != NULL && !watching; client = client->next) {
+        for (sub = client->subs; sub != NULL; sub = sub->next) {
+            if (!strcmp (sub->cardid, cardid)) { watching = TRUE; break; }
+        }
+    }
+    pthread_mutex_unlock (&websock->lock);
+    return watching;
+}
+
+PUBLIC json_object *wsockStats (AJG_session *session) {
+    AJG_websock *websock = session->websock;
+    json_object *statsJ = json_object_new_object();
+
+    pthread_mutex_lock (&websock->lock);
+    json_object_object_add (statsJ, "connected", json_object_new_int64 (websock->connected));
+    json_object_object_add (statsJ, "accepted" , json_object_new_int64 (websock->accepted));
+    json_object_object_add (statsJ, "messages" , json_object_new_int64 (websock->messages));
+    json_object_object_add (statsJ, "frames"   , json_object_new_int64 (websock->frames));
+    json_object_object_add (statsJ, "dropped"  , json_object_new_int64 (websock->dropped));
+    pthread_mutex_unlock (&websock->lock);
+
+    return statsJ;
+}
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+# Object: fader drag benchmark, times ctrl-set-one&quiet=0 sent at UI fader rate [30-60Hz]
+#   values sweep min..max..min like a dragged fader on one keep-alive connection, each response
+#   has to return the written values. Run it against fakemod or the ajg ctl plugin card:
+#     ajg-daemon --fakemod --port=1234 ; ajg-fader-bench.py --cardid=hw:18i8
+#     ajg-daemon --port=1234 [ctl.ajg18i8 in ~/.asoundrc] ; ajg-fader-bench.py --cardid=ajg18i8
+#   Target: p99 <= 5ms and no request over one frame [16.7ms at 60Hz], a write answers
+#   before the next one is sent so fader drags never queue. Exit status 1 when target is missed.
+# Author: Fulup Ar Foll
+# Copyright: GPL v2, same as AlsaJsonGateway
+
+import argparse, http.client, json, sys, time, urllib.parse
+
+parser = argparse.ArgumentParser (description="time ctrl-set-one quiet=0 at fader rate")
+parser.add_argument ("--host", default="localhost")
+parser.add_argument ("--port", type=int, default=1234)
+parser.add_argument ("--cardid", default="hw:18i8")
+parser.add_argument ("--numid", type=int, help="writable INTEGER control [default first one with TLV]")
+parser.add_argument ("--rate", type=float, default=60, help="requests per second [default 60]")
+parser.add_argument ("--seconds", type=float, default=10)
+parser.add_argument ("--target-p99", type=float, default=5.0, help="ms [default 5]")
+parser.add_argument ("--target-max", type=float, help="ms [default one frame, 1000/rate]")
+options = parser.parse_args ()
+if options.target_max is None: options.target_max = 1000.0 / options.rate
+
+connection = http.client.HTTPConnection (options.host, options.port, timeout=5)
+
+def request (**args):
+    connection.request ("GET", "/jsonapi?" + urllib.parse.urlencode (args, safe=":,"))
+    response = connection.getresponse ()
+    return json.loads (response.read ().decode ())
+
+# fader to drag, writable integer control with a range [a dB scaled one when any]
+controls = request (request="ctrl-get-all", cardid=options.cardid, quiet=0).get ("data")
+if not controls:
+    sys.exit ("cardid=%s has no controls, is the daemon running on port %d?" % (options.cardid, options.port))
+faders = [ctrl for ctrl in controls if ctrl.get ("ctrl", {}).get ("type") == "INTEGER" and ctrl.get ("acl", {}).get ("write")
+    and ctrl["ctrl"].get ("max", 0) > ctrl["ctrl"].get ("min", 0) and (options.numid is None or ctrl["numid"] == options.numid)]
+faders.sort (key=lambda ctrl: ("tlv" not in ctrl, ctrl["numid"]))
+if not faders:
+    sys.exit ("cardid=%s has no writable INTEGER control%s" % (options.cardid, " numid=%d" % options.numid if options.numid else ""))
+fader = faders[0]
+low, high, count = fader["ctrl"]["min"], fader["ctrl"]["max"], fader["ctrl"].get ("count", 1)
+print ("cardid=%s numid=%d [%s] %d..%d at %gHz for %gs" % (options.cardid, fader["numid"], fader["name"], low, high, options.rate, options.seconds))
+
+latencies, wrong, late = [], 0, 0
+period = 1.0 / options.rate
+value, direction = low, 1
+start = tick = time.monotonic ()
+
+while tick - start < options.seconds:
+    values = [value] * count
+    sent = time.monotonic ()
+    response = request (request="ctrl-set-one", cardid=options.cardid, numid=fader["numid"], quiet=0, value=",".join (map (str, values)))
+    latencies.append ((time.monotonic () - sent) * 1000)
+    if (response.get ("data") or [{}])[0].get ("value") != values: wrong += 1
+
+    if value + direction > high or value + direction < low: direction = -direction
+    value += direction
+
+    # fixed rate like a UI, a response later than next tick delays it
+    tick += period
+    now = time.monotonic ()
+    if now > tick: late += 1
+    else: time.sleep (tick - now)
+
+latencies.sort ()
+def percentile (rank): return latencies[min (len (latencies) - 1, int (len (latencies) * rank / 100))]
+p99 = percentile (99)
+success = p99 <= options.target_p99 and latencies[-1] <= options.target_max and wrong == 0
+
+print ("requests=%d wrong-values=%d late-ticks=%d" % (len (latencies), wrong, late))
+print ("latency ms: p50=%.2f p95=%.2f p99=%.2f max=%.2f" % (percentile (50), percentile (95), p99, latencies[-1]))
+print ("target p99<=%.2fms max<=%.2fms: %s" % (options.target_p99, options.target_max,
+    "OK" if success else "MISSED"))
+sys.exit (0 if success else 1)
@@ -22,16 +22,16 @@ License: Apache
 Summary: HTTP REST/JSON Gateway to ALSA mixer service for HTML5 UI
 Url:     https://github.com/fulup-bzh/AlsaJsonGateway
 Source:  https://github.com/fulup-bzh/AlsaJsonGateway/archive/master.tar.gz
-#BuildRequires: libjson-c-devel, libmicrohttpd-devel, alsa-lib-devel
+#BuildRequires: libjson-c-devel, libmicrohttpd-devel >= 0.9.63, alsa-lib-devel, zlib-devel
 
 BuildRoot:      %{_tmppath}/%{name}-%{version}-build
 Provides: ajg-daemon
 Prefix: /opt/ajg-daemon
 
 %if 0%{?suse_version}
-BuildRequires: pkg-config, libjson-c-devel, libmicrohttpd-devel, alsa-lib-devel
+BuildRequires: pkg-config, libjson-c-devel, libmicrohttpd-devel >= 0.9.63, alsa-lib-devel, zlib-devel
 %else
-BuildRequires:pkg-config, json-c-devel, libmicrohttpd-devel, alsa-lib-devel
+BuildRequires:pkg-config, json-c-devel, libmicrohttpd-devel >= 0.9.63, alsa-lib-devel, zlib-devel
 %endif
 
 %description 